@@ -0,0 +1,88 @@
+#include "AdafruitIOTelemetry.h"
+#include "PublishScheduler.h"
+#include "Outbox.h"
+#include "Logger.h"
+#include "config.h"
+
+status_t AdafruitIOTelemetry::connect()
+{
+    // The connection is shared with config and brought up by SystemManager,
+    // the scheduler stores readings in the outbox while it is down
+    return STATUS_OK;
+}
+
+status_t AdafruitIOTelemetry::publish(const SensorSnapshot &snapshot)
+{
+    status_t rc = STATUS_OK;
+
+    struct {
+        const char *topic;
+        double value;
+        bool valid;
+    } readings[] = {
+        { AIO_FEED_TOPIC("co2"), snapshot.co2Ppm, snapshot.co2Valid },
+        { AIO_FEED_TOPIC("air-temperature"), snapshot.airTempCelsius, snapshot.airValid },
+        { AIO_FEED_TOPIC("air-humidity"), snapshot.airHumidityPercent, snapshot.airValid },
+        { AIO_FEED_TOPIC("battery-soc"), snapshot.batterySocPercent, snapshot.batteryValid },
+        { AIO_FEED_TOPIC("battery-cell-voltage"), snapshot.batteryVoltageV, snapshot.batteryValid },
+        { AIO_FEED_TOPIC("soil-temperature"), snapshot.soilTempCelsius, snapshot.soilValid },
+        { AIO_FEED_TOPIC("soil-moisture"), snapshot.soilMoisturePercent, snapshot.soilValid },
+        // Logging of an invalid water level happens when it is measured
+        { AIO_FEED_TOPIC("water-level"), snapshot.waterLevelPercent, snapshot.waterLevelValid },
+        { AIO_FEED_TOPIC("solar-panel-voltage"), snapshot.solarPanelVoltageV, snapshot.solarValid },
+        { AIO_FEED_TOPIC("solar-panel-current"), snapshot.solarPanelCurrentmA, snapshot.solarValid },
+        { AIO_FEED_TOPIC("solar-panel-power"), snapshot.solarPanelPowermW, snapshot.solarValid },
+    };
+
+    // Keep going past a failed feed so one bad publish doesn't lose the rest
+    for (auto &reading : readings) {
+        if (!reading.valid) {
+            continue;
+        }
+
+        LOG_INFO("Sending " + String(reading.topic)
+                 + " val: " + String(reading.value));
+        if (gPublishScheduler.publish(reading.topic, reading.value,
+                                      PublishScheduler::PRIORITY_TELEMETRY) != STATUS_OK) {
+            LOG_ERROR("Failed to publish " + String(reading.topic));
+            if (rc == STATUS_OK) {
+                rc = STATUS_FAIL;
+            }
+        }
+    }
+
+    if (snapshot.lastWakeEnergyValid && publishWakeEnergy(snapshot.lastWakeEnergy) != STATUS_OK) {
+        rc = STATUS_FAIL;
+    }
+
+    return rc;
+}
+
+status_t AdafruitIOTelemetry::publishWakeEnergy(const WakeEnergy &wake)
+{
+    status_t rc = STATUS_OK;
+
+    if (gPublishScheduler.publish(AIO_FEED_TOPIC("wake-energy"), wake.totalMj,
+                                  PublishScheduler::PRIORITY_TELEMETRY) != STATUS_OK) {
+        LOG_ERROR("Failed to publish wake energy");
+        rc = STATUS_FAIL;
+    }
+
+    // One feed for all the phases, comma separated in EnergyPhase order,
+    // rather than a feed and a publish each
+    char phases[OUTBOX_MAX_PAYLOAD_LEN + 1];
+    size_t len = 0;
+    for (int i = 0; i < ENERGY_NUM_PHASES && len < sizeof(phases); ++i) {
+        len += snprintf(phases + len, sizeof(phases) - len, "%s%lu", i == 0 ? "" : ",",
+                        (unsigned long)(wake.phaseMj[i] + 0.5f));
+    }
+
+    LOG_INFO("Sending wake energy " + String(wake.totalMj, 0) + " mJ, phases " + String(phases));
+    if (gPublishScheduler.publish(AIO_FEED_TOPIC("wake-energy-phases"), phases,
+                                  PublishScheduler::PRIORITY_TELEMETRY) != STATUS_OK) {
+        LOG_ERROR("Failed to publish wake energy phases");
+        rc = STATUS_FAIL;
+    }
+
+    return rc;
+}
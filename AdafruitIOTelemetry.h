@@ -0,0 +1,36 @@
+#ifndef ADAFRUITIOTELEMETRY_H_H3KX7QDM
+#define ADAFRUITIOTELEMETRY_H_H3KX7QDM
+
+#include "TelemetryBackend.h"
+
+/*! \class AdafruitIOTelemetry
+ *  \brief Publishes each reading to its own Adafruit IO feed, as text
+ *
+ *  Shares the Adafruit IO MQTT connection used for config, and goes through
+ *  the publish scheduler so readings are rate limited and stored in the
+ *  outbox when they can't be sent. Feed topics are string literals, there
+ *  are no per feed objects.
+ */
+class AdafruitIOTelemetry : public TelemetryBackend
+{
+public:
+    const char *getName() override { return "Adafruit IO"; }
+
+    status_t connect() override;
+
+    /**
+     * @brief Publish every reading, continuing past failed feeds
+     *
+     * @return The first failure, STATUS_OK if all readings were published
+     */
+    status_t publish(const SensorSnapshot &snapshot) override;
+
+protected:
+    /**
+     * @brief Publish the energy the previous wake used, to wake-energy and
+     * per phase to wake-energy-phases
+     */
+    status_t publishWakeEnergy(const WakeEnergy &wake);
+};
+
+#endif /* end of include guard: ADAFRUITIOTELEMETRY_H_H3KX7QDM */
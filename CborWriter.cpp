@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "CborWriter.h"
+
+CborWriter::CborWriter(uint8_t *buffer, size_t size) :
+    _buffer(buffer),
+    _size(size),
+    _len(0),
+    _overflowed(false)
+{ }
+
+void CborWriter::writeByte(uint8_t byte)
+{
+    if (_len >= _size) {
+        _overflowed = true;
+        return;
+    }
+
+    _buffer[_len++] = byte;
+}
+
+void CborWriter::writeBigEndian(uint64_t value, uint8_t numBytes)
+{
+    for (int shift = (numBytes - 1) * 8; shift >= 0; shift -= 8) {
+        writeByte((value >> shift) & 0xFF);
+    }
+}
+
+void CborWriter::writeHead(uint8_t majorType, uint64_t argument)
+{
+    uint8_t type = majorType << 5;
+
+    // Arguments use the smallest encoding that fits
+    if (argument < ADDITIONAL_UINT8) {
+        writeByte(type | argument);
+    } else if (argument <= 0xFF) {
+        writeByte(type | ADDITIONAL_UINT8);
+        writeBigEndian(argument, 1);
+    } else if (argument <= 0xFFFF) {
+        writeByte(type | ADDITIONAL_UINT16);
+        writeBigEndian(argument, 2);
+    } else if (argument <= 0xFFFFFFFF) {
+        writeByte(type | ADDITIONAL_UINT32);
+        writeBigEndian(argument, 4);
+    } else {
+        writeByte(type | ADDITIONAL_UINT64);
+        writeBigEndian(argument, 8);
+    }
+}
+
+void CborWriter::beginMap()
+{
+    writeByte((MAJOR_TYPE_MAP << 5) | ADDITIONAL_INDEFINITE);
+}
+
+void CborWriter::endMap()
+{
+    writeByte((MAJOR_TYPE_SIMPLE << 5) | SIMPLE_BREAK);
+}
+
+void CborWriter::addUint(uint64_t value)
+{
+    writeHead(MAJOR_TYPE_UINT, value);
+}
+
+void CborWriter::addText(const char *text)
+{
+    size_t len = strlen(text);
+
+    writeHead(MAJOR_TYPE_TEXT, len);
+    for (size_t i = 0; i < len; ++i) {
+        writeByte(text[i]);
+    }
+}
+
+void CborWriter::addFloat(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    writeByte((MAJOR_TYPE_SIMPLE << 5) | SIMPLE_FLOAT32);
+    writeBigEndian(bits, 4);
+}
+
+size_t CborWriter::length()
+{
+    return _len;
+}
+
+bool CborWriter::hasOverflowed()
+{
+    return _overflowed;
+}
@@ -0,0 +1,71 @@
+#ifndef CBORWRITER_H_9DFU3YRB
+#define CBORWRITER_H_9DFU3YRB
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*! \class CborWriter
+ *  \brief Minimal CBOR (RFC 8949) encoder writing into a fixed buffer
+ *
+ *  Only what the telemetry snapshots need, maps with text keys and unsigned
+ *  and float values. Floats are encoded as single precision. Writes past
+ *  the end of the buffer are dropped and flagged by hasOverflowed().
+ */
+class CborWriter
+{
+public:
+    CborWriter(uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Start an indefinite length map, end it with endMap()
+     */
+    void beginMap();
+
+    void endMap();
+
+    void addUint(uint64_t value);
+
+    void addText(const char *text);
+
+    void addFloat(float value);
+
+    size_t length();
+
+    bool hasOverflowed();
+
+protected:
+    enum {
+        MAJOR_TYPE_UINT = 0,
+        MAJOR_TYPE_TEXT = 3,
+        MAJOR_TYPE_MAP = 5,
+        MAJOR_TYPE_SIMPLE = 7,
+
+        ADDITIONAL_UINT8 = 24,
+        ADDITIONAL_UINT16 = 25,
+        ADDITIONAL_UINT32 = 26,
+        ADDITIONAL_UINT64 = 27,
+        ADDITIONAL_INDEFINITE = 31,
+
+        SIMPLE_FLOAT32 = 26,
+        SIMPLE_BREAK = 31,
+    };
+
+    void writeByte(uint8_t byte);
+
+    /**
+     * @brief Write a big endian value of numBytes bytes
+     */
+    void writeBigEndian(uint64_t value, uint8_t numBytes);
+
+    /**
+     * @brief Write a data item head, the major type and its argument
+     */
+    void writeHead(uint8_t majorType, uint64_t argument);
+
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _len;
+    bool _overflowed;
+};
+
+#endif /* end of include guard: CBORWRITER_H_9DFU3YRB */
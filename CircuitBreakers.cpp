@@ -0,0 +1,207 @@
+#include <time.h>
+
+#include "CircuitBreakers.h"
+#include "Logger.h"
+
+#define CIRCUIT_BREAKER_MAGIC 0x42524B52
+
+// Jitter of the back off, as a fraction either way
+#define BACKOFF_JITTER 0.25f
+
+// Doublings before the back off is surely at its max, keeps the shift in
+// range
+#define MAX_BACKOFF_DOUBLINGS 16
+
+/*
+ * Failures in a row that open each breaker, and its back off range. The
+ * network and config come back on their own, so are retried sooner than a
+ * sensor, which usually needs someone to fix it.
+ */
+static const struct {
+    const char *name;
+    uint32_t failureThreshold;
+    uint32_t minBackoffS;
+    uint32_t maxBackoffS;
+} breakerConfigs[BREAKER_NUM] = {
+    { "network", 3, 10*60, 4*60*60 },
+    { "config", 3, 10*60, 2*60*60 },
+    { "bme280", 2, 30*60, 24*60*60 },
+    { "ccs811", 2, 30*60, 24*60*60 },
+    { "gas gauge", 2, 30*60, 24*60*60 },
+    { "ina219", 2, 30*60, 24*60*60 },
+    // Echoes go missing now and then, so it takes more misses to open
+    { "water level", 5, 30*60, 24*60*60 },
+};
+
+typedef struct {
+    bool open;
+    uint32_t failures;
+    //! When an open breaker allows a retry, seconds on the RTC clock
+    uint32_t retryTime;
+    //! Times the breaker has opened
+    uint32_t trips;
+} BreakerState;
+
+/**
+ * State of every breaker
+ */
+typedef struct {
+    //! Set to CIRCUIT_BREAKER_MAGIC once the state is valid
+    uint32_t magic;
+
+    BreakerState breakers[BREAKER_NUM];
+} CircuitBreakerState;
+
+RTC_DATA_ATTR static CircuitBreakerState sBreakerState;
+
+CircuitBreakers gCircuitBreakers;
+
+static BreakerState *getState(Breaker breaker)
+{
+    if (sBreakerState.magic != CIRCUIT_BREAKER_MAGIC) {
+        memset(&sBreakerState, 0, sizeof(sBreakerState));
+        sBreakerState.magic = CIRCUIT_BREAKER_MAGIC;
+    }
+
+    return &sBreakerState.breakers[breaker];
+}
+
+uint32_t CircuitBreakers::backoffSeconds(Breaker breaker, uint32_t failures)
+{
+    uint32_t doublings = std::min<uint32_t>(failures - breakerConfigs[breaker].failureThreshold,
+                                            MAX_BACKOFF_DOUBLINGS);
+
+    uint64_t backoffS = (uint64_t)breakerConfigs[breaker].minBackoffS << doublings;
+
+    float jitter = 1 - BACKOFF_JITTER + 2 * BACKOFF_JITTER * ((float)esp_random() / UINT32_MAX);
+
+    // Clamped after the jitter, allow() takes a retry further away than the
+    // max back off for a clock stepped back
+    return std::min<uint64_t>(backoffS * jitter, breakerConfigs[breaker].maxBackoffS);
+}
+
+bool CircuitBreakers::allow(Breaker breaker)
+{
+    if (breaker >= BREAKER_NUM) {
+        return false;
+    }
+
+    BreakerState *state = getState(breaker);
+    if (!state->open) {
+        return true;
+    }
+
+    // The clock counts through deep sleep, but an NTP sync can step it. A
+    // retry further away than the max back off is from a clock stepped
+    // back, so retry now.
+    uint32_t now = time(nullptr);
+    if (now < state->retryTime && state->retryTime - now <= breakerConfigs[breaker].maxBackoffS) {
+        LOG_DEBUG("Skipping " + String(breakerConfigs[breaker].name) + ", retry in "
+                  + String(state->retryTime - now) + " s");
+        return false;
+    }
+
+    LOG_INFO("Retrying " + String(breakerConfigs[breaker].name) + " after "
+             + String(state->failures) + " failures");
+
+    return true;
+}
+
+void CircuitBreakers::recordSuccess(Breaker breaker)
+{
+    if (breaker >= BREAKER_NUM) {
+        return;
+    }
+
+    BreakerState *state = getState(breaker);
+    if (state->open) {
+        LOG_WARN(String(breakerConfigs[breaker].name) + " recovered after "
+                 + String(state->failures) + " failures");
+    }
+
+    state->open = false;
+    state->failures = 0;
+}
+
+void CircuitBreakers::recordFailure(Breaker breaker)
+{
+    if (breaker >= BREAKER_NUM) {
+        return;
+    }
+
+    BreakerState *state = getState(breaker);
+    state->failures++;
+
+    if (state->failures < breakerConfigs[breaker].failureThreshold) {
+        return;
+    }
+
+    uint32_t backoffS = backoffSeconds(breaker, state->failures);
+    state->retryTime = time(nullptr) + backoffS;
+
+    if (!state->open) {
+        state->open = true;
+        state->trips++;
+        LOG_WARN(String(breakerConfigs[breaker].name) + " failed " + String(state->failures)
+                 + " times in a row, skipping it for " + String(backoffS) + " s");
+    } else {
+        LOG_INFO(String(breakerConfigs[breaker].name) + " still failing, next retry in "
+                 + String(backoffS) + " s");
+    }
+}
+
+bool CircuitBreakers::isOpen(Breaker breaker)
+{
+    if (breaker >= BREAKER_NUM) {
+        return false;
+    }
+
+    return getState(breaker)->open;
+}
+
+bool CircuitBreakers::isDegraded()
+{
+    for (int i = 0; i < BREAKER_NUM; ++i) {
+        if (isOpen((Breaker)i)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+String CircuitBreakers::openBreakers()
+{
+    String names;
+
+    for (int i = 0; i < BREAKER_NUM; ++i) {
+        if (!isOpen((Breaker)i)) {
+            continue;
+        }
+
+        if (names.length() != 0) {
+            names += ", ";
+        }
+        names += breakerConfigs[i].name;
+    }
+
+    return names;
+}
+
+void CircuitBreakers::logStats()
+{
+    uint32_t now = time(nullptr);
+
+    for (int i = 0; i < BREAKER_NUM; ++i) {
+        BreakerState *state = getState((Breaker)i);
+        if (!state->open) {
+            continue;
+        }
+
+        int32_t retryInS = state->retryTime - now;
+        LOG_INFO("Breaker " + String(breakerConfigs[i].name) + " open, "
+                 + String(state->failures) + " failures, opened "
+                 + String(state->trips) + " times, retry in "
+                 + String(std::max<int32_t>(retryInS, 0)) + " s");
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef CIRCUITBREAKERS_H_M2WJ7RZP
+#define CIRCUITBREAKERS_H_M2WJ7RZP
+
+#include <Arduino.h>
+#include "Status.h"
+
+/**
+ * Subsystems that fail on their own, each with its own breaker
+ */
+enum Breaker {
+    //! WiFi association and the MQTT connection
+    BREAKER_NETWORK,
+    //! Fetching config values over MQTT
+    BREAKER_CONFIG,
+    BREAKER_BME280,
+    BREAKER_CCS811,
+    BREAKER_GAS_GAUGE,
+    BREAKER_INA219,
+    BREAKER_WATER_LEVEL,
+    BREAKER_NUM,
+};
+
+/*! \class CircuitBreakers
+ *  \brief Stops retrying failed subsystems on every wake
+ *
+ *  After a few failures in a row a subsystem's breaker opens, and it is
+ *  skipped until its back off runs out. The back off doubles with every
+ *  failed retry, up to a max, with jitter so retries don't line up with
+ *  other periodic work. A success closes the breaker. The limits of each
+ *  breaker are in the table in CircuitBreakers.cpp.
+ *
+ *  While any breaker is open we run degraded. Readings from the sensors
+ *  that are left are published, to the outbox when the network is out, and
+ *  watering runs on the soil moisture and the stored config.
+ *
+ *  Breaker state is kept in RTC memory so it survives deep sleep. Only used
+ *  from the main task.
+ */
+class CircuitBreakers
+{
+public:
+    /**
+     * @brief Check if a subsystem should be tried, an open breaker allows
+     * one try once its back off has run out
+     */
+    bool allow(Breaker breaker);
+
+    void recordSuccess(Breaker breaker);
+
+    /**
+     * @brief Count a failure, opening the breaker after enough in a row
+     */
+    void recordFailure(Breaker breaker);
+
+    bool isOpen(Breaker breaker);
+
+    /**
+     * @brief Check if any breaker is open
+     */
+    bool isDegraded();
+
+    /**
+     * @brief Names of the open breakers, comma separated
+     */
+    String openBreakers();
+
+    void logStats();
+
+protected:
+    /**
+     * @brief Back off before the next retry, with jitter
+     */
+    static uint32_t backoffSeconds(Breaker breaker, uint32_t failures);
+};
+
+extern CircuitBreakers gCircuitBreakers;
+
+#endif /* end of include guard: CIRCUITBREAKERS_H_M2WJ7RZP */
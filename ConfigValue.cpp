@@ -29,6 +29,11 @@ double ConfigValue::getValue()
 
 status_t ConfigValue::updateValue(double newValue)
 {
+    // Avoid wearing out the flash rewriting an unchanged value
+    if (newValue == _value) {
+        return STATUS_OK;
+    }
+
     if (gAppPreferences.putDouble(_configName, newValue) == 0) {
         LOG_ERROR("Failed to update config value " + String(_configName));
         return STATUS_FAIL;
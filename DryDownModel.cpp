@@ -0,0 +1,156 @@
+#include "DryDownModel.h"
+#include "Logger.h"
+
+#define DRYDOWN_MAGIC 0x44525944
+
+// Readings needed, and the time they must span, before the trend is trusted
+#define MIN_READINGS 4
+#define MIN_SPAN_S (30*60)
+
+// A rise this large is watering or rain, the start of a new dry down
+#define RESET_RISE_PERCENT 3.0f
+
+// Readings further apart than this, e.g. the clock was set in between,
+// don't belong to the same dry down
+#define MAX_GAP_S (6*60*60)
+
+/**
+ * Recent readings
+ */
+typedef struct {
+    uint32_t magic;
+
+    uint32_t times[DRYDOWN_MAX_READINGS];
+    float moisture[DRYDOWN_MAX_READINGS];
+
+    //! Index the next reading is written to
+    uint32_t next;
+    uint32_t count;
+} DryDownReadings;
+
+RTC_DATA_ATTR static DryDownReadings sReadings;
+
+DryDownModel gDryDownModel;
+
+void DryDownModel::reset()
+{
+    sReadings.next = 0;
+    sReadings.count = 0;
+    sReadings.magic = DRYDOWN_MAGIC;
+}
+
+void DryDownModel::addReading(uint32_t time, float moisturePercent)
+{
+    if (sReadings.magic != DRYDOWN_MAGIC) {
+        reset();
+    }
+
+    if (sReadings.count > 0) {
+        uint32_t last = (sReadings.next + DRYDOWN_MAX_READINGS - 1) % DRYDOWN_MAX_READINGS;
+
+        if (moisturePercent > sReadings.moisture[last] + RESET_RISE_PERCENT) {
+            LOG_DEBUG("Soil moisture rose to " + String(moisturePercent)
+                      + "%, starting a new dry down");
+            reset();
+        } else if (time < sReadings.times[last]
+                   || time - sReadings.times[last] > MAX_GAP_S) {
+            reset();
+        }
+    }
+
+    sReadings.times[sReadings.next] = time;
+    sReadings.moisture[sReadings.next] = moisturePercent;
+    sReadings.next = (sReadings.next + 1) % DRYDOWN_MAX_READINGS;
+    sReadings.count = std::min(sReadings.count + 1, (uint32_t)DRYDOWN_MAX_READINGS);
+}
+
+status_t DryDownModel::fit(float *slopePerSecond, float *intercept)
+{
+    if (sReadings.magic != DRYDOWN_MAGIC || sReadings.count < MIN_READINGS) {
+        return STATUS_EMPTY;
+    }
+
+    uint32_t oldest = (sReadings.next + DRYDOWN_MAX_READINGS - sReadings.count)
+                      % DRYDOWN_MAX_READINGS;
+    uint32_t start = sReadings.times[oldest];
+
+    // Times relative to the oldest reading keep the sums small enough for
+    // floats
+    float sumT = 0, sumM = 0, sumTT = 0, sumTM = 0;
+    for (uint32_t i = 0; i < sReadings.count; ++i) {
+        uint32_t index = (oldest + i) % DRYDOWN_MAX_READINGS;
+        float t = sReadings.times[index] - start;
+        float m = sReadings.moisture[index];
+
+        sumT += t;
+        sumM += m;
+        sumTT += t * t;
+        sumTM += t * m;
+    }
+
+    uint32_t newest = (sReadings.next + DRYDOWN_MAX_READINGS - 1) % DRYDOWN_MAX_READINGS;
+    if (sReadings.times[newest] - start < MIN_SPAN_S) {
+        return STATUS_EMPTY;
+    }
+
+    float n = sReadings.count;
+    float denominator = n * sumTT - sumT * sumT;
+    if (denominator <= 0) {
+        return STATUS_EMPTY;
+    }
+
+    *slopePerSecond = (n * sumTM - sumT * sumM) / denominator;
+    *intercept = (sumM - *slopePerSecond * sumT) / n;
+
+    return STATUS_OK;
+}
+
+status_t DryDownModel::getDryingRate(float *pctPerHour)
+{
+    if (pctPerHour == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    float slope, intercept;
+    status_t rc = fit(&slope, &intercept);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    *pctPerHour = -slope * 3600;
+
+    return STATUS_OK;
+}
+
+status_t DryDownModel::predictSecondsUntil(float thresholdPercent, uint32_t now,
+                                           uint32_t *seconds)
+{
+    if (seconds == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    float slope, intercept;
+    status_t rc = fit(&slope, &intercept);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    uint32_t oldest = (sReadings.next + DRYDOWN_MAX_READINGS - sReadings.count)
+                      % DRYDOWN_MAX_READINGS;
+    if (now < sReadings.times[oldest]) {
+        return STATUS_EMPTY;
+    }
+
+    float moistureNow = intercept + slope * (float)(now - sReadings.times[oldest]);
+
+    if (moistureNow <= thresholdPercent) {
+        *seconds = 0;
+    } else if (slope >= 0) {
+        *seconds = UINT32_MAX;
+    } else {
+        float untilThreshold = (thresholdPercent - moistureNow) / slope;
+        *seconds = (untilThreshold < (float)UINT32_MAX) ? untilThreshold : UINT32_MAX;
+    }
+
+    return STATUS_OK;
+}
@@ -0,0 +1,61 @@
+#ifndef DRYDOWNMODEL_H_M2HX7QAZ
+#define DRYDOWNMODEL_H_M2HX7QAZ
+
+#include <Arduino.h>
+#include "Status.h"
+
+//! Number of recent moisture readings the trend is fitted to
+#define DRYDOWN_MAX_READINGS 12
+
+/*! \class DryDownModel
+ *  \brief Fits the soil moisture dry down to predict when it will need
+ *  watering
+ *
+ *  The recent readings are kept in RTC memory and a line is fitted to them
+ *  by least squares. Over the hours between waterings the dry down is close
+ *  enough to linear, and a short window follows changes in weather.
+ *
+ *  The readings are dropped when the moisture jumps up, after watering or
+ *  rain, or the clock jumps, so the fit only covers one dry down.
+ */
+class DryDownModel
+{
+public:
+    /**
+     * @brief Add a reading
+     *
+     * @param time time() of the reading, it doesn't have to be set
+     */
+    void addReading(uint32_t time, float moisturePercent);
+
+    /**
+     * @brief Get how fast the soil is drying
+     *
+     * @param pctPerHour Positive when drying
+     *
+     * @return STATUS_EMPTY if there aren't enough readings for a trend
+     */
+    status_t getDryingRate(float *pctPerHour);
+
+    /**
+     * @brief Predict how long until the moisture drops to a threshold
+     *
+     * @param seconds 0 if it already has, UINT32_MAX if it isn't drying
+     *
+     * @return STATUS_EMPTY if there aren't enough readings for a trend
+     */
+    status_t predictSecondsUntil(float thresholdPercent, uint32_t now,
+                                 uint32_t *seconds);
+
+    void reset();
+
+protected:
+    /**
+     * @brief Fit moisture = intercept + slope * (time - first reading time)
+     */
+    status_t fit(float *slopePerSecond, float *intercept);
+};
+
+extern DryDownModel gDryDownModel;
+
+#endif /* end of include guard: DRYDOWNMODEL_H_M2HX7QAZ */
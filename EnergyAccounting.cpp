@@ -0,0 +1,215 @@
+#include <time.h>
+
+#include "EnergyAccounting.h"
+#include "PowerManagement.h"
+#include "TimerServer.h"
+#include "Logger.h"
+
+#define ENERGY_HISTORY_MAGIC 0x454E5247
+
+// Bootloader and app image load, before millis() starts counting
+#define BOOTLOADER_MS 300
+
+// Used when the gas gauge reading isn't plausible
+#define NOMINAL_BATTERY_VOLTAGE_V 3.7f
+#define MIN_BATTERY_VOLTAGE_V 3.0f
+#define MAX_BATTERY_VOLTAGE_V 4.5f
+
+/*
+ * Battery current of each phase on top of the CPU, which PowerManagement
+ * estimates. Rough figures from the ESP32 datasheet and the sensor and pump
+ * ratings, calibrate by timing a wake against a meter on the battery.
+ */
+static const struct {
+    const char *name;
+    float currentMa;
+} phaseModels[ENERGY_NUM_PHASES] = {
+    // The whole chip, power management isn't running yet
+    { "boot", 45.0f },
+    { "wifi", 95.0f },
+    { "tls", 80.0f },
+    { "sens", 6.0f },
+    { "pub", 80.0f },
+    // Mostly waiting for replies, in modem sleep between beacons
+    { "cfg", 40.0f },
+    // The pump through the 9V/12V boost converter
+    { "wat", 450.0f },
+    // Only the name, the current comes from PowerManagement
+    { "base", 0.0f },
+};
+
+/**
+ * Energy of recent wakes
+ */
+typedef struct {
+    //! Set to ENERGY_HISTORY_MAGIC once the history is valid
+    uint32_t magic;
+
+    WakeEnergy wakes[ENERGY_HISTORY_LEN];
+
+    //! Index the next wake is written to
+    uint32_t next;
+    uint32_t numWakes;
+} EnergyHistory;
+
+RTC_DATA_ATTR static EnergyHistory sHistory;
+
+EnergyAccounting gEnergyAccounting;
+
+EnergyAccounting::EnergyAccounting()
+    : _statsMux(portMUX_INITIALIZER_UNLOCKED)
+{
+    for (int i = 0; i < ENERGY_NUM_PHASES; ++i) {
+        _activeCount[i] = 0;
+        _startMs[i] = 0;
+        _phaseMs[i] = 0;
+    }
+}
+
+void EnergyAccounting::begin()
+{
+    if (sHistory.magic != ENERGY_HISTORY_MAGIC) {
+        memset(&sHistory, 0, sizeof(sHistory));
+        sHistory.magic = ENERGY_HISTORY_MAGIC;
+    }
+
+    portENTER_CRITICAL(&_statsMux);
+    _phaseMs[ENERGY_PHASE_BOOT] = BOOTLOADER_MS + millis();
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+void EnergyAccounting::startPhase(EnergyPhase phase)
+{
+    if (phase >= ENERGY_PHASE_BASE) {
+        LOG_WARN("Energy phase " + String(phase) + " can't be timed");
+        return;
+    }
+
+    portENTER_CRITICAL(&_statsMux);
+    if (_activeCount[phase]++ == 0) {
+        _startMs[phase] = millis();
+    }
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+void EnergyAccounting::endPhase(EnergyPhase phase)
+{
+    if (phase >= ENERGY_PHASE_BASE) {
+        return;
+    }
+
+    portENTER_CRITICAL(&_statsMux);
+    if (_activeCount[phase] != 0 && --_activeCount[phase] == 0) {
+        _phaseMs[phase] += millis() - _startMs[phase];
+    }
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+void EnergyAccounting::finishWake(double batteryVoltageV, double solarPowerMw)
+{
+    WakeEnergy wake;
+    uint32_t phaseMs[ENERGY_NUM_PHASES];
+
+    wake.awakeMs = millis();
+
+    portENTER_CRITICAL(&_statsMux);
+    for (int i = 0; i < ENERGY_NUM_PHASES; ++i) {
+        phaseMs[i] = _phaseMs[i];
+        if (_activeCount[i] != 0) {
+            phaseMs[i] += wake.awakeMs - _startMs[i];
+        }
+    }
+    portEXIT_CRITICAL(&_statsMux);
+
+    float voltage = NOMINAL_BATTERY_VOLTAGE_V;
+    if (batteryVoltageV >= MIN_BATTERY_VOLTAGE_V && batteryVoltageV <= MAX_BATTERY_VOLTAGE_V) {
+        voltage = batteryVoltageV;
+    }
+
+    // mA by ms is uC, by V is uJ
+    wake.totalMj = 0;
+    for (int i = 0; i < ENERGY_PHASE_BASE; ++i) {
+        wake.phaseMj[i] = phaseMs[i] * phaseModels[i].currentMa * voltage / 1000;
+        wake.totalMj += wake.phaseMj[i];
+    }
+
+    // The CPU from when power management started
+    uint32_t appMs = wake.awakeMs + BOOTLOADER_MS - phaseMs[ENERGY_PHASE_BOOT];
+    wake.phaseMj[ENERGY_PHASE_BASE] =
+        appMs * gPowerManagement.getAverageCpuCurrentMa() * voltage / 1000;
+    wake.totalMj += wake.phaseMj[ENERGY_PHASE_BASE];
+
+    wake.solarMj = solarPowerMw > 0 ? solarPowerMw * wake.awakeMs / 1000 : 0;
+
+    wake.timestamp = TimerServer::clockIsSet() ? time(nullptr) : 0;
+
+    sHistory.wakes[sHistory.next] = wake;
+    sHistory.next = (sHistory.next + 1) % ENERGY_HISTORY_LEN;
+    if (sHistory.numWakes < ENERGY_HISTORY_LEN) {
+        sHistory.numWakes++;
+    }
+
+    logWake(wake);
+}
+
+status_t EnergyAccounting::getLastWake(WakeEnergy *wake)
+{
+    if (wake == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (sHistory.magic != ENERGY_HISTORY_MAGIC || sHistory.numWakes == 0) {
+        return STATUS_EMPTY;
+    }
+
+    *wake = sHistory.wakes[(sHistory.next + ENERGY_HISTORY_LEN - 1) % ENERGY_HISTORY_LEN];
+
+    return STATUS_OK;
+}
+
+float EnergyAccounting::predictMj(EnergyPhase phase, uint32_t durationMs)
+{
+    if (phase >= ENERGY_NUM_PHASES) {
+        return 0;
+    }
+
+    return durationMs * phaseModels[phase].currentMa * NOMINAL_BATTERY_VOLTAGE_V / 1000;
+}
+
+const char *EnergyAccounting::phaseName(EnergyPhase phase)
+{
+    if (phase >= ENERGY_NUM_PHASES) {
+        return "?";
+    }
+
+    return phaseModels[phase].name;
+}
+
+void EnergyAccounting::logWake(const WakeEnergy &wake)
+{
+    String phases;
+    for (int i = 0; i < ENERGY_NUM_PHASES; ++i) {
+        phases += " " + String(phaseModels[i].name) + " " + String(wake.phaseMj[i], 0);
+    }
+
+    LOG_INFO("Wake used " + String(wake.totalMj, 0) + " mJ in " + String(wake.awakeMs)
+             + " ms, solar " + String(wake.solarMj, 0) + " mJ. mJ per phase:" + phases);
+}
+
+void EnergyAccounting::logStats()
+{
+    if (sHistory.magic != ENERGY_HISTORY_MAGIC || sHistory.numWakes == 0) {
+        return;
+    }
+
+    float totalMj = 0;
+    float solarMj = 0;
+    for (uint32_t i = 0; i < sHistory.numWakes; ++i) {
+        totalMj += sHistory.wakes[i].totalMj;
+        solarMj += sHistory.wakes[i].solarMj;
+    }
+
+    LOG_INFO("Last " + String(sHistory.numWakes) + " wakes used "
+             + String(totalMj / sHistory.numWakes, 0) + " mJ on average, solar "
+             + String(solarMj / sHistory.numWakes, 0) + " mJ while awake");
+}
@@ -0,0 +1,122 @@
+#ifndef ENERGYACCOUNTING_H_Q8RM2ZDK
+#define ENERGYACCOUNTING_H_Q8RM2ZDK
+
+#include <Arduino.h>
+#include "Status.h"
+
+//! Wakes kept in the history in RTC memory
+#define ENERGY_HISTORY_LEN 12
+
+/**
+ * Parts of a wake energy is accounted to
+ */
+enum EnergyPhase {
+    //! Bootloader and app start, up to EnergyAccounting::begin()
+    ENERGY_PHASE_BOOT,
+    //! WiFi association and DHCP
+    ENERGY_PHASE_WIFI,
+    //! MQTT connection and TLS handshake
+    ENERGY_PHASE_TLS,
+    //! Sensor power up, set up and sampling
+    ENERGY_PHASE_SENSORS,
+    //! Publishing readings and uploading the outbox backlog
+    ENERGY_PHASE_PUBLISH,
+    //! Fetching config and commands
+    ENERGY_PHASE_CONFIG,
+    ENERGY_PHASE_WATERING,
+    //! The CPU for the whole wake, and anything outside the phases above
+    ENERGY_PHASE_BASE,
+    ENERGY_NUM_PHASES,
+};
+
+/**
+ * Energy used by one wake, all energies in mJ drawn from the battery
+ */
+typedef struct {
+    //! Time the wake ended, seconds since the epoch, 0 if unknown
+    uint32_t timestamp;
+
+    uint32_t awakeMs;
+
+    float totalMj;
+    float phaseMj[ENERGY_NUM_PHASES];
+
+    //! Energy from the solar panel while awake, not taken off the total
+    float solarMj;
+} WakeEnergy;
+
+/*! \class EnergyAccounting
+ *  \brief Estimates the energy each wake, and each phase of it, costs
+ *
+ *  Each phase is timed between startPhase() and endPhase(), and its energy
+ *  is its time by its current in the model in EnergyAccounting.cpp. Phase
+ *  currents are on top of the CPU, which is accounted to ENERGY_PHASE_BASE
+ *  from the frequency and light sleep residency tracked by PowerManagement.
+ *  Phases can overlap, the network comes up while the sensors are sampled,
+ *  and then both draw current.
+ *
+ *  Charge is converted to energy at the battery voltage read by the gas
+ *  gauge, and the solar panel power read by the INA219 gives the energy
+ *  harvested while awake.
+ *
+ *  The last ENERGY_HISTORY_LEN wakes are kept in RTC memory. The previous
+ *  wake is published with each set of readings, the current one isn't done
+ *  until we sleep.
+ */
+class EnergyAccounting
+{
+public:
+    EnergyAccounting();
+
+    /**
+     * @brief Start accounting a wake, call first thing on wake
+     */
+    void begin();
+
+    /**
+     * @brief Start timing a phase, can be called from any task and nested
+     */
+    void startPhase(EnergyPhase phase);
+
+    void endPhase(EnergyPhase phase);
+
+    /**
+     * @brief Add this wake to the history, call right before deep sleep
+     *
+     * @param batteryVoltageV Latest battery voltage, ignored if not plausible
+     * @param solarPowerMw Latest solar panel power
+     */
+    void finishWake(double batteryVoltageV, double solarPowerMw);
+
+    /**
+     * @brief Get the last finished wake
+     *
+     * @return STATUS_EMPTY if there is no history
+     */
+    status_t getLastWake(WakeEnergy *wake);
+
+    /**
+     * @brief Predict the energy of a phase from the current model, at the
+     * nominal battery voltage and not counting the CPU
+     */
+    static float predictMj(EnergyPhase phase, uint32_t durationMs);
+
+    /**
+     * @brief Short name of a phase, used as its telemetry key
+     */
+    static const char *phaseName(EnergyPhase phase);
+
+    void logStats();
+
+protected:
+    void logWake(const WakeEnergy &wake);
+
+    portMUX_TYPE _statsMux;
+    uint32_t _activeCount[ENERGY_NUM_PHASES];
+    uint32_t _startMs[ENERGY_NUM_PHASES];
+    uint32_t _phaseMs[ENERGY_NUM_PHASES];
+};
+
+extern EnergyAccounting gEnergyAccounting;
+
+#endif /* end of include guard: ENERGYACCOUNTING_H_Q8RM2ZDK */
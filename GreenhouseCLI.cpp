@@ -0,0 +1,303 @@
+#include "GreenhouseCLI.h"
+#include "SystemManager.h"
+#include "Logger.h"
+
+GreenhouseCLI gGreenhouseCLI;
+
+void GreenhouseCLI::helpCommand(cmd *c)
+{
+    _out->println("Help:");
+    _out->println(_cli.toString());
+}
+
+void GreenhouseCLI::pingCommand(cmd *c)
+{
+    _out->println("> pong");
+}
+
+void GreenhouseCLI::setWaterHoursCommand(cmd *c)
+{
+    Command cmd(c);
+
+    int startHour = cmd.getArgument("startHour").getValue().toInt();
+    int endHour = cmd.getArgument("endHour").getValue().toInt();
+
+    _rc = _systemManager->setWaterHours(startHour, endHour);
+
+    if (_rc == STATUS_OK) {
+        _out->println("> Success: updated water hours");
+    } else {
+        _out->println("> Fail: failed to update water hours");
+    }
+}
+
+void GreenhouseCLI::setWaterMinSOCCommand(cmd *c)
+{
+    Command cmd(c);
+
+    double minSOC = cmd.getArgument("minSOC").getValue().toDouble();
+
+    _rc = _systemManager->setWaterMinSOC(minSOC);
+
+    if (_rc == STATUS_OK) {
+        _out->println("> Success: updated min water SOC");
+    } else {
+        _out->println("> Fail: failed to update min water SOC");
+    }
+}
+
+void GreenhouseCLI::updateWaterLevelCalibrationCommand(cmd *c)
+{
+    Command cmd(c);
+
+    double emptyCm = cmd.getArgument("emptyCm").getValue().toDouble();
+    double fullCm = cmd.getArgument("fullCm").getValue().toDouble();
+
+    _rc = _systemManager->updateWaterLevelCalibration(fullCm, emptyCm);
+
+    if (_rc == STATUS_OK) {
+        _out->println("> Success: updated water level cal");
+    } else {
+        _out->println("> Fail: failed to update water level cal");
+    }
+}
+
+void GreenhouseCLI::getWaterDistanceCommand(cmd *c)
+{
+    uint32_t distanceCm = _systemManager->getWaterDistanceCm();
+
+    _out->print("> Water Distance ");
+    _out->print(String(distanceCm));
+    _out->println(" cm");
+}
+
+void GreenhouseCLI::getWaterLevelPercentCommand(cmd *c)
+{
+    double waterLevel = _systemManager->getWaterLevelPercent();
+
+    _out->print("> Water Level ");
+    _out->print(String(waterLevel));
+    _out->println(" %");
+}
+
+void GreenhouseCLI::closeCommand(cmd *c)
+{
+    _out->println("> Goodbye");
+    _closeRequested = true;
+}
+
+void GreenhouseCLI::telnetCommand(cmd *c)
+{
+    _rc = _systemManager->requestTelnet();
+
+    if (_rc == STATUS_OK) {
+        _out->println("> Success: starting telnet, IP published to the local-ip feed");
+    } else {
+        _out->println("> Fail: failed to start telnet");
+    }
+}
+
+// Callback in case of an error
+void GreenhouseCLI::errorCallback(cmd_error* e) {
+    CommandError cmdError(e); // Create wrapper object
+
+    _rc = STATUS_INVALID_PARAMS;
+
+    _out->print("ERROR: ");
+    _out->println(cmdError.toString());
+
+    if (cmdError.hasCommand()) {
+        _out->print("Did you mean \"");
+        _out->print(cmdError.getCommand().toString());
+        _out->println("\"?");
+    }
+}
+
+status_t GreenhouseCLI::registerSetWaterHoursCommand()
+{
+    _setWaterHoursCommand = _cli.addCommand("setWaterHours",
+                                            [](cmd *c) {
+                                                gGreenhouseCLI.setWaterHoursCommand(c);
+                                            });
+
+    if (!_setWaterHoursCommand) {
+        return STATUS_FAIL;
+    }
+
+    _setWaterHoursCommand.addArgument("startHour");
+    _setWaterHoursCommand.addArgument("endHour");
+
+    _setWaterHoursCommand.setDescription(" Sets the hours that the plants can be watered");
+
+    return STATUS_OK;
+}
+
+status_t GreenhouseCLI::registerSetWaterMinSOCCommand()
+{
+    _setWaterMinSOCCommand = _cli.addCommand("setWaterMinSOC",
+                                            [](cmd *c) {
+                                                gGreenhouseCLI.setWaterMinSOCCommand(c);
+                                            });
+
+    if (!_setWaterMinSOCCommand) {
+        return STATUS_FAIL;
+    }
+
+    _setWaterMinSOCCommand.addArgument("minSOC");
+
+    _setWaterMinSOCCommand.setDescription(" Sets the minimum SOC where the plants can be watered");
+    return STATUS_OK;
+}
+
+status_t GreenhouseCLI::registerWaterLevelCalibrationCommand()
+{
+    _updateWaterLevelCalibrationCommand = _cli.addCommand("waterLevelCal",
+                                            [](cmd *c) {
+                                                gGreenhouseCLI.updateWaterLevelCalibrationCommand(c);
+                                            });
+
+    if (!_updateWaterLevelCalibrationCommand) {
+        return STATUS_FAIL;
+    }
+
+    _updateWaterLevelCalibrationCommand.addArgument("emptyCm");
+    _updateWaterLevelCalibrationCommand.addArgument("fullCm");
+
+    _updateWaterLevelCalibrationCommand.setDescription(
+        " Sets the calibration for water level."
+        " The empty and full distances are the distances measured when the"
+        " water reservoir is empty and full respectively");
+    return STATUS_OK;
+}
+
+status_t GreenhouseCLI::registerCommands()
+{
+    _pingCommand = _cli.addCmd("ping",
+                               [](cmd *c) {
+                                gGreenhouseCLI.pingCommand(c);
+                               });
+    if (!_pingCommand) {
+        LOG_ERROR("Failed to create ping command");
+        return STATUS_FAIL;
+    }
+    _pingCommand.setDescription(" Ping the CLI, return Pong");
+
+    _closeCommand = _cli.addCmd("close",
+                               [](cmd *c) {
+                                gGreenhouseCLI.closeCommand(c);
+                               });
+    if (!_closeCommand) {
+        LOG_ERROR("Failed to create close command");
+        return STATUS_FAIL;
+    }
+    _closeCommand.setDescription(" Closes the telnet connection and restarts the greenhouse app");
+
+    _telnetCommand = _cli.addCmd("telnet",
+                               [](cmd *c) {
+                                gGreenhouseCLI.telnetCommand(c);
+                               });
+    if (!_telnetCommand) {
+        LOG_ERROR("Failed to create telnet command");
+        return STATUS_FAIL;
+    }
+    _telnetCommand.setDescription(" Starts a telnet session once the current commands have run");
+
+    status_t rc;
+
+    rc = registerSetWaterHoursCommand();
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to register setWaterHours command");
+        return STATUS_FAIL;
+    }
+
+    rc = registerSetWaterMinSOCCommand();
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to register setWaterMinSOC command");
+        return STATUS_FAIL;
+    }
+
+    rc = registerWaterLevelCalibrationCommand();
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to register waterLevelCal command");
+        return STATUS_FAIL;
+    }
+
+    _getWaterDistanceCommand = _cli.addCmd("waterDistance",
+                               [](cmd *c) {
+                                gGreenhouseCLI.getWaterDistanceCommand(c);
+                               });
+    if (!_getWaterDistanceCommand) {
+        LOG_ERROR("Failed to create waterDistance command");
+        return STATUS_FAIL;
+    }
+    _getWaterDistanceCommand.setDescription(" Get the distance to the water as measured by the water level sensor");
+
+    _getWaterDistancePercentCommand = _cli.addCmd("waterPercent",
+                               [](cmd *c) {
+                                gGreenhouseCLI.getWaterLevelPercentCommand(c);
+                               });
+    if (!_getWaterDistancePercentCommand) {
+        LOG_ERROR("Failed to create waterDistance command");
+        return STATUS_FAIL;
+    }
+    _getWaterDistancePercentCommand.setDescription(" Get the water level");
+
+
+    // Set error Callback
+    _cli.setOnError([](cmd_error *e) {
+                        gGreenhouseCLI.errorCallback(e);
+                    });
+
+    _helpCommand = _cli.addCmd("help",
+                [](cmd *c) {
+                    gGreenhouseCLI.helpCommand(c);
+                });
+    if (!_helpCommand) {
+        LOG_ERROR("Failed to create help command");
+        return STATUS_FAIL;
+    }
+    _helpCommand.setDescription(" Get CLI help");
+
+    return STATUS_OK;
+}
+
+status_t GreenhouseCLI::init(SystemManager *systemManager)
+{
+    // Telnet and the MQTT command channel share the commands, only register
+    // them once
+    if (_systemManager != nullptr) {
+        return STATUS_OK;
+    }
+
+    status_t rc = registerCommands();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    _systemManager = systemManager;
+
+    return STATUS_OK;
+}
+
+status_t GreenhouseCLI::execute(const String &input, Print *out)
+{
+    if (_systemManager == nullptr || out == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    _out = out;
+    _rc = STATUS_OK;
+    _closeRequested = false;
+
+    // Commands and the error callback run from within parse
+    _cli.parse(input);
+
+    _out = nullptr;
+
+    return _rc;
+}
+
+bool GreenhouseCLI::closeRequested()
+{
+    return _closeRequested;
+}
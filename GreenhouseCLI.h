@@ -0,0 +1,90 @@
+#ifndef GREENHOUSECLI_H_P3XK8RWA
+#define GREENHOUSECLI_H_P3XK8RWA
+
+#include "SimpleCLI.h"
+#include "Status.h"
+
+class SystemManager;
+
+/*! \class GreenhouseCLI
+ *  \brief The greenhouse command line, shared by telnet and the MQTT command
+ *  channel
+ *
+ *  Commands print their output to whichever Print the command line was
+ *  executed with, so the same handlers answer a telnet session or an MQTT
+ *  response.
+ */
+class GreenhouseCLI
+{
+public:
+    status_t init(SystemManager *systemManager);
+
+    /**
+     * @brief Run a command line
+     *
+     * @param input The command line
+     * @param out Where the command output is printed
+     *
+     * @return STATUS_OK if the command succeeded, STATUS_INVALID_PARAMS if
+     * the command line couldn't be parsed, STATUS_FAIL otherwise
+     */
+    status_t execute(const String &input, Print *out);
+
+    /**
+     * @brief Check if the last command asked to close the session
+     */
+    bool closeRequested();
+
+    /**
+     * Private, only to be used in callbacks
+     */
+    void pingCommand(cmd * c);
+    void setWaterHoursCommand(cmd *c);
+    void setWaterMinSOCCommand(cmd *c);
+    void updateWaterLevelCalibrationCommand(cmd *c);
+    void getWaterDistanceCommand(cmd *c);
+    void getWaterLevelPercentCommand(cmd *c);
+    void closeCommand(cmd *c);
+    void telnetCommand(cmd *c);
+    void helpCommand(cmd *c);
+    void errorCallback(cmd_error* e);
+
+protected:
+    status_t registerCommands();
+
+    status_t registerSetWaterHoursCommand();
+    status_t registerSetWaterMinSOCCommand();
+    status_t registerWaterLevelCalibrationCommand();
+
+    SimpleCLI _cli;
+
+    SystemManager *_systemManager = nullptr;
+
+    //! Output of the command being executed
+    Print *_out = nullptr;
+
+    //! Result of the command being executed
+    status_t _rc = STATUS_OK;
+
+    bool _closeRequested = false;
+
+    /**
+     * CLI Commands
+     */
+    Command _pingCommand;
+
+    Command _setWaterHoursCommand;
+    Command _setWaterMinSOCCommand;
+
+    Command _updateWaterLevelCalibrationCommand;
+    Command _getWaterDistanceCommand;
+    Command _getWaterDistancePercentCommand;
+
+    Command _helpCommand;
+    Command _closeCommand;
+    Command _telnetCommand;
+};
+
+extern GreenhouseCLI gGreenhouseCLI;
+
+#endif /* end of include guard: GREENHOUSECLI_H_P3XK8RWA */
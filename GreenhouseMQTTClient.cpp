@@ -0,0 +1,176 @@
+#include "GreenhouseMQTTClient.h"
+#include "Logger.h"
+
+GreenhouseMQTTClient::GreenhouseMQTTClient(Client *client, const char *server,
+                                           uint16_t port, const char *cid,
+                                           const char *user, const char *pass) :
+    Adafruit_MQTT_Client(client, server, port, cid, user, pass),
+    _persistentSession(false),
+    _pingResponded(false)
+{}
+
+void GreenhouseMQTTClient::setPersistentSession(bool persistent)
+{
+    _persistentSession = persistent;
+}
+
+uint16_t GreenhouseMQTTClient::variableHeaderOffset(uint8_t *buffer, uint16_t len)
+{
+    // Skip the fixed header, the remaining length is encoded in 1-4 bytes
+    // using a continuation bit
+    uint16_t pos = 1;
+    while (pos < len && (buffer[pos] & 0x80)) {
+        pos++;
+    }
+    pos++;
+
+    return pos;
+}
+
+void GreenhouseMQTTClient::clearCleanSessionFlag(uint8_t *buffer, uint16_t len)
+{
+    uint16_t pos = variableHeaderOffset(buffer, len);
+
+    // The variable header starts with the protocol name (2 byte length then
+    // the name) and protocol level, followed by the connect flags
+    if (pos + 2 > len) {
+        LOG_ERROR("Malformed MQTT connect packet");
+        return;
+    }
+
+    uint16_t protocolNameLen = (buffer[pos] << 8) | buffer[pos + 1];
+    pos += 2 + protocolNameLen + 1;
+
+    if (pos >= len) {
+        LOG_ERROR("Malformed MQTT connect packet");
+        return;
+    }
+
+    buffer[pos] &= ~MQTT_CONN_CLEANSESSION;
+}
+
+bool GreenhouseMQTTClient::sendPacket(uint8_t *buffer, uint16_t len)
+{
+    if (_persistentSession && len > 0
+        && (buffer[0] >> 4) == MQTT_CTRL_CONNECT)
+    {
+        clearCleanSessionFlag(buffer, len);
+    }
+
+    return Adafruit_MQTT_Client::sendPacket(buffer, len);
+}
+
+bool GreenhouseMQTTClient::subscribeFilter(const char *filter, uint8_t qos)
+{
+    uint8_t packet[MAXBUFFERSIZE];
+    uint16_t filterLen = strlen(filter);
+
+    // Packet id, filter length, filter and qos, short enough for a one byte
+    // remaining length
+    uint16_t remainingLen = 2 + 2 + filterLen + 1;
+    if (remainingLen > 127) {
+        LOG_ERROR("Topic filter too long: " + String(filter));
+        return false;
+    }
+
+    uint16_t packetId = ++packet_id_counter;
+    uint16_t pos = 0;
+
+    packet[pos++] = (MQTT_CTRL_SUBSCRIBE << 4) | (MQTT_QOS_1 << 1);
+    packet[pos++] = remainingLen;
+    packet[pos++] = packetId >> 8;
+    packet[pos++] = packetId & 0xFF;
+    packet[pos++] = filterLen >> 8;
+    packet[pos++] = filterLen & 0xFF;
+    memcpy(&packet[pos], filter, filterLen);
+    pos += filterLen;
+    packet[pos++] = qos;
+
+    return sendPacket(packet, pos);
+}
+
+void GreenhouseMQTTClient::checkSubAck(uint8_t *buffer, uint16_t len)
+{
+    // A single return code follows the packet id
+    uint16_t pos = variableHeaderOffset(buffer, len) + 2;
+
+    if (pos < len && buffer[pos] == MQTT_SUBACK_FAILURE) {
+        LOG_ERROR("Broker rejected a subscription");
+    }
+}
+
+bool GreenhouseMQTTClient::sendPing()
+{
+    uint8_t packet[2] = {MQTT_CTRL_PINGREQ << 4, 0};
+
+    _pingResponded = false;
+
+    return sendPacket(packet, sizeof(packet));
+}
+
+bool GreenhouseMQTTClient::pingResponded()
+{
+    return _pingResponded;
+}
+
+bool GreenhouseMQTTClient::readMessage(MQTTMessage *message, int16_t timeoutMs)
+{
+    // Reads at most one byte less than the buffer, which leaves room to null
+    // terminate the payload
+    uint16_t len = readFullPacket(buffer, MAXBUFFERSIZE, timeoutMs);
+    if (len == 0) {
+        return false;
+    }
+
+    uint8_t packetType = buffer[0] >> 4;
+
+    if (packetType == MQTT_CTRL_SUBACK) {
+        checkSubAck(buffer, len);
+        return false;
+    }
+
+    if (packetType == MQTT_CTRL_PINGRESP) {
+        _pingResponded = true;
+        return false;
+    }
+
+    if (packetType != MQTT_CTRL_PUBLISH) {
+        return false;
+    }
+
+    uint8_t qos = (buffer[0] >> 1) & 0x03;
+    uint16_t pos = variableHeaderOffset(buffer, len);
+
+    if (pos + 2 > len) {
+        LOG_ERROR("Malformed MQTT publish packet");
+        return false;
+    }
+
+    uint16_t topicLen = (buffer[pos] << 8) | buffer[pos + 1];
+    uint16_t payloadPos = pos + 2 + topicLen + (qos > 0 ? 2 : 0);
+
+    if (payloadPos > len) {
+        LOG_ERROR("Malformed MQTT publish packet");
+        return false;
+    }
+
+    if (qos > 0) {
+        uint8_t puback[4] = {
+            MQTT_CTRL_PUBACK << 4, 2,
+            buffer[payloadPos - 2], buffer[payloadPos - 1],
+        };
+        sendPacket(puback, sizeof(puback));
+    }
+
+    // Move the topic over its length so it can be null terminated in place
+    memmove(&buffer[pos], &buffer[pos + 2], topicLen);
+    buffer[pos + topicLen] = '\0';
+
+    buffer[len] = '\0';
+
+    message->topic = (const char *)&buffer[pos];
+    message->payload = &buffer[payloadPos];
+    message->len = len - payloadPos;
+
+    return true;
+}
@@ -0,0 +1,112 @@
+#ifndef GREENHOUSEMQTTCLIENT_H_V4NC8QXE
+#define GREENHOUSEMQTTCLIENT_H_V4NC8QXE
+
+#include "Adafruit_MQTT.h"
+#include "Adafruit_MQTT_Client.h"
+
+//! SUBACK return code for a rejected subscription
+#define MQTT_SUBACK_FAILURE 0x80
+
+typedef struct {
+    //! Null terminated topic
+    const char *topic;
+    //! Payload, null terminated so text payloads can be used directly
+    const uint8_t *payload;
+    uint16_t len;
+} MQTTMessage;
+
+/*! \class GreenhouseMQTTClient
+ *  \brief MQTT client with support for persistent sessions and wildcard
+ *  subscriptions
+ *
+ *  Adafruit_MQTT always requests a clean session when connecting. When
+ *  persistent sessions are enabled the clean session flag is cleared from the
+ *  outgoing CONNECT packet, so the broker keeps our subscriptions and queues
+ *  QoS 1 messages published while we are asleep.
+ *
+ *  Adafruit_MQTT only delivers messages whose topic exactly matches one of
+ *  its subscriptions, each with its own receive buffer. Messages read with
+ *  readMessage() are left in the client's packet buffer for any topic, so a
+ *  single wildcard subscription can serve many topics.
+ *
+ *  Adafruit_MQTT's ping() drops any message that arrives while it waits for
+ *  the PINGRESP. sendPing() only sends the PINGREQ, and readMessage() notes
+ *  the PINGRESP when it comes, so messages are still read and routed.
+ */
+class GreenhouseMQTTClient : public Adafruit_MQTT_Client
+{
+public:
+    GreenhouseMQTTClient(Client *client, const char *server, uint16_t port,
+                         const char *cid, const char *user, const char *pass);
+
+    /**
+     * @brief Set whether the broker should keep our session between
+     * connections. Requires a non empty client ID.
+     *
+     * @param persistent True to connect with clean session off
+     */
+    void setPersistentSession(bool persistent);
+
+    /**
+     * @brief Subscribe to a topic filter, which may contain wildcards
+     *
+     * Subscriptions made here aren't restored by connect(), subscribe again
+     * after connecting. The SUBACK is read by readMessage().
+     *
+     * @return True if the SUBSCRIBE packet was sent
+     */
+    bool subscribeFilter(const char *filter, uint8_t qos);
+
+    /**
+     * @brief Read the next PUBLISH packet, for any topic
+     *
+     * The message points into the client's packet buffer and is only valid
+     * until the next read or publish. QoS 1 messages are acknowledged.
+     *
+     * @param message Set to the message read
+     * @param timeoutMs Max time to wait for a packet
+     *
+     * @return True if a message was read
+     */
+    bool readMessage(MQTTMessage *message, int16_t timeoutMs);
+
+    /**
+     * @brief Send a PINGREQ, the PINGRESP is read by readMessage()
+     *
+     * @return True if the PINGREQ was sent
+     */
+    bool sendPing();
+
+    /**
+     * @brief Check if the PINGRESP to the last sendPing() was read
+     */
+    bool pingResponded();
+
+protected:
+    bool sendPacket(uint8_t *buffer, uint16_t len) override;
+
+    /**
+     * @brief Clear the clean session flag in a CONNECT packet
+     *
+     * @param buffer The CONNECT packet
+     * @param len The length of the packet
+     */
+    void clearCleanSessionFlag(uint8_t *buffer, uint16_t len);
+
+    /**
+     * @brief Check the return code of a SUBACK packet
+     */
+    void checkSubAck(uint8_t *buffer, uint16_t len);
+
+    /**
+     * @brief Get the offset of the variable header, after the fixed header
+     * and its 1-4 byte remaining length
+     */
+    static uint16_t variableHeaderOffset(uint8_t *buffer, uint16_t len);
+
+    bool _persistentSession;
+
+    bool _pingResponded;
+};
+
+#endif /* end of include guard: GREENHOUSEMQTTCLIENT_H_V4NC8QXE */
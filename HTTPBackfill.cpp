@@ -0,0 +1,382 @@
+#include <time.h>
+
+#include "HTTPBackfill.h"
+#include "JsonStreamWriter.h"
+#include "Outbox.h"
+#include "Logger.h"
+#include "PowerManagement.h"
+
+#define FEED_TOPIC_SEPARATOR "/feeds/"
+
+// Length of an ISO 8601 UTC time, 2023-06-01T12:00:00Z
+#define ISO_TIME_LEN 20
+
+ChunkedPrint::ChunkedPrint(Print *out) :
+    _out(out),
+    _len(0),
+    _error(false)
+{ }
+
+bool ChunkedPrint::sendChunk()
+{
+    if (_len == 0 || _error) {
+        return !_error;
+    }
+
+    char sizeLine[12];
+    snprintf(sizeLine, sizeof(sizeLine), "%x\r\n", (unsigned)_len);
+
+    if (_out->write(sizeLine) != strlen(sizeLine)
+        || _out->write(_buffer, _len) != _len
+        || _out->write("\r\n") != 2)
+    {
+        _error = true;
+    }
+
+    _len = 0;
+
+    return !_error;
+}
+
+size_t ChunkedPrint::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ChunkedPrint::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+
+    while (written < size) {
+        if (_len == sizeof(_buffer) && !sendChunk()) {
+            return written;
+        }
+
+        size_t len = std::min(size - written, sizeof(_buffer) - _len);
+        memcpy(&_buffer[_len], &buffer[written], len);
+
+        _len += len;
+        written += len;
+    }
+
+    return written;
+}
+
+bool ChunkedPrint::finish()
+{
+    if (!sendChunk()) {
+        return false;
+    }
+
+    if (_out->write("0\r\n\r\n") != 5) {
+        _error = true;
+    }
+
+    return !_error;
+}
+
+HTTPBackfill::HTTPBackfill(Client *client, const char *host, uint16_t port,
+                           const char *username, const char *key) :
+    _client(client),
+    _host(host),
+    _port(port),
+    _username(username),
+    _key(key),
+    _numFeeds(0)
+{ }
+
+const char *HTTPBackfill::feedKeyFromTopic(const char *topic)
+{
+    const char *separator = strstr(topic, FEED_TOPIC_SEPARATOR);
+    if (separator == nullptr) {
+        return nullptr;
+    }
+
+    const char *feedKey = separator + strlen(FEED_TOPIC_SEPARATOR);
+    if (*feedKey == '\0' || strlen(feedKey) > HTTP_BACKFILL_MAX_FEED_KEY_LEN) {
+        return nullptr;
+    }
+
+    return feedKey;
+}
+
+bool HTTPBackfill::addFeed(const char *feedKey)
+{
+    for (uint32_t i = 0; i < _numFeeds; ++i) {
+        if (strcmp(_feedKeys[i], feedKey) == 0) {
+            _feedPoints[i]++;
+            return true;
+        }
+    }
+
+    if (_numFeeds >= HTTP_BACKFILL_MAX_FEEDS) {
+        return false;
+    }
+
+    strcpy(_feedKeys[_numFeeds], feedKey);
+    _feedPoints[_numFeeds] = 1;
+    _numFeeds++;
+
+    return true;
+}
+
+status_t HTTPBackfill::connect()
+{
+    if (_client->connected()) {
+        return STATUS_OK;
+    }
+
+    if (!_client->connect(_host, _port)) {
+        LOG_ERROR("Failed to connect to " + String(_host) + ":" + String(_port));
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+status_t HTTPBackfill::readResponse()
+{
+    uint64_t start = millis();
+
+    while (!_client->available()) {
+        if (!_client->connected() || millis() - start > RESPONSE_TIMEOUT_MS) {
+            LOG_ERROR("No response to backfill upload");
+            _client->stop();
+            return STATUS_FAIL;
+        }
+        gPowerManagement.wait(10);
+    }
+
+    _client->setTimeout(RESPONSE_TIMEOUT_MS);
+
+    // Status line, HTTP/1.1 200 OK
+    String statusLine = _client->readStringUntil('\n');
+    int space = statusLine.indexOf(' ');
+    int httpStatus = (space < 0) ? 0 : statusLine.substring(space + 1).toInt();
+
+    // Headers, only the body length and whether the connection stays open
+    // matter to us
+    int contentLength = -1;
+    bool keepAlive = true;
+
+    while (true) {
+        String header = _client->readStringUntil('\n');
+        header.trim();
+        if (header.length() == 0) {
+            break;
+        }
+
+        header.toLowerCase();
+        if (header.startsWith("content-length:")) {
+            contentLength = header.substring(strlen("content-length:")).toInt();
+        } else if (header.startsWith("connection:")
+                   && header.indexOf("close") >= 0) {
+            keepAlive = false;
+        }
+    }
+
+    // Skip the body so the connection can be used for the next feed, without
+    // a length we can't tell where it ends
+    if (contentLength >= 0 && keepAlive) {
+        uint8_t discard[64];
+        while (contentLength > 0) {
+            int len = _client->read(discard, std::min((int)sizeof(discard), contentLength));
+            if (len <= 0) {
+                keepAlive = false;
+                break;
+            }
+            contentLength -= len;
+        }
+    } else {
+        keepAlive = false;
+    }
+
+    if (!keepAlive) {
+        _client->stop();
+    }
+
+    if (httpStatus == HTTP_STATUS_TOO_MANY_REQUESTS) {
+        LOG_WARN("Backfill upload rate limited");
+        return STATUS_TIMEOUT;
+    }
+
+    if (httpStatus < HTTP_STATUS_OK || httpStatus >= 300) {
+        LOG_ERROR("Backfill upload failed, HTTP status " + String(httpStatus));
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+status_t HTTPBackfill::postFeed(const char *feedKey, uint32_t start, uint32_t end)
+{
+    status_t rc;
+    OutboxRecord record;
+    uint32_t numPoints = 0;
+
+    rc = connect();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    _client->print("POST /api/v2/" + String(_username) + "/feeds/"
+                   + String(feedKey) + "/data/batch HTTP/1.1\r\n"
+                   "Host: " + String(_host) + "\r\n"
+                   "X-AIO-Key: " + String(_key) + "\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "Connection: keep-alive\r\n"
+                   "\r\n");
+
+    // {"data":[{"value":"42.00","created_at":"2023-06-01T12:00:00Z"},...]}
+    ChunkedPrint body(_client);
+    JsonStreamWriter json(&body);
+
+    json.beginObject();
+    json.beginArray("data");
+
+    uint32_t offset = start;
+    while (offset < end && gOutbox.readAt(&offset, &record) == STATUS_OK) {
+        const char *recordFeedKey = feedKeyFromTopic(record.topic);
+        if (recordFeedKey == nullptr || strcmp(recordFeedKey, feedKey) != 0) {
+            continue;
+        }
+
+        json.beginObject();
+        json.addString("value", record.payload);
+
+        // Without a time the point is stamped when it arrives
+        if (record.timestamp != 0) {
+            char createdAt[ISO_TIME_LEN + 1];
+            time_t timestamp = record.timestamp;
+            struct tm utc;
+            gmtime_r(&timestamp, &utc);
+            strftime(createdAt, sizeof(createdAt), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+            json.addString("created_at", createdAt);
+        }
+
+        json.endObject();
+        numPoints++;
+    }
+
+    json.endArray();
+    json.endObject();
+
+    if (!body.finish()) {
+        LOG_ERROR("Failed to send backfill for " + String(feedKey));
+        _client->stop();
+        return STATUS_FAIL;
+    }
+
+    rc = readResponse();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    LOG_DEBUG("Backfilled " + String(numPoints) + " points to " + String(feedKey));
+
+    return STATUS_OK;
+}
+
+status_t HTTPBackfill::requeueFeed(const char *feedKey, uint32_t start, uint32_t end)
+{
+    status_t rc = STATUS_OK;
+    OutboxRecord record;
+
+    uint32_t offset = start;
+    while (offset < end && gOutbox.readAt(&offset, &record) == STATUS_OK) {
+        const char *recordFeedKey = feedKeyFromTopic(record.topic);
+        if (recordFeedKey == nullptr || strcmp(recordFeedKey, feedKey) != 0) {
+            continue;
+        }
+
+        if (gOutbox.append(record.topic, record.payload,
+                           record.timestamp) != STATUS_OK) {
+            rc = STATUS_FAIL;
+        }
+    }
+
+    return rc;
+}
+
+status_t HTTPBackfill::upload(uint32_t maxPoints, uint32_t *numUploaded)
+{
+    status_t rc;
+    OutboxRecord record;
+
+    if (numUploaded == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    *numUploaded = 0;
+
+    if (maxPoints == 0 || gOutbox.isEmpty()) {
+        return STATUS_OK;
+    }
+
+    rc = gOutbox.beginRead();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    // Find the feeds in the messages we are uploading
+    uint32_t start = gOutbox.headOffset();
+    uint32_t end = start;
+    uint32_t offset = start;
+    uint32_t numPoints = 0;
+
+    _numFeeds = 0;
+
+    while (numPoints < maxPoints && gOutbox.readAt(&offset, &record) == STATUS_OK) {
+        const char *feedKey = feedKeyFromTopic(record.topic);
+        if (feedKey == nullptr) {
+            LOG_WARN("Dropping outbox message to " + String(record.topic)
+                     + ", not an Adafruit IO feed");
+        } else if (!addFeed(feedKey)) {
+            break;
+        }
+
+        end = offset;
+        numPoints++;
+    }
+
+    if (end == start) {
+        gOutbox.endRead();
+        return STATUS_OK;
+    }
+
+    rc = STATUS_OK;
+
+    for (uint32_t i = 0; i < _numFeeds; ++i) {
+        if (rc == STATUS_OK) {
+            rc = postFeed(_feedKeys[i], start, end);
+
+            // Nothing is uploaded yet, leave the outbox as it was
+            if (rc != STATUS_OK && i == 0) {
+                gOutbox.endRead();
+                return rc;
+            }
+
+            if (rc == STATUS_OK) {
+                *numUploaded += _feedPoints[i];
+                continue;
+            }
+        }
+
+        // Some feeds were uploaded, keep the rest for next time
+        if (requeueFeed(_feedKeys[i], start, end) != STATUS_OK) {
+            LOG_ERROR("Failed to requeue backfill for " + String(_feedKeys[i]));
+        }
+    }
+
+    gOutbox.popUntil(end);
+    gOutbox.endRead();
+
+    if (rc == STATUS_OK) {
+        LOG_INFO("Backfilled " + String(numPoints) + " messages over HTTP, "
+                 + String(gOutbox.pendingBytes()) + " bytes left");
+    }
+
+    return rc;
+}
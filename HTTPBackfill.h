@@ -0,0 +1,136 @@
+#ifndef HTTPBACKFILL_H_W2JD7SEH
+#define HTTPBACKFILL_H_W2JD7SEH
+
+#include <Client.h>
+#include "Status.h"
+
+//! Size of the buffer request bodies are sent in, one HTTP chunk at a time
+#define HTTP_BACKFILL_CHUNK_SIZE 512
+
+//! Max number of feeds uploaded in one go
+#define HTTP_BACKFILL_MAX_FEEDS 16
+
+//! Max length of a feed key, not including the null terminator
+#define HTTP_BACKFILL_MAX_FEED_KEY_LEN 32
+
+/*! \class ChunkedPrint
+ *  \brief Sends everything printed to it with HTTP chunked transfer encoding
+ *
+ *  Output is collected in a fixed buffer and sent one chunk at a time when
+ *  the buffer fills, so a body of any length can be sent without knowing its
+ *  length up front.
+ */
+class ChunkedPrint : public Print
+{
+public:
+    ChunkedPrint(Print *out);
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+
+    /**
+     * @brief Send the last chunk and end the body
+     *
+     * @return true if everything was sent
+     */
+    bool finish();
+
+protected:
+    bool sendChunk();
+
+    Print *_out;
+
+    uint8_t _buffer[HTTP_BACKFILL_CHUNK_SIZE];
+    size_t _len;
+
+    bool _error;
+};
+
+/*! \class HTTPBackfill
+ *  \brief Uploads the outbox backlog over the Adafruit IO REST API with the
+ *  time each reading was taken
+ *
+ *  MQTT publishes are timestamped by the broker when they arrive, so a
+ *  backlog published over MQTT shows up at the wrong time. The REST batch
+ *  endpoint takes a created_at time for every data point, and all of a
+ *  feed's points in a single request.
+ *
+ *  Bodies are written with a streaming JSON writer into a fixed buffer and
+ *  sent chunked, so the backlog is never held in memory.
+ */
+class HTTPBackfill
+{
+public:
+    HTTPBackfill(Client *client, const char *host, uint16_t port,
+                 const char *username, const char *key);
+
+    /**
+     * @brief Upload messages from the start of the outbox, one request per
+     * feed, and remove them from the outbox
+     *
+     * If a feed fails after others have been uploaded, its messages are moved
+     * to the end of the outbox so the uploaded ones aren't sent twice.
+     *
+     * @param maxPoints Max number of messages to upload
+     * @param numUploaded Output, number of messages the server accepted,
+     * which count against the rate limit
+     *
+     * @return STATUS_OK if the messages were uploaded, STATUS_TIMEOUT if rate
+     * limited, STATUS_FAIL otherwise
+     */
+    status_t upload(uint32_t maxPoints, uint32_t *numUploaded);
+
+protected:
+    enum {
+        RESPONSE_TIMEOUT_MS = 10*1000,
+
+        HTTP_STATUS_OK = 200,
+        HTTP_STATUS_TOO_MANY_REQUESTS = 429,
+    };
+
+    /**
+     * @brief Get the feed key of an Adafruit IO feed topic
+     *
+     * @return The feed key, or nullptr if the topic isn't a feed
+     */
+    static const char *feedKeyFromTopic(const char *topic);
+
+    /**
+     * @brief Add a message to the feeds being uploaded, adding its feed if it
+     * isn't already
+     *
+     * @return false if there are too many feeds
+     */
+    bool addFeed(const char *feedKey);
+
+    status_t connect();
+
+    /**
+     * @brief Upload the messages for one feed between two outbox offsets
+     */
+    status_t postFeed(const char *feedKey, uint32_t start, uint32_t end);
+
+    status_t readResponse();
+
+    /**
+     * @brief Move the messages for one feed between two outbox offsets to
+     * the end of the outbox
+     */
+    status_t requeueFeed(const char *feedKey, uint32_t start, uint32_t end);
+
+    Client *_client;
+    const char *_host;
+    uint16_t _port;
+    const char *_username;
+    const char *_key;
+
+    char _feedKeys[HTTP_BACKFILL_MAX_FEEDS][HTTP_BACKFILL_MAX_FEED_KEY_LEN + 1];
+    //! Number of messages for each feed
+    uint32_t _feedPoints[HTTP_BACKFILL_MAX_FEEDS];
+    uint32_t _numFeeds;
+};
+
+#endif /* end of include guard: HTTPBACKFILL_H_W2JD7SEH */
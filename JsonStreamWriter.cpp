@@ -0,0 +1,104 @@
+#include "JsonStreamWriter.h"
+
+JsonStreamWriter::JsonStreamWriter(Print *out) :
+    _out(out),
+    _depth(0)
+{
+    _hasValue[0] = false;
+    _isObject[0] = false;
+}
+
+void JsonStreamWriter::beginValue(const char *key)
+{
+    if (_hasValue[_depth]) {
+        _out->write(',');
+    }
+    _hasValue[_depth] = true;
+
+    if (_isObject[_depth] && key != nullptr) {
+        writeString(key);
+        _out->write(':');
+    }
+}
+
+void JsonStreamWriter::writeString(const char *str)
+{
+    _out->write('"');
+
+    for (const char *c = str; *c != '\0'; ++c) {
+        switch (*c) {
+            case '"':  _out->write("\\\""); break;
+            case '\\': _out->write("\\\\"); break;
+            case '\n': _out->write("\\n"); break;
+            case '\r': _out->write("\\r"); break;
+            case '\t': _out->write("\\t"); break;
+            default:
+                // Other control characters aren't valid in a JSON string
+                if ((uint8_t)*c >= 0x20) {
+                    _out->write((uint8_t)*c);
+                }
+                break;
+        }
+    }
+
+    _out->write('"');
+}
+
+void JsonStreamWriter::beginObject(const char *key)
+{
+    beginValue(key);
+    _out->write('{');
+
+    if (_depth < MAX_DEPTH) {
+        _depth++;
+    }
+    _hasValue[_depth] = false;
+    _isObject[_depth] = true;
+}
+
+void JsonStreamWriter::endObject()
+{
+    _out->write('}');
+
+    if (_depth > 0) {
+        _depth--;
+    }
+}
+
+void JsonStreamWriter::beginArray(const char *key)
+{
+    beginValue(key);
+    _out->write('[');
+
+    if (_depth < MAX_DEPTH) {
+        _depth++;
+    }
+    _hasValue[_depth] = false;
+    _isObject[_depth] = false;
+}
+
+void JsonStreamWriter::endArray()
+{
+    _out->write(']');
+
+    if (_depth > 0) {
+        _depth--;
+    }
+}
+
+void JsonStreamWriter::addString(const char *key, const char *value)
+{
+    beginValue(key);
+    writeString(value);
+}
+
+void JsonStreamWriter::addNumber(const char *key, double value)
+{
+    beginValue(key);
+    _out->print(String(value));
+}
+
+bool JsonStreamWriter::isComplete()
+{
+    return _depth == 0;
+}
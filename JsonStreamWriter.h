@@ -0,0 +1,58 @@
+#ifndef JSONSTREAMWRITER_H_L4VX9QPA
+#define JSONSTREAMWRITER_H_L4VX9QPA
+
+#include <Arduino.h>
+
+/*! \class JsonStreamWriter
+ *  \brief Writes JSON straight to an output as it is generated
+ *
+ *  Nothing is buffered here, so documents of any size can be written without
+ *  building them in memory. Commas between values are added automatically.
+ *  Keys are ignored for values in arrays.
+ */
+class JsonStreamWriter
+{
+public:
+    JsonStreamWriter(Print *out);
+
+    void beginObject(const char *key = nullptr);
+
+    void endObject();
+
+    void beginArray(const char *key = nullptr);
+
+    void endArray();
+
+    void addString(const char *key, const char *value);
+
+    void addNumber(const char *key, double value);
+
+    /**
+     * @brief Check if every nested object and array has been closed
+     */
+    bool isComplete();
+
+protected:
+    enum {
+        MAX_DEPTH = 8,
+    };
+
+    /**
+     * @brief Write the separator and key before a value
+     */
+    void beginValue(const char *key);
+
+    void writeString(const char *str);
+
+    Print *_out;
+
+    uint8_t _depth;
+
+    //! Whether a value has been written at each depth, to place commas
+    bool _hasValue[MAX_DEPTH + 1];
+
+    //! Whether each depth is an object, which needs keys
+    bool _isObject[MAX_DEPTH + 1];
+};
+
+#endif /* end of include guard: JSONSTREAMWRITER_H_L4VX9QPA */
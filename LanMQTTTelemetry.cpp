@@ -0,0 +1,206 @@
+#include "LanMQTTTelemetry.h"
+#include "CborWriter.h"
+#include "Logger.h"
+#include "PowerManagement.h"
+#include "WakeBudget.h"
+
+LanMQTTTelemetry::LanMQTTTelemetry(const char *server, uint16_t port,
+                                   const char *username, const char *password,
+                                   const char *topic) :
+    _mqtt(&_client, server, port, MQTT_CLIENT_ID "-telemetry", username, password),
+    _topic(topic),
+    _outbox(OUTBOX_LAN_TELEMETRY, LAN_MQTT_OUTBOX_MAX_BYTES)
+{ }
+
+status_t LanMQTTTelemetry::connect()
+{
+    int8_t ret;
+
+    if (_mqtt.connected()) {
+        return STATUS_OK;
+    }
+
+#if LAN_MQTT_USE_TLS
+#ifdef LAN_MQTT_CA_CERT
+    _client.setCACert(LAN_MQTT_CA_CERT);
+#else
+    // A self signed broker on a trusted LAN
+    _client.setInsecure();
+#endif
+#endif
+
+    for (uint8_t i = 0; i < CONNECT_RETRIES; ++i) {
+        ret = _mqtt.connect();
+        if (ret == 0) {
+            LOG_INFO("LAN MQTT Connected!");
+            return STATUS_OK;
+        }
+
+        LOG_WARN(reinterpret_cast<const char *>(_mqtt.connectErrorString(ret)));
+        _mqtt.disconnect();
+        gPowerManagement.wait(CONNECT_RETRY_DELAY_MS);
+    }
+
+    LOG_ERROR("Failed to connect to LAN MQTT");
+
+    return STATUS_FAIL;
+}
+
+size_t LanMQTTTelemetry::encode(const SensorSnapshot &snapshot,
+                                uint8_t *buffer, size_t size)
+{
+    CborWriter cbor(buffer, size);
+
+    cbor.beginMap();
+
+    if (snapshot.timestamp != 0) {
+        cbor.addText("t");
+        cbor.addUint(snapshot.timestamp);
+    }
+
+    if (snapshot.co2Valid) {
+        cbor.addText("co2");
+        cbor.addFloat(snapshot.co2Ppm);
+    }
+
+    if (snapshot.airValid) {
+        cbor.addText("at");
+        cbor.addFloat(snapshot.airTempCelsius);
+        cbor.addText("ah");
+        cbor.addFloat(snapshot.airHumidityPercent);
+    }
+
+    if (snapshot.batteryValid) {
+        cbor.addText("soc");
+        cbor.addFloat(snapshot.batterySocPercent);
+        cbor.addText("bv");
+        cbor.addFloat(snapshot.batteryVoltageV);
+    }
+
+    if (snapshot.soilValid) {
+        cbor.addText("st");
+        cbor.addFloat(snapshot.soilTempCelsius);
+        cbor.addText("sm");
+        cbor.addFloat(snapshot.soilMoisturePercent);
+    }
+
+    if (snapshot.waterLevelValid) {
+        cbor.addText("wl");
+        cbor.addFloat(snapshot.waterLevelPercent);
+    }
+
+    if (snapshot.solarValid) {
+        cbor.addText("pv");
+        cbor.addFloat(snapshot.solarPanelVoltageV);
+        cbor.addText("pi");
+        cbor.addFloat(snapshot.solarPanelCurrentmA);
+        cbor.addText("pp");
+        cbor.addFloat(snapshot.solarPanelPowermW);
+    }
+
+    if (snapshot.lastWakeEnergyValid) {
+        const WakeEnergy &wake = snapshot.lastWakeEnergy;
+
+        cbor.addText("e");
+        cbor.beginMap();
+        cbor.addText("tot");
+        cbor.addFloat(wake.totalMj);
+        for (int i = 0; i < ENERGY_NUM_PHASES; ++i) {
+            cbor.addText(EnergyAccounting::phaseName((EnergyPhase)i));
+            cbor.addFloat(wake.phaseMj[i]);
+        }
+        cbor.addText("sol");
+        cbor.addFloat(wake.solarMj);
+        cbor.endMap();
+    }
+
+    cbor.endMap();
+
+    if (cbor.hasOverflowed()) {
+        return 0;
+    }
+
+    return cbor.length();
+}
+
+status_t LanMQTTTelemetry::publish(const SensorSnapshot &snapshot)
+{
+    uint8_t payload[LAN_TELEMETRY_MAX_PAYLOAD_LEN];
+
+    size_t len = encode(snapshot, payload, sizeof(payload));
+    if (len == 0) {
+        LOG_ERROR("Telemetry snapshot too large to encode");
+        return STATUS_FAIL;
+    }
+
+    // Already mounted after the first wake's publish
+    _outbox.init();
+
+    if (_mqtt.connected()) {
+        drainOutbox();
+
+        LOG_INFO("Sending " + String(len) + " byte snapshot to " + String(_topic));
+        if (_mqtt.publish(_topic, payload, len)) {
+            return STATUS_OK;
+        }
+
+        LOG_ERROR("Failed to publish snapshot, storing it");
+    } else {
+        LOG_ERROR("Not connected to LAN MQTT, storing snapshot");
+    }
+
+    if (_outbox.append(_topic, payload, len, snapshot.timestamp) != STATUS_OK) {
+        LOG_ERROR("Failed to store snapshot, dropping it");
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+status_t LanMQTTTelemetry::drainOutbox()
+{
+    status_t rc;
+    OutboxRecord record;
+    uint32_t numDrained = 0;
+
+    if (_outbox.isEmpty()) {
+        return STATUS_OK;
+    }
+
+    rc = _outbox.beginRead();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    while (numDrained < DRAIN_MAX_SNAPSHOTS
+           && gWakeBudget.remainingMs(WAKE_PHASE_PUBLISH) > 0)
+    {
+        rc = _outbox.peek(&record);
+        if (rc != STATUS_OK) {
+            break;
+        }
+
+        if (!_mqtt.publish(record.topic, (uint8_t *)record.payload, record.payloadLen)) {
+            rc = STATUS_FAIL;
+            break;
+        }
+
+        _outbox.pop();
+        numDrained++;
+    }
+
+    _outbox.endRead();
+
+    LOG_INFO("Sent " + String(numDrained) + " stored snapshots, "
+             + String(_outbox.pendingBytes()) + " bytes left");
+
+    // Running out of snapshots or time isn't an error
+    return (rc == STATUS_FAIL) ? STATUS_FAIL : STATUS_OK;
+}
+
+void LanMQTTTelemetry::disconnect()
+{
+    if (_mqtt.connected()) {
+        _mqtt.disconnect();
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef LANMQTTTELEMETRY_H_T5WG2CPN
+#define LANMQTTTELEMETRY_H_T5WG2CPN
+
+#include <WiFiClientSecure.h>
+#include "Adafruit_MQTT.h"
+#include "Adafruit_MQTT_Client.h"
+#include "TelemetryBackend.h"
+#include "Outbox.h"
+#include "config.h"
+
+//! Max size of an encoded snapshot, so any snapshot fits in the outbox
+#define LAN_TELEMETRY_MAX_PAYLOAD_LEN OUTBOX_MAX_BINARY_PAYLOAD_LEN
+
+/*! \class LanMQTTTelemetry
+ *  \brief Publishes each set of readings as one CBOR encoded message to a
+ *  MQTT broker on the LAN
+ *
+ *  The payload is a CBOR map with short text keys and single precision
+ *  values, about 100 bytes for a full snapshot and 180 with the wake energy:
+ *
+ *      t    time the readings were taken, seconds since the epoch (if known)
+ *      co2  CO2 ppm (if the CCS811 is enabled)
+ *      at   air temperature, C
+ *      ah   air humidity, %
+ *      soc  battery SOC, %
+ *      bv   battery voltage, V
+ *      st   soil temperature, C
+ *      sm   soil moisture, %
+ *      wl   water level, % (if measured)
+ *      pv   solar panel voltage, V
+ *      pi   solar panel current, mA
+ *      pp   solar panel power, mW
+ *      e    energy used by the previous wake (if known), a map of mJ by
+ *           phase name (EnergyAccounting::phaseName()) plus "tot" and "sol"
+ *
+ *  The broker is trusted and has no quota, so publishes skip the publish
+ *  scheduler. Snapshots that can't be sent are kept in their own outbox, and
+ *  sent oldest first before the next snapshot once the broker is back. Each
+ *  keeps the time it was taken in "t".
+ */
+class LanMQTTTelemetry : public TelemetryBackend
+{
+public:
+    LanMQTTTelemetry(const char *server, uint16_t port, const char *username,
+                     const char *password, const char *topic);
+
+    const char *getName() override { return "LAN MQTT"; }
+
+    status_t connect() override;
+
+    status_t publish(const SensorSnapshot &snapshot) override;
+
+    void disconnect() override;
+
+protected:
+    enum {
+        CONNECT_RETRIES = 2,
+        CONNECT_RETRY_DELAY_MS = 500,
+
+        //! Max stored snapshots sent per wake, the rest wait for the next
+        DRAIN_MAX_SNAPSHOTS = 50,
+    };
+
+    /**
+     * @brief Send stored snapshots, oldest first
+     */
+    status_t drainOutbox();
+
+    /**
+     * @brief Encode a snapshot as CBOR
+     *
+     * @return Length of the encoded snapshot, 0 if it didn't fit
+     */
+    size_t encode(const SensorSnapshot &snapshot, uint8_t *buffer, size_t size);
+
+#if LAN_MQTT_USE_TLS
+    WiFiClientSecure _client;
+#else
+    WiFiClient _client;
+#endif
+
+    Adafruit_MQTT_Client _mqtt;
+
+    const char *_topic;
+
+    Outbox _outbox;
+};
+
+#endif /* end of include guard: LANMQTTTELEMETRY_H_T5WG2CPN */
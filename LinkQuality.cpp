@@ -0,0 +1,225 @@
+#include <time.h>
+
+#include "LinkQuality.h"
+#include "TimerServer.h"
+#include "Logger.h"
+#include "config.h"
+
+#define LINK_STATS_MAGIC 0x4C494E4B
+
+// Weight of the newest sample in the smoothed RSSI and uplink energy
+#define SMOOTHING_WEIGHT 0.3f
+
+// Typical access point TX power, used to estimate how well it hears us
+#define AP_TX_POWER_DBM 20.0f
+
+// Extra margin on top of LINK_TARGET_AP_RSSI_DBM, RSSI moves a few dB
+// between wakes
+#define TX_POWER_MARGIN_DB 3.0f
+
+#define SUPPLY_VOLTAGE_V 3.3f
+
+/**
+ * Link statistics
+ */
+typedef struct {
+    //! Set to LINK_STATS_MAGIC once the smoothed values are valid
+    uint32_t magic;
+
+    float rssiDbm;
+    float uplinkMj;
+
+    //! Time of the last uplink, seconds since the epoch, 0 if unknown
+    uint32_t lastUplinkTime;
+
+    /*
+     * Statistics
+     */
+    uint32_t numUplinks;
+    uint32_t numFailed;
+    uint32_t numDeferred;
+} LinkStats;
+
+RTC_DATA_ATTR static LinkStats sLinkStats;
+
+LinkQuality gLinkQuality;
+
+typedef struct {
+    wifi_power_t power;
+    float dbm;
+    //! Average current with the radio on, mostly receiving, at this power
+    float currentMa;
+} TxPowerLevel;
+
+// Lowest power first. Currents are rough estimates from the ESP32 datasheet
+// RX and TX figures, good enough to compare uplinks with each other
+static const TxPowerLevel kTxPowerLevels[] = {
+    { WIFI_POWER_2dBm, 2.0f, 102.0f },
+    { WIFI_POWER_5dBm, 5.0f, 104.0f },
+    { WIFI_POWER_7dBm, 7.0f, 106.0f },
+    { WIFI_POWER_8_5dBm, 8.5f, 108.0f },
+    { WIFI_POWER_11dBm, 11.0f, 112.0f },
+    { WIFI_POWER_15dBm, 15.0f, 120.0f },
+    { WIFI_POWER_19_5dBm, 19.5f, 130.0f },
+};
+
+#define NUM_TX_POWER_LEVELS (sizeof(kTxPowerLevels) / sizeof(kTxPowerLevels[0]))
+#define MAX_TX_POWER_LEVEL (kTxPowerLevels[NUM_TX_POWER_LEVELS - 1])
+
+wifi_power_t LinkQuality::txPowerForRssi(float rssi)
+{
+    // The access point hears us roughly as far below its TX power as we
+    // hear it, less however much we back off from it
+    for (uint32_t i = 0; i < NUM_TX_POWER_LEVELS; ++i) {
+        float apRssi = rssi - (AP_TX_POWER_DBM - kTxPowerLevels[i].dbm);
+
+        if (apRssi >= LINK_TARGET_AP_RSSI_DBM + TX_POWER_MARGIN_DB) {
+            return kTxPowerLevels[i].power;
+        }
+    }
+
+    return MAX_TX_POWER_LEVEL.power;
+}
+
+float LinkQuality::txPowerDbm(wifi_power_t power)
+{
+    for (uint32_t i = 0; i < NUM_TX_POWER_LEVELS; ++i) {
+        if (kTxPowerLevels[i].power == power) {
+            return kTxPowerLevels[i].dbm;
+        }
+    }
+
+    return MAX_TX_POWER_LEVEL.dbm;
+}
+
+float LinkQuality::radioCurrentMa(wifi_power_t power)
+{
+    for (uint32_t i = 0; i < NUM_TX_POWER_LEVELS; ++i) {
+        if (kTxPowerLevels[i].power == power) {
+            return kTxPowerLevels[i].currentMa;
+        }
+    }
+
+    return MAX_TX_POWER_LEVEL.currentMa;
+}
+
+void LinkQuality::setTxPower(wifi_power_t power)
+{
+    if (WiFi.getTxPower() == power) {
+        return;
+    }
+
+    if (!WiFi.setTxPower(power)) {
+        LOG_WARN("Failed to set TX power");
+        return;
+    }
+
+    LOG_DEBUG("TX power " + String(txPowerDbm(power)) + " dBm");
+}
+
+void LinkQuality::applyTxPower()
+{
+    if (sLinkStats.magic != LINK_STATS_MAGIC) {
+        setTxPower(MAX_TX_POWER_LEVEL.power);
+        return;
+    }
+
+    setTxPower(txPowerForRssi(sLinkStats.rssiDbm));
+}
+
+void LinkQuality::measure()
+{
+    // One sample, the smoothing across wakes does the averaging
+    int8_t rssi = WiFi.RSSI();
+    if (rssi == 0) {
+        return;
+    }
+
+    if (sLinkStats.magic != LINK_STATS_MAGIC) {
+        sLinkStats.rssiDbm = rssi;
+        sLinkStats.uplinkMj = 0;
+        sLinkStats.magic = LINK_STATS_MAGIC;
+    } else {
+        sLinkStats.rssiDbm += SMOOTHING_WEIGHT * (rssi - sLinkStats.rssiDbm);
+    }
+
+    // Adjust to what we see now, associating may have needed more power
+    // than the rest of the wake does
+    setTxPower(txPowerForRssi(rssi));
+
+    LOG_INFO("WiFi RSSI " + String(rssi) + " dBm, smoothed "
+             + String(sLinkStats.rssiDbm) + " dBm");
+}
+
+void LinkQuality::recordUplink(uint32_t radioOnMs, bool success)
+{
+    if (!success) {
+        // Back to full power in case we backed off too far to be heard
+        sLinkStats.magic = 0;
+        sLinkStats.numFailed++;
+        return;
+    }
+
+    wifi_power_t power = WiFi.getTxPower();
+    float uplinkMj = SUPPLY_VOLTAGE_V * radioCurrentMa(power) * radioOnMs / 1000.0f;
+
+    if (sLinkStats.uplinkMj == 0) {
+        sLinkStats.uplinkMj = uplinkMj;
+    } else {
+        sLinkStats.uplinkMj += SMOOTHING_WEIGHT * (uplinkMj - sLinkStats.uplinkMj);
+    }
+
+    sLinkStats.lastUplinkTime = TimerServer::clockIsSet() ? time(nullptr) : 0;
+    sLinkStats.numUplinks++;
+
+    LOG_INFO("Uplink took " + String(radioOnMs) + " ms at "
+             + String(txPowerDbm(power)) + " dBm TX, about "
+             + String(uplinkMj) + " mJ, average " + String(sLinkStats.uplinkMj)
+             + " mJ at " + String(sLinkStats.rssiDbm) + " dBm");
+}
+
+bool LinkQuality::shouldDeferTelemetry(uint32_t backlogBytes)
+{
+    if (sLinkStats.magic != LINK_STATS_MAGIC) {
+        return false;
+    }
+
+    if (sLinkStats.rssiDbm >= LINK_POOR_RSSI_DBM
+        || sLinkStats.uplinkMj < LINK_DEFER_MIN_UPLINK_MJ)
+    {
+        return false;
+    }
+
+    if (backlogBytes >= LINK_DEFER_MAX_BACKLOG_BYTES) {
+        return false;
+    }
+
+    // Without a clock we can't tell how stale we are, don't risk it
+    time_t now = time(nullptr);
+    if (!TimerServer::clockIsSet() || sLinkStats.lastUplinkTime == 0
+        || now - sLinkStats.lastUplinkTime >= LINK_MAX_DEFER_S)
+    {
+        return false;
+    }
+
+    sLinkStats.numDeferred++;
+
+    return true;
+}
+
+int32_t LinkQuality::getRssi()
+{
+    if (sLinkStats.magic != LINK_STATS_MAGIC) {
+        return 0;
+    }
+
+    return sLinkStats.rssiDbm;
+}
+
+void LinkQuality::logStats()
+{
+    LOG_INFO("Link: " + String(sLinkStats.numUplinks) + " uplinks, "
+             + String(sLinkStats.numFailed) + " failed, "
+             + String(sLinkStats.numDeferred) + " deferred, average "
+             + String(sLinkStats.uplinkMj) + " mJ per uplink");
+}
@@ -0,0 +1,83 @@
+#ifndef LINKQUALITY_H_T4WB9MXG
+#define LINKQUALITY_H_T4WB9MXG
+
+#include <WiFi.h>
+#include "Status.h"
+
+/*! \class LinkQuality
+ *  \brief Tracks the WiFi link across wakes and sets the uplink policy from it
+ *
+ *  The RSSI and an estimate of the energy each uplink costs are smoothed
+ *  across wakes in RTC memory. They are used to:
+ *
+ *  - Transmit at the lowest power that still leaves the access point a
+ *    comfortable margin, assuming the link is roughly symmetric.
+ *  - Defer telemetry to a later wake when the link is poor and uplinks have
+ *    been expensive, as long as the outbox backlog and the time since the
+ *    last full uplink are within their limits. Readings are kept in the
+ *    outbox and sent once the link recovers.
+ *
+ *  Energy is estimated from the time the radio was on and a per TX power
+ *  average current. The estimates are logged every uplink so the thresholds
+ *  in config.h can be tuned.
+ */
+class LinkQuality
+{
+public:
+    /**
+     * @brief Set the TX power from the RSSI of earlier wakes, call once WiFi
+     * is started and before associating
+     */
+    void applyTxPower();
+
+    /**
+     * @brief Sample the RSSI of the current connection and adjust the TX
+     * power to it
+     */
+    void measure();
+
+    /**
+     * @brief Record the cost of this wake's uplink
+     *
+     * @param radioOnMs Time from starting WiFi until the uplink was done
+     * @param success False if the network couldn't be brought up, the TX
+     * power goes back to full for the next wake
+     */
+    void recordUplink(uint32_t radioOnMs, bool success);
+
+    /**
+     * @brief Check if this wake's telemetry should be deferred. The network
+     * is still brought up for alarms, config and commands, which also
+     * measures the RSSI again.
+     *
+     * @param backlogBytes Bytes waiting in the outbox
+     */
+    bool shouldDeferTelemetry(uint32_t backlogBytes);
+
+    /**
+     * @brief Get the smoothed RSSI, 0 if not known
+     */
+    int32_t getRssi();
+
+    void logStats();
+
+protected:
+    /**
+     * @brief Get the lowest TX power that leaves the access point enough
+     * margin at an RSSI
+     */
+    static wifi_power_t txPowerForRssi(float rssi);
+
+    static float txPowerDbm(wifi_power_t power);
+
+    /**
+     * @brief Estimated average current with the radio on at a TX power
+     */
+    static float radioCurrentMa(wifi_power_t power);
+
+    void setTxPower(wifi_power_t power);
+};
+
+extern LinkQuality gLinkQuality;
+
+#endif /* end of include guard: LINKQUALITY_H_T4WB9MXG */
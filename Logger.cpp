@@ -2,6 +2,7 @@
 
 #include "Logger.h"
 #include "config.h"
+#include "PublishScheduler.h"
 
 Logger gLogger(DEFAULT_LOG_LEVEL_MQTT, DEFAULT_LOG_LEVEL_UART);
 
@@ -9,18 +10,18 @@ Logger::Logger(LogLevel mqttLevel, LogLevel uartLevel) {
     _levels[MQTT] = mqttLevel;
     _levels[UART] = uartLevel;
 
-    _loggingFeed = nullptr;
+    _loggingTopic = nullptr;
 
     _mqttEnabled = false;
 }
 
-status_t Logger::enableMqttLogging(Adafruit_MQTT_Publish *loggingFeed) {
-    if (loggingFeed == nullptr) {
-        Serial.println("Attempt to enable MQTT logging with null feed");
+status_t Logger::enableMqttLogging(const char *loggingTopic) {
+    if (loggingTopic == nullptr) {
+        Serial.println("Attempt to enable MQTT logging with null topic");
         return STATUS_INVALID_PARAMS;
     }
 
-    _loggingFeed = loggingFeed;
+    _loggingTopic = loggingTopic;
     _mqttEnabled = true;
 }
 
@@ -70,12 +71,15 @@ status_t Logger::logUART(String msg) {
 }
 
 status_t Logger::logMQTT(String msg) {
-    if (_loggingFeed == nullptr) {
-        Serial.println("Logging MQTT feed null, initialize logging with a MQTT feed");
+    if (_loggingTopic == nullptr) {
+        Serial.println("Logging MQTT topic null, initialize logging with a MQTT topic");
         return STATUS_FAIL;
     }
 
-    if (!_loggingFeed->publish(msg.c_str())) {
+    // Logs are the lowest priority traffic, they are dropped when we are
+    // close to the broker rate limit
+    if (gPublishScheduler.publish(_loggingTopic, msg.c_str(),
+                                  PublishScheduler::PRIORITY_LOG) != STATUS_OK) {
         Serial.println("Failed to log over MQTT");
         return STATUS_FAIL;
     }
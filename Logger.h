@@ -46,7 +46,7 @@ class Logger {
 
     status_t SetLogLevel(LoggingOutputs output, LogLevel level);
 
-    status_t enableMqttLogging(Adafruit_MQTT_Publish *loggingFeed);
+    status_t enableMqttLogging(const char *loggingTopic);
 
     protected:
 
@@ -56,7 +56,7 @@ class Logger {
     status_t logMQTT(String msg);
 
     LogLevel _levels[NUM_LOGGING_OUTPUTS];
-    Adafruit_MQTT_Publish *_loggingFeed;
+    const char *_loggingTopic;
 
     bool _mqttEnabled;
 
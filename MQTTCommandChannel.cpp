@@ -0,0 +1,244 @@
+#include "MQTTCommandChannel.h"
+#include "GreenhouseCLI.h"
+#include "PublishScheduler.h"
+#include "AppPreferences.h"
+#include "Logger.h"
+#include "config.h"
+
+#define SEEN_IDS_MAGIC 0x53454E49
+
+//! Preferences key the seen IDs are saved under
+#define SEEN_IDS_PREFERENCES_KEY "cmdSeenIds"
+
+//! Correlation IDs of the last commands run, kept across deep sleep and
+//! saved to preferences so they also survive a power loss
+typedef struct {
+    //! Set to SEEN_IDS_MAGIC once loaded from preferences
+    uint32_t magic;
+    char ids[MQTT_COMMAND_SEEN_IDS][MQTT_COMMAND_MAX_ID_LEN + 1];
+    uint32_t next;
+} SeenCommandIds;
+
+RTC_DATA_ATTR static SeenCommandIds sSeenIds;
+
+ResponsePrint::ResponsePrint(char *buffer, size_t size) :
+    _buffer(buffer),
+    _size(size),
+    _len(0)
+{
+    _buffer[0] = '\0';
+}
+
+size_t ResponsePrint::write(uint8_t c)
+{
+    if (c == '\r') {
+        return 1;
+    }
+
+    // Responses are a single line
+    const char *text = (c == '\n') ? "; " : nullptr;
+    size_t textLen = (text != nullptr) ? strlen(text) : 1;
+
+    if (_len + textLen >= _size) {
+        return 0;
+    }
+
+    if (text != nullptr) {
+        memcpy(&_buffer[_len], text, textLen);
+    } else {
+        _buffer[_len] = c;
+    }
+
+    _len += textLen;
+    _buffer[_len] = '\0';
+
+    return 1;
+}
+
+size_t ResponsePrint::length()
+{
+    return _len;
+}
+
+MQTTCommandChannel::MQTTCommandChannel(MQTTTopicRouter *router,
+                                       const char *commandTopic,
+                                       const char *commandGetTopic,
+                                       const char *responseTopic) :
+    _router(router),
+    _commandTopic(commandTopic),
+    _getTopic(commandGetTopic),
+    _responseTopic(responseTopic),
+    _numQueued(0)
+{}
+
+status_t MQTTCommandChannel::init()
+{
+    status_t rc = _router->addRoute(_commandTopic, this);
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to route command feed");
+        return rc;
+    }
+
+    loadSeenIds();
+
+    return STATUS_OK;
+}
+
+void MQTTCommandChannel::loadSeenIds()
+{
+    if (sSeenIds.magic == SEEN_IDS_MAGIC) {
+        return;
+    }
+
+    // After a power loss, a retained or queued command must not run again
+    size_t len = gAppPreferences.getBytes(SEEN_IDS_PREFERENCES_KEY, &sSeenIds,
+                                          sizeof(sSeenIds));
+    if (len != sizeof(sSeenIds) || sSeenIds.magic != SEEN_IDS_MAGIC
+        || sSeenIds.next >= MQTT_COMMAND_SEEN_IDS)
+    {
+        memset(&sSeenIds, 0, sizeof(sSeenIds));
+        sSeenIds.magic = SEEN_IDS_MAGIC;
+    }
+}
+
+status_t MQTTCommandChannel::requestLatest()
+{
+#if MQTT_CONFIG_DELIVERY == MQTT_CONFIG_DELIVERY_GET
+    if (gPublishScheduler.publish(_getTopic, "",
+                                  PublishScheduler::PRIORITY_CONTROL) != STATUS_OK) {
+        LOG_ERROR("Failed to request latest command");
+        return STATUS_FAIL;
+    }
+#endif
+
+    return STATUS_OK;
+}
+
+status_t MQTTCommandChannel::parse(const uint8_t *data, uint16_t len,
+                                   QueuedCommand *command)
+{
+    char text[MQTT_COMMAND_MAX_LEN + 1];
+
+    len = std::min(len, (uint16_t)MQTT_COMMAND_MAX_LEN);
+    memcpy(text, data, len);
+    text[len] = '\0';
+
+    char *separator = strchr(text, ' ');
+    if (separator == nullptr || separator == text
+        || separator - text > MQTT_COMMAND_MAX_ID_LEN)
+    {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    *separator = '\0';
+
+    const char *commandLine = separator + 1;
+    while (*commandLine == ' ') {
+        commandLine++;
+    }
+
+    if (*commandLine == '\0') {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    strcpy(command->id, text);
+    strcpy(command->commandLine, commandLine);
+
+    return STATUS_OK;
+}
+
+void MQTTCommandChannel::handleMessage(const char *topic,
+                                       const uint8_t *payload, uint16_t len)
+{
+    // An empty feed has nothing to run
+    if (len == 0) {
+        return;
+    }
+
+    if (_numQueued >= MQTT_COMMAND_QUEUE_LEN) {
+        LOG_WARN("Command queue full, dropping command");
+        return;
+    }
+
+    QueuedCommand *command = &_queue[_numQueued];
+    if (parse(payload, len, command) != STATUS_OK) {
+        LOG_WARN("Ignoring command without a correlation ID: "
+                 + String((const char *)payload));
+        return;
+    }
+
+    _numQueued++;
+}
+
+bool MQTTCommandChannel::wasSeen(const char *id)
+{
+    for (uint32_t i = 0; i < MQTT_COMMAND_SEEN_IDS; ++i) {
+        if (strcmp(sSeenIds.ids[i], id) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MQTTCommandChannel::markSeen(const char *id)
+{
+    strcpy(sSeenIds.ids[sSeenIds.next], id);
+    sSeenIds.next = (sSeenIds.next + 1) % MQTT_COMMAND_SEEN_IDS;
+
+    if (gAppPreferences.putBytes(SEEN_IDS_PREFERENCES_KEY, &sSeenIds,
+                                 sizeof(sSeenIds)) != sizeof(sSeenIds))
+    {
+        LOG_WARN("Failed to save command IDs, a power loss may run "
+                 + String(id) + " again");
+    }
+}
+
+status_t MQTTCommandChannel::respond(const char *id, status_t rc,
+                                     const char *output)
+{
+    char response[MQTT_COMMAND_MAX_RESPONSE_LEN + 1];
+
+    snprintf(response, sizeof(response), "%s %s %s",
+             id, status_to_string(rc).c_str(), output);
+
+    return gPublishScheduler.publish(_responseTopic, response,
+                                     PublishScheduler::PRIORITY_CONTROL);
+}
+
+status_t MQTTCommandChannel::run(const QueuedCommand &command)
+{
+    if (wasSeen(command.id)) {
+        LOG_DEBUG("Command " + String(command.id) + " already run, skipping");
+        return STATUS_OK;
+    }
+
+    // Remembered before running, a command that crashes us isn't run again
+    markSeen(command.id);
+
+    LOG_INFO("Running command " + String(command.id) + ": "
+             + String(command.commandLine));
+
+    char output[MQTT_COMMAND_MAX_RESPONSE_LEN + 1];
+    ResponsePrint out(output, sizeof(output));
+
+    status_t rc = gGreenhouseCLI.execute(command.commandLine, &out);
+
+    return respond(command.id, rc, output);
+}
+
+status_t MQTTCommandChannel::process()
+{
+    status_t rc = STATUS_OK;
+
+    for (uint32_t i = 0; i < _numQueued; ++i) {
+        if (run(_queue[i]) != STATUS_OK) {
+            LOG_ERROR("Failed to publish response to command " + String(_queue[i].id));
+            rc = STATUS_FAIL;
+        }
+    }
+
+    _numQueued = 0;
+
+    return rc;
+}
@@ -0,0 +1,132 @@
+#ifndef MQTTCOMMANDCHANNEL_H_F8LQ2VZN
+#define MQTTCOMMANDCHANNEL_H_F8LQ2VZN
+
+#include "MQTTTopicRouter.h"
+#include "Status.h"
+
+//! Max length of a command, including the correlation ID
+#define MQTT_COMMAND_MAX_LEN 96
+
+//! Max length of a response, it must fit in one Adafruit_MQTT packet with the
+//! response topic
+#define MQTT_COMMAND_MAX_RESPONSE_LEN 96
+
+//! Max length of a correlation ID, not including the null terminator
+#define MQTT_COMMAND_MAX_ID_LEN 16
+
+//! Max number of commands received before they are run
+#define MQTT_COMMAND_QUEUE_LEN 4
+
+//! Number of recent correlation IDs remembered, to skip commands that are
+//! delivered again
+#define MQTT_COMMAND_SEEN_IDS 8
+
+/*! \class ResponsePrint
+ *  \brief Collects printed output in a fixed buffer, dropping whatever
+ *  doesn't fit
+ */
+class ResponsePrint : public Print
+{
+public:
+    ResponsePrint(char *buffer, size_t size);
+
+    size_t write(uint8_t c) override;
+
+    using Print::write;
+
+    size_t length();
+
+protected:
+    char *_buffer;
+    size_t _size;
+    size_t _len;
+};
+
+/*! \class MQTTCommandChannel
+ *  \brief Runs greenhouse CLI commands received over MQTT and publishes the
+ *  results
+ *
+ *  Commands are "<id> <command line>", e.g. "17 setWaterHours 10 14". The
+ *  command line runs through the same handlers as telnet, and the response
+ *  "<id> <status> <output>", e.g. "17 OK > Success: updated water hours", is
+ *  published to the response topic. Newlines in the output are replaced by
+ *  "; " and long output is truncated.
+ *
+ *  Commands sent while we sleep are picked up on the next connection. A
+ *  persistent session queues every command. Otherwise the latest command is
+ *  fetched like a config value, with a get request or as a retained
+ *  message. Either way a command can be delivered more than once, so the
+ *  last few correlation IDs are kept in RTC memory and preferences and a
+ *  command with an ID that was already run is skipped.
+ *
+ *  Commands routed to us are queued and run by process(), so they never run
+ *  in the middle of a config sync.
+ */
+class MQTTCommandChannel : public MQTTMessageHandler
+{
+public:
+    MQTTCommandChannel(MQTTTopicRouter *router, const char *commandTopic,
+                       const char *commandGetTopic, const char *responseTopic);
+
+    /**
+     * @brief Register the command topic with the router
+     */
+    status_t init();
+
+    /**
+     * @brief Ask the broker for the latest command, the reply is routed to
+     * us with the config values
+     */
+    status_t requestLatest();
+
+    /**
+     * @brief Queue a command routed to us
+     */
+    void handleMessage(const char *topic, const uint8_t *payload,
+                       uint16_t len) override;
+
+    /**
+     * @brief Run the queued commands and publish their responses
+     *
+     * @return STATUS_OK if every response was published
+     */
+    status_t process();
+
+protected:
+    typedef struct {
+        char id[MQTT_COMMAND_MAX_ID_LEN + 1];
+        char commandLine[MQTT_COMMAND_MAX_LEN + 1];
+    } QueuedCommand;
+
+    /**
+     * @brief Split a command into its correlation ID and command line
+     *
+     * @return STATUS_INVALID_PARAMS if the command has no ID or command line
+     */
+    static status_t parse(const uint8_t *data, uint16_t len,
+                          QueuedCommand *command);
+
+    /**
+     * @brief Load the seen IDs from preferences if they aren't in RTC memory
+     */
+    static void loadSeenIds();
+
+    bool wasSeen(const char *id);
+
+    void markSeen(const char *id);
+
+    status_t respond(const char *id, status_t rc, const char *output);
+
+    status_t run(const QueuedCommand &command);
+
+    MQTTTopicRouter *_router;
+
+    const char *_commandTopic;
+    const char *_getTopic;
+    const char *_responseTopic;
+
+    QueuedCommand _queue[MQTT_COMMAND_QUEUE_LEN];
+    uint32_t _numQueued;
+};
+
+#endif /* end of include guard: MQTTCOMMANDCHANNEL_H_F8LQ2VZN */
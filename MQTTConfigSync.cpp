@@ -0,0 +1,88 @@
+#include "MQTTConfigSync.h"
+#include "Logger.h"
+#include "config.h"
+
+MQTTConfigSync::MQTTConfigSync(MQTTTopicRouter *router) :
+    _router(router),
+    _numValues(0)
+{}
+
+status_t MQTTConfigSync::add(MQTTConfigValue *value)
+{
+    if (value == nullptr) {
+        LOG_ERROR("Config sync got null config value");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (_numValues >= MQTT_CONFIG_SYNC_MAX_VALUES) {
+        LOG_ERROR("Config sync is full, increase MQTT_CONFIG_SYNC_MAX_VALUES");
+        return STATUS_FAIL;
+    }
+
+    _values[_numValues++] = value;
+
+    return STATUS_OK;
+}
+
+uint32_t MQTTConfigSync::numPending()
+{
+    uint32_t pending = 0;
+
+    for (uint32_t i = 0; i < _numValues; ++i) {
+        if (!_values[i]->isReceived()) {
+            pending++;
+        }
+    }
+
+    return pending;
+}
+
+status_t MQTTConfigSync::sync(uint32_t timeoutMs)
+{
+    uint32_t startMs = millis();
+
+    // Fire every request before reading anything, so the broker can reply to
+    // all of them while we drain the subscriptions
+    for (uint32_t i = 0; i < _numValues; ++i) {
+        if (_values[i]->requestValue() != STATUS_OK) {
+            LOG_WARN("Failed to request config value " + String(i));
+        }
+    }
+
+    while (numPending() > 0) {
+        uint32_t elapsedMs = millis() - startMs;
+        if (elapsedMs >= timeoutMs) {
+            break;
+        }
+
+        uint32_t readTimeoutMs = timeoutMs - elapsedMs;
+        if (readTimeoutMs > SUBSCRIPTION_READ_TIMEOUT_MS) {
+            readTimeoutMs = SUBSCRIPTION_READ_TIMEOUT_MS;
+        }
+
+        _router->poll(readTimeoutMs);
+    }
+
+#if MQTT_CONFIG_DELIVERY == MQTT_CONFIG_DELIVERY_RETAINED
+    // Updates queued by a persistent session can follow the retained values,
+    // keep reading until the broker goes quiet so we end up with the latest
+    while (millis() - startMs < timeoutMs
+           && _router->poll(SUBSCRIPTION_READ_TIMEOUT_MS) != nullptr)
+    {
+    }
+#endif
+
+    uint32_t pending = numPending();
+
+    LOG_INFO("Config sync took " + String(millis() - startMs) + " ms, "
+             + String(_numValues - pending) + "/" + String(_numValues)
+             + " values received");
+
+    if (pending > 0) {
+        LOG_WARN("Config sync timed out with " + String(pending)
+                 + " values missing");
+        return STATUS_TIMEOUT;
+    }
+
+    return STATUS_OK;
+}
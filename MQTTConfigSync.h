@@ -0,0 +1,62 @@
+#ifndef MQTTCONFIGSYNC_H_R7WQK2ZD
+#define MQTTCONFIGSYNC_H_R7WQK2ZD
+
+#include "MQTTTopicRouter.h"
+#include "MQTTConfigValue.h"
+#include "Status.h"
+
+#define MQTT_CONFIG_SYNC_MAX_VALUES 8
+
+/*! \class MQTTConfigSync
+ *  \brief Fetches a batch of MQTT config values concurrently
+ *
+ *  All get requests are published up front, then incoming messages are read
+ *  in a single loop and the router hands each reply to the config value that
+ *  owns it. Messages for other topics, such as commands, go to their own
+ *  handlers. The sync finishes when every value has arrived or a single shared
+ *  deadline expires.
+ *
+ *  With retained config delivery there are no requests to publish, the sync
+ *  only waits for the retained values delivered on subscribe.
+ */
+class MQTTConfigSync
+{
+public:
+    MQTTConfigSync(MQTTTopicRouter *router);
+
+    /**
+     * @brief Add a config value to the batch
+     *
+     * @param value The config value to fetch on every sync
+     *
+     * @return status
+     */
+    status_t add(MQTTConfigValue *value);
+
+    /**
+     * @brief Request all values in the batch and wait for the replies
+     *
+     * Values that arrived before the deadline are updated even if the sync
+     * times out, check MQTTConfigValue::isReceived() for each value
+     *
+     * @param timeoutMs The deadline shared by all values in the batch
+     *
+     * @return STATUS_OK if every value was received, STATUS_TIMEOUT if the
+     * deadline expired first
+     */
+    status_t sync(uint32_t timeoutMs);
+
+protected:
+    enum {
+        SUBSCRIPTION_READ_TIMEOUT_MS = 100,
+    };
+
+    uint32_t numPending();
+
+    MQTTTopicRouter *_router;
+
+    MQTTConfigValue *_values[MQTT_CONFIG_SYNC_MAX_VALUES];
+    uint32_t _numValues;
+};
+
+#endif /* end of include guard: MQTTCONFIGSYNC_H_R7WQK2ZD */
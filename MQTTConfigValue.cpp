@@ -1,38 +1,93 @@
 #include "MQTTConfigValue.h"
 #include "Logger.h"
+#include "config.h"
+#include "PublishScheduler.h"
 
-MQTTConfigValue::MQTTConfigValue(Adafruit_MQTT *mqtt,
+MQTTConfigValue::MQTTConfigValue(MQTTTopicRouter *router,
                                  const char *configMQTTFeedName,
                                  const char *configMQTTFeedNameGet) :
-    _value_feed(mqtt, configMQTTFeedName),
-    _get_feed(mqtt, configMQTTFeedNameGet),
-    _mqtt(mqtt)
+    _router(router),
+    _value_topic(configMQTTFeedName),
+    _get_topic(configMQTTFeedNameGet),
+    _hasValue(false),
+    _received(false),
+    _value(0),
+    _onOff(VALUE_NOT_ON_OFF)
 {}
 
 status_t MQTTConfigValue::init()
 {
-    if (!_mqtt->subscribe(&_value_feed)) {
-        LOG_ERROR("Failed to subscribe to mqtt feed");
-        return STATUS_FAIL;
+    status_t rc = _router->addRoute(_value_topic, this);
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to route mqtt feed " + String(_value_topic));
+        return rc;
     }
 
     return STATUS_OK;
 }
 
-status_t MQTTConfigValue::updateValue()
+status_t MQTTConfigValue::requestValue()
 {
-    Adafruit_MQTT_Subscribe *subscription;
+#if MQTT_CONFIG_DELIVERY == MQTT_CONFIG_DELIVERY_RETAINED
+    // The broker delivers the retained value when we subscribe, so there is
+    // nothing to request. The value may already have been read while
+    // connecting, in which case it is the latest one.
+    _received = _hasValue;
+#else
+    _received = false;
 
-    if (!_get_feed.publish('\0')) {
+    if (gPublishScheduler.publish(_get_topic, "",
+                                  PublishScheduler::PRIORITY_CONTROL) != STATUS_OK) {
         LOG_ERROR("Failed to publish to get feed");
         return STATUS_FAIL;
     }
+#endif
+
+    return STATUS_OK;
+}
+
+void MQTTConfigValue::handleMessage(const char *topic, const uint8_t *payload,
+                                    uint16_t len)
+{
+    const char *text = (const char *)payload;
+
+    _value = atof(text);
+
+    if (strcmp(text, "ON") == 0) {
+        _onOff = VALUE_ON;
+    } else if (strcmp(text, "OFF") == 0) {
+        _onOff = VALUE_OFF;
+    } else {
+        _onOff = VALUE_NOT_ON_OFF;
+    }
+
+    _hasValue = true;
+    _received = true;
+}
+
+bool MQTTConfigValue::isReceived()
+{
+    return _received;
+}
+
+status_t MQTTConfigValue::updateValue()
+{
+    status_t rc = requestValue();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
 
     for (int i = 0; i < SUBSCRIPTION_READ_NUM_TRIES; ++i) {
-        if ((subscription = _mqtt->readSubscription(SUBSCRIPTION_READ_TIMEOUT_MS))) {
-            if (subscription == &_value_feed) {
-                return STATUS_OK;
-            }
+        MQTTMessageHandler *handler = _router->poll(SUBSCRIPTION_READ_TIMEOUT_MS);
+
+        if (handler == this) {
+            return STATUS_OK;
+        }
+
+        // With retained delivery there is no reply to wait for, once nothing
+        // newer is queued the last delivered value is current
+        if (handler == nullptr && _received) {
+            return STATUS_OK;
         }
     }
 
@@ -43,29 +98,15 @@ status_t MQTTConfigValue::updateValue()
 
 double MQTTConfigValue::getValueDouble()
 {
-    double data = atof((char *)_value_feed.lastread);
-
-    return data;
+    return _value;
 }
 
-std::pair<uint8_t *, uint8_t> MQTTConfigValue::getValueBuffer()
+bool MQTTConfigValue::getValueOnOff()
 {
-    std::pair<uint8_t *, uint8_t> bufferPair = std::make_pair(_value_feed.lastread,
-                                                              _value_feed.datalen);
+    if (_onOff == VALUE_NOT_ON_OFF) {
+        LOG_ERROR("Got a value that isn't ON or OFF from feed "
+                  + String(_value_topic));
+    }
 
-    return bufferPair;
+    return _onOff == VALUE_ON;
 }
-
-bool MQTTConfigValue::getValueOnOff()
-{
-      if (strcmp((char *)_value_feed.lastread, "ON") == 0) {
-          return true;
-      } else if (strcmp((char *)_value_feed.lastread, "OFF") == 0) {
-          return false;
-      } else {
-          LOG_ERROR("Got unknown value "
-                    + String((char *)_value_feed.lastread)
-                    + " from feed " + String(_value_feed.topic));
-          return false;
-      }
-} 
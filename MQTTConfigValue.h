@@ -1,32 +1,63 @@
 #ifndef MQTTCONFIGVALUE_H_3AHQU2BD
 #define MQTTCONFIGVALUE_H_3AHQU2BD
 
-#include "Adafruit_MQTT.h"
+#include "MQTTTopicRouter.h"
 #include "Status.h"
 
 //! \class MQTTConfigValue
 //\brief Class to manage updating a config value over MQTT
-class MQTTConfigValue
+//
+// Values are routed to us by the topic router and parsed as they arrive, so
+// a config value doesn't keep a receive buffer, or with a wildcard
+// subscription use a subscription of its own.
+class MQTTConfigValue : public MQTTMessageHandler
 {
     public:
         /**
          * @brief Constructor
          *
-         * @param mqtt Pointer to the MQTT instance
+         * @param router The router messages are received through
          * @param configMQTTFeedName The feed name containing the config values
          * (need to prepend username)
          * @param configMQTTFeedNameGet The feed name with /get appended
          * (need to prepend username)
          */
-        MQTTConfigValue(Adafruit_MQTT *mqtt, const char *configMQTTFeedName, const char *configMQTTFeedNameGet);
+        MQTTConfigValue(MQTTTopicRouter *router, const char *configMQTTFeedName, const char *configMQTTFeedNameGet);
 
+        /**
+         * @brief Register the value feed with the router
+         */
         status_t init();
 
+        /**
+         * @brief Request the current value and wait for the reply
+         *
+         * Messages for other topics read while waiting are routed to their
+         * handlers, use an MQTTConfigSync to fetch several values at once
+         */
         status_t updateValue();
 
-        double getValueDouble();
+        /**
+         * @brief Publish a request for the current value to the get feed,
+         * without waiting for the reply
+         *
+         * Clears the received flag, which is set again once the reply is
+         * routed to this value
+         */
+        status_t requestValue();
+
+        /**
+         * @brief Parse a value routed to us and mark it as received
+         */
+        void handleMessage(const char *topic, const uint8_t *payload,
+                           uint16_t len) override;
+
+        /**
+         * @brief Check if a value has been received since the last request
+         */
+        bool isReceived();
 
-        std::pair<uint8_t *, uint8_t> getValueBuffer();
+        double getValueDouble();
 
         bool getValueOnOff();
 
@@ -36,9 +67,22 @@ class MQTTConfigValue
             SUBSCRIPTION_READ_NUM_TRIES = 50,
         };
 
-        Adafruit_MQTT *_mqtt;
-        Adafruit_MQTT_Subscribe _value_feed;
-        Adafruit_MQTT_Publish _get_feed;
+        enum OnOff {
+            VALUE_OFF,
+            VALUE_ON,
+            VALUE_NOT_ON_OFF,
+        };
+
+        MQTTTopicRouter *_router;
+        const char *_value_topic;
+        const char *_get_topic;
+
+        //! Set once any value has arrived, even if not since the last request
+        bool _hasValue;
+        bool _received;
+
+        double _value;
+        OnOff _onOff;
 };
 
 #endif /* end of include guard: MQTTCONFIGVALUE_H_3AHQU2BD */
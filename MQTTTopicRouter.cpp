@@ -0,0 +1,119 @@
+#include "MQTTTopicRouter.h"
+#include "Logger.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+MQTTTopicRouter::MQTTTopicRouter(GreenhouseMQTTClient *mqtt) :
+    _mqtt(mqtt),
+    _numRoutes(0),
+    _numFilters(0)
+{}
+
+uint32_t MQTTTopicRouter::hashTopic(const char *topic)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    while (*topic != '\0') {
+        hash ^= (uint8_t)*topic++;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+status_t MQTTTopicRouter::addFilter(const char *filter)
+{
+    if (filter == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (_numFilters >= MQTT_ROUTER_MAX_FILTERS) {
+        LOG_ERROR("Topic router is out of filters, increase MQTT_ROUTER_MAX_FILTERS");
+        return STATUS_FAIL;
+    }
+
+    _filters[_numFilters++] = filter;
+
+    return STATUS_OK;
+}
+
+status_t MQTTTopicRouter::addRoute(const char *topic, MQTTMessageHandler *handler)
+{
+    if (topic == nullptr || handler == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (findHandler(topic) != nullptr) {
+        LOG_ERROR("Topic " + String(topic) + " is already routed");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (_numRoutes >= MQTT_ROUTER_MAX_ROUTES) {
+        LOG_ERROR("Topic router is out of routes, increase MQTT_ROUTER_MAX_ROUTES");
+        return STATUS_FAIL;
+    }
+
+    Route *route = &_routes[_numRoutes++];
+    route->hash = hashTopic(topic);
+    route->topic = topic;
+    route->handler = handler;
+
+    return STATUS_OK;
+}
+
+status_t MQTTTopicRouter::subscribe(uint8_t qos)
+{
+    status_t rc = STATUS_OK;
+
+    if (_numFilters > 0) {
+        for (uint32_t i = 0; i < _numFilters; ++i) {
+            if (!_mqtt->subscribeFilter(_filters[i], qos)) {
+                LOG_ERROR("Failed to subscribe to " + String(_filters[i]));
+                rc = STATUS_FAIL;
+            }
+        }
+
+        return rc;
+    }
+
+    for (uint32_t i = 0; i < _numRoutes; ++i) {
+        if (!_mqtt->subscribeFilter(_routes[i].topic, qos)) {
+            LOG_ERROR("Failed to subscribe to " + String(_routes[i].topic));
+            rc = STATUS_FAIL;
+        }
+    }
+
+    return rc;
+}
+
+MQTTMessageHandler *MQTTTopicRouter::findHandler(const char *topic)
+{
+    uint32_t hash = hashTopic(topic);
+
+    for (uint32_t i = 0; i < _numRoutes; ++i) {
+        if (_routes[i].hash == hash && strcmp(_routes[i].topic, topic) == 0) {
+            return _routes[i].handler;
+        }
+    }
+
+    return nullptr;
+}
+
+MQTTMessageHandler *MQTTTopicRouter::poll(int16_t timeoutMs)
+{
+    MQTTMessage message;
+
+    if (!_mqtt->readMessage(&message, timeoutMs)) {
+        return nullptr;
+    }
+
+    MQTTMessageHandler *handler = findHandler(message.topic);
+    if (handler == nullptr) {
+        return nullptr;
+    }
+
+    handler->handleMessage(message.topic, message.payload, message.len);
+
+    return handler;
+}
@@ -0,0 +1,98 @@
+#ifndef MQTTTOPICROUTER_H_C6VY1TQE
+#define MQTTTOPICROUTER_H_C6VY1TQE
+
+#include "GreenhouseMQTTClient.h"
+#include "Status.h"
+
+//! Max number of topics messages can be routed to
+#define MQTT_ROUTER_MAX_ROUTES 16
+
+//! Max number of wildcard subscriptions
+#define MQTT_ROUTER_MAX_FILTERS 2
+
+/*! \class MQTTMessageHandler
+ *  \brief Receives the messages routed to a topic
+ */
+class MQTTMessageHandler
+{
+public:
+    /**
+     * @brief Handle a message, the topic and payload are only valid for the
+     * duration of the call
+     *
+     * @param payload Null terminated payload
+     */
+    virtual void handleMessage(const char *topic, const uint8_t *payload,
+                               uint16_t len) = 0;
+};
+
+/*! \class MQTTTopicRouter
+ *  \brief Dispatches incoming messages to handlers by topic
+ *
+ *  Messages are read into the MQTT client's packet buffer, shared by every
+ *  topic, and handed to the handler registered for their topic. Topics are
+ *  matched by hash, with a string compare only to confirm a match. Messages
+ *  for topics without a handler, such as our own publishes delivered back
+ *  through a wildcard subscription, are dropped.
+ *
+ *  With wildcard filters added, e.g. "user/feeds/+", only the filters are
+ *  subscribed to, so a new route costs no subscription. Without filters each
+ *  route is subscribed to on its own.
+ */
+class MQTTTopicRouter
+{
+public:
+    MQTTTopicRouter(GreenhouseMQTTClient *mqtt);
+
+    /**
+     * @brief Add a wildcard subscription covering routed topics
+     */
+    status_t addFilter(const char *filter);
+
+    /**
+     * @brief Route messages on a topic to a handler
+     *
+     * @param topic The topic, must stay valid
+     */
+    status_t addRoute(const char *topic, MQTTMessageHandler *handler);
+
+    /**
+     * @brief Subscribe to the filters, or every route if there are none.
+     * Call after each connect.
+     */
+    status_t subscribe(uint8_t qos);
+
+    /**
+     * @brief Read one message and dispatch it
+     *
+     * @param timeoutMs Max time to wait for a message
+     *
+     * @return The handler the message was dispatched to, nullptr if no
+     * message was read or nothing handles its topic
+     */
+    MQTTMessageHandler *poll(int16_t timeoutMs);
+
+protected:
+    typedef struct {
+        uint32_t hash;
+        const char *topic;
+        MQTTMessageHandler *handler;
+    } Route;
+
+    /**
+     * @brief FNV-1a hash of a topic
+     */
+    static uint32_t hashTopic(const char *topic);
+
+    MQTTMessageHandler *findHandler(const char *topic);
+
+    GreenhouseMQTTClient *_mqtt;
+
+    Route _routes[MQTT_ROUTER_MAX_ROUTES];
+    uint32_t _numRoutes;
+
+    const char *_filters[MQTT_ROUTER_MAX_FILTERS];
+    uint32_t _numFilters;
+};
+
+#endif /* end of include guard: MQTTTOPICROUTER_H_C6VY1TQE */
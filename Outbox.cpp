@@ -0,0 +1,451 @@
+#include "Outbox.h"
+#include "Logger.h"
+#include "config.h"
+
+#define OUTBOX_APPEND_MAGIC 0x4150504E
+
+/*
+ * Files of each outbox, all on the one LittleFS partition
+ */
+static const OutboxFiles outboxFiles[OUTBOX_NUM] = {
+    { "outbox", "/outbox.log", "/outbox.head", "/outbox.head.tmp", "/outbox.tmp" },
+    { "LAN outbox", "/lan.log", "/lan.head", "/lan.head.tmp", "/lan.tmp" },
+};
+
+/**
+ * Outbox statistics
+ */
+typedef struct OutboxStats {
+    uint32_t numAppended;
+    uint32_t numDrained;
+    uint32_t numDropped;
+    uint32_t numCorrupt;
+} OutboxStats;
+
+RTC_DATA_ATTR static OutboxStats sStats[OUTBOX_NUM];
+
+/**
+ * Append in progress, kept in RTC memory so a reset part way through an
+ * append can be undone on the next boot. Lost on power loss, where the torn
+ * record is found and truncated when draining instead.
+ */
+typedef struct OutboxAppendState {
+    //! Set to OUTBOX_APPEND_MAGIC while an append is being written
+    uint32_t magic;
+    //! Size of the log before the append
+    uint32_t logSize;
+} OutboxAppendState;
+
+RTC_DATA_ATTR static OutboxAppendState sAppendState[OUTBOX_NUM];
+
+Outbox gOutbox(OUTBOX_ADAFRUIT_IO, OUTBOX_MAX_BYTES);
+
+Outbox::Outbox(OutboxId id, uint32_t maxBytes) :
+    _files(&outboxFiles[id]),
+    _stats(&sStats[id]),
+    _appendState(&sAppendState[id]),
+    _maxBytes(maxBytes),
+    _mounted(false),
+    _head(0),
+    _reading(false),
+    _peekEnd(0),
+    _corrupt(false),
+    _corruptOffset(0)
+{ }
+
+status_t Outbox::init()
+{
+    if (_mounted) {
+        return STATUS_OK;
+    }
+
+    // Format on failure, only outboxes are kept on the partition. Mounting
+    // an already mounted partition does nothing.
+    if (!LittleFS.begin(true)) {
+        LOG_ERROR("Failed to mount " + String(_files->name) + " filesystem");
+        return STATUS_FAIL;
+    }
+
+    _mounted = true;
+
+    // Left behind by a reset part way through compacting or storing the head
+    if (LittleFS.exists(_files->compactPath)) {
+        LittleFS.remove(_files->compactPath);
+    }
+    if (LittleFS.exists(_files->headTmpPath)) {
+        LittleFS.remove(_files->headTmpPath);
+    }
+
+    status_t rc = loadHead();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    // Drop a record torn by a reset part way through appending it, before
+    // anything is appended after it
+    if (_appendState->magic == OUTBOX_APPEND_MAGIC) {
+        _appendState->magic = 0;
+
+        uint32_t goodSize = std::max(_appendState->logSize, _head);
+        if (logSize() > goodSize) {
+            LOG_WARN(String(_files->name) + " append interrupted, truncating to "
+                 + String(goodSize) + " bytes");
+            _stats->numCorrupt++;
+            return compact(goodSize);
+        }
+    }
+
+    return STATUS_OK;
+}
+
+uint32_t Outbox::logSize()
+{
+    if (!LittleFS.exists(_files->logPath)) {
+        return 0;
+    }
+
+    File file = LittleFS.open(_files->logPath, FILE_READ);
+    if (!file) {
+        return 0;
+    }
+
+    uint32_t size = file.size();
+    file.close();
+
+    return size;
+}
+
+status_t Outbox::loadHead()
+{
+    _head = 0;
+
+    if (!LittleFS.exists(_files->headPath)) {
+        return STATUS_OK;
+    }
+
+    File file = LittleFS.open(_files->headPath, FILE_READ);
+    if (!file) {
+        return STATUS_FAIL;
+    }
+
+    uint32_t head = 0;
+    size_t len = file.read((uint8_t *)&head, sizeof(head));
+    file.close();
+
+    // Resending the drained messages is better than losing the rest
+    if (len != sizeof(head) || head > logSize()) {
+        LOG_ERROR(String(_files->name) + " head invalid, draining from the start");
+        return STATUS_OK;
+    }
+
+    _head = head;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::storeHead()
+{
+    // Opening for write truncates, so write a new head and rename it over the
+    // old one, which LittleFS does atomically. A reset leaves either head.
+    File file = LittleFS.open(_files->headTmpPath, FILE_WRITE);
+    if (!file) {
+        return STATUS_FAIL;
+    }
+
+    size_t len = file.write((uint8_t *)&_head, sizeof(_head));
+    file.close();
+
+    if (len != sizeof(_head) || !LittleFS.rename(_files->headTmpPath, _files->headPath)) {
+        LittleFS.remove(_files->headTmpPath);
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+status_t Outbox::clear()
+{
+    LittleFS.remove(_files->logPath);
+    LittleFS.remove(_files->headPath);
+
+    _head = 0;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::compact(uint32_t end)
+{
+    File src = LittleFS.open(_files->logPath, FILE_READ);
+    if (!src) {
+        return STATUS_FAIL;
+    }
+
+    File dst = LittleFS.open(_files->compactPath, FILE_WRITE);
+    if (!dst) {
+        src.close();
+        return STATUS_FAIL;
+    }
+
+    uint8_t chunk[COPY_CHUNK_SIZE];
+    uint32_t offset = _head;
+    bool ok = src.seek(offset);
+
+    while (ok && offset < end && src.available()) {
+        size_t len = src.read(chunk, std::min<uint32_t>(sizeof(chunk), end - offset));
+        if (len == 0 || dst.write(chunk, len) != len) {
+            ok = false;
+        }
+        offset += len;
+    }
+
+    src.close();
+    dst.close();
+
+    if (!ok) {
+        LittleFS.remove(_files->compactPath);
+        return STATUS_FAIL;
+    }
+
+    // Drop the head first, a reset before the rename leaves the old log with
+    // drained messages resent rather than the new log with messages skipped.
+    // LittleFS renames over the old log atomically.
+    LittleFS.remove(_files->headPath);
+    if (!LittleFS.rename(_files->compactPath, _files->logPath)) {
+        return STATUS_FAIL;
+    }
+
+    _head = 0;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::append(const char *topic, const char *payload, uint32_t timestamp)
+{
+    if (payload == nullptr || strlen(payload) > OUTBOX_MAX_PAYLOAD_LEN) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    return append(topic, (const uint8_t *)payload, strlen(payload), timestamp);
+}
+
+status_t Outbox::append(const char *topic, const uint8_t *payload, size_t payloadLen,
+                        uint32_t timestamp)
+{
+    if (topic == nullptr || payload == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    size_t topicLen = strlen(topic);
+
+    if (topicLen > OUTBOX_MAX_TOPIC_LEN || payloadLen > OUTBOX_MAX_BINARY_PAYLOAD_LEN) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (!_mounted) {
+        _stats->numDropped++;
+        return STATUS_FAIL;
+    }
+
+    uint32_t recordLen = sizeof(RecordHeader) + topicLen + payloadLen;
+    if (logSize() + recordLen > _maxBytes) {
+        _stats->numDropped++;
+        return STATUS_FAIL;
+    }
+
+    RecordHeader header;
+    header.magic = RECORD_MAGIC;
+    header.topicLen = topicLen;
+    header.payloadLen = payloadLen;
+    header.timestamp = timestamp;
+
+    _appendState->logSize = logSize();
+    _appendState->magic = OUTBOX_APPEND_MAGIC;
+
+    File file = LittleFS.open(_files->logPath, FILE_APPEND);
+    if (!file) {
+        _appendState->magic = 0;
+        _stats->numDropped++;
+        return STATUS_FAIL;
+    }
+
+    size_t len = file.write((uint8_t *)&header, sizeof(header));
+    len += file.write((const uint8_t *)topic, topicLen);
+    len += file.write(payload, payloadLen);
+    file.close();
+
+    // A short write is left for the next init or drain to truncate
+    if (len == recordLen) {
+        _appendState->magic = 0;
+    }
+
+    if (len != recordLen) {
+        _stats->numDropped++;
+        return STATUS_FAIL;
+    }
+
+    _stats->numAppended++;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::beginRead()
+{
+    if (!_mounted) {
+        return STATUS_FAIL;
+    }
+
+    _reading = true;
+    _corrupt = false;
+    _peekEnd = _head;
+
+    if (LittleFS.exists(_files->logPath)) {
+        _readFile = LittleFS.open(_files->logPath, FILE_READ);
+    }
+
+    return STATUS_OK;
+}
+
+status_t Outbox::readAt(uint32_t *offset, OutboxRecord *record)
+{
+    if (offset == nullptr || record == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (!_reading || !_readFile || _corrupt) {
+        return STATUS_EMPTY;
+    }
+
+    if (!_readFile.seek(*offset)) {
+        return STATUS_EMPTY;
+    }
+
+    RecordHeader header;
+    size_t len = _readFile.read((uint8_t *)&header, sizeof(header));
+    if (len == 0) {
+        return STATUS_EMPTY;
+    }
+
+    // A short or garbled record is left by a reset part way through an append
+    if (len != sizeof(header)
+        || header.magic != RECORD_MAGIC
+        || header.topicLen > OUTBOX_MAX_TOPIC_LEN
+        || _readFile.read((uint8_t *)record->topic, header.topicLen) != header.topicLen
+        || _readFile.read((uint8_t *)record->payload, header.payloadLen) != header.payloadLen)
+    {
+        _corrupt = true;
+        _corruptOffset = *offset;
+        return STATUS_EMPTY;
+    }
+
+    record->topic[header.topicLen] = '\0';
+    record->payload[header.payloadLen] = '\0';
+    record->payloadLen = header.payloadLen;
+    record->timestamp = header.timestamp;
+
+    *offset += sizeof(header) + header.topicLen + header.payloadLen;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::peek(OutboxRecord *record)
+{
+    _peekEnd = _head;
+
+    return readAt(&_peekEnd, record);
+}
+
+status_t Outbox::pop()
+{
+    return popUntil(_peekEnd);
+}
+
+uint32_t Outbox::headOffset()
+{
+    return _head;
+}
+
+status_t Outbox::popUntil(uint32_t offset)
+{
+    if (!_reading || offset <= _head) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    // Count the messages removed, offsets always land on record boundaries
+    OutboxRecord record;
+    uint32_t next = _head;
+    while (next < offset && readAt(&next, &record) == STATUS_OK) {
+        _stats->numDrained++;
+    }
+
+    _head = offset;
+
+    return STATUS_OK;
+}
+
+status_t Outbox::endRead()
+{
+    if (!_reading) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (_readFile) {
+        _readFile.close();
+    }
+    _reading = false;
+
+    uint32_t size = logSize();
+
+    // Keep the good records before the corrupt one. Anything appended after
+    // a torn record can't be found again, so it goes too.
+    if (_corrupt) {
+        LOG_ERROR(String(_files->name) + " corrupt at " + String(_corruptOffset) + ", dropping "
+                  + String(size - std::min(_corruptOffset, size)) + " bytes");
+        _stats->numCorrupt++;
+
+        if (_corruptOffset <= _head) {
+            return clear();
+        }
+
+        // On failure the head is stored, and the next drain tries again
+        if (compact(_corruptOffset) == STATUS_OK) {
+            return STATUS_OK;
+        }
+
+        return storeHead();
+    }
+
+    if (_head >= size) {
+        return clear();
+    }
+
+    if (_head > size / 2 && compact(size) == STATUS_OK) {
+        return STATUS_OK;
+    }
+
+    return storeHead();
+}
+
+uint32_t Outbox::pendingBytes()
+{
+    if (!_mounted) {
+        return 0;
+    }
+
+    uint32_t size = logSize();
+
+    return size > _head ? size - _head : 0;
+}
+
+bool Outbox::isEmpty()
+{
+    return pendingBytes() == 0;
+}
+
+void Outbox::logStats()
+{
+    LOG_DEBUG(String(_files->name) + ": pending " + String(pendingBytes()) + " bytes"
+              + " appended " + String(_stats->numAppended)
+              + " drained " + String(_stats->numDrained)
+              + " dropped " + String(_stats->numDropped)
+              + " corrupt " + String(_stats->numCorrupt));
+}
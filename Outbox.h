@@ -0,0 +1,200 @@
+#ifndef OUTBOX_H_7TNR4XKD
+#define OUTBOX_H_7TNR4XKD
+
+#include <LittleFS.h>
+#include "Status.h"
+
+//! Max length of a stored topic, not including the null terminator
+#define OUTBOX_MAX_TOPIC_LEN 64
+
+//! Max length of a stored text payload, not including the null terminator
+#define OUTBOX_MAX_PAYLOAD_LEN 64
+
+//! Max length of a stored binary payload, its length is stored in a byte
+#define OUTBOX_MAX_BINARY_PAYLOAD_LEN 255
+
+/**
+ * Outboxes, each with its own files
+ */
+enum OutboxId {
+    //! Messages for Adafruit IO, drained by PublishScheduler and HTTPBackfill
+    OUTBOX_ADAFRUIT_IO,
+    //! Snapshots for the LAN MQTT telemetry backend
+    OUTBOX_LAN_TELEMETRY,
+    OUTBOX_NUM,
+};
+
+typedef struct {
+    //! Time the message was stored, seconds since the epoch, 0 if unknown
+    uint32_t timestamp;
+    char topic[OUTBOX_MAX_TOPIC_LEN + 1];
+    //! Null terminated, so text payloads can be used as strings
+    char payload[OUTBOX_MAX_BINARY_PAYLOAD_LEN + 1];
+    uint8_t payloadLen;
+} OutboxRecord;
+
+typedef struct {
+    const char *name;
+    const char *logPath;
+    const char *headPath;
+    //! The new head is written here then renamed over the head
+    const char *headTmpPath;
+    //! The compacted log is written here then renamed over the log
+    const char *compactPath;
+} OutboxFiles;
+
+struct OutboxStats;
+struct OutboxAppendState;
+
+/*! \class Outbox
+ *  \brief Durable store for MQTT messages that couldn't be sent
+ *
+ *  Each OutboxId has its own files, so backends draining to different
+ *  brokers don't hold each other up.
+ *
+ *  Messages are appended to a log file on LittleFS, which wear levels the
+ *  flash for us. The offset of the oldest undelivered message is kept in a
+ *  separate head file, so draining never rewrites the log. The log is
+ *  deleted once it is fully drained, and compacted when more than half of it
+ *  has been drained.
+ *
+ *  To drain, call beginRead(), then peek() and pop() each record once it has
+ *  been sent, then endRead() to store the new head. readAt() and popUntil()
+ *  allow several passes over the messages before removing them.
+ */
+class Outbox
+{
+public:
+    Outbox(OutboxId id, uint32_t maxBytes);
+
+    /**
+     * @brief Mount the filesystem, formatting it if it can't be mounted
+     */
+    status_t init();
+
+    /**
+     * @brief Append a message to the end of the outbox
+     *
+     * @param timestamp Time the message was generated, seconds since the
+     * epoch, 0 if unknown
+     *
+     * @return STATUS_OK if the message was stored, STATUS_FAIL if the outbox
+     * is full or the write failed
+     */
+    status_t append(const char *topic, const char *payload, uint32_t timestamp);
+
+    /**
+     * @brief Append a message with a binary payload, of up to
+     * OUTBOX_MAX_BINARY_PAYLOAD_LEN bytes
+     */
+    status_t append(const char *topic, const uint8_t *payload, size_t payloadLen,
+                    uint32_t timestamp);
+
+    status_t beginRead();
+
+    /**
+     * @brief Read the oldest message without removing it
+     *
+     * @return STATUS_OK if a message was read, STATUS_EMPTY if there are no
+     * more messages
+     */
+    status_t peek(OutboxRecord *record);
+
+    /**
+     * @brief Remove the message returned by the last peek()
+     */
+    status_t pop();
+
+    /**
+     * @brief Get the offset of the oldest message, for use with readAt()
+     */
+    uint32_t headOffset();
+
+    /**
+     * @brief Read the message at an offset without removing it
+     *
+     * @param offset Offset to read from, set to the offset of the next
+     * message on success
+     *
+     * @return STATUS_OK if a message was read, STATUS_EMPTY if there are no
+     * more messages
+     */
+    status_t readAt(uint32_t *offset, OutboxRecord *record);
+
+    /**
+     * @brief Remove all messages before an offset returned by readAt()
+     */
+    status_t popUntil(uint32_t offset);
+
+    status_t endRead();
+
+    /**
+     * @brief Get the number of bytes of undelivered messages
+     */
+    uint32_t pendingBytes();
+
+    bool isEmpty();
+
+    void logStats();
+
+protected:
+    enum {
+        RECORD_MAGIC = 0x0B0C,
+
+        //! Size of the chunks copied when compacting
+        COPY_CHUNK_SIZE = 256,
+    };
+
+    typedef struct __attribute__((packed)) {
+        uint16_t magic;
+        uint8_t topicLen;
+        uint8_t payloadLen;
+        uint32_t timestamp;
+    } RecordHeader;
+
+    status_t loadHead();
+
+    status_t storeHead();
+
+    /**
+     * @brief Delete all messages
+     */
+    status_t clear();
+
+    /**
+     * @brief Rewrite the log without the drained messages
+     *
+     * @param end Offset the log is truncated at, the log size to keep every
+     * message
+     */
+    status_t compact(uint32_t end);
+
+    uint32_t logSize();
+
+    const OutboxFiles *_files;
+
+    //! This outbox's state in RTC memory
+    OutboxStats *_stats;
+    OutboxAppendState *_appendState;
+
+    uint32_t _maxBytes;
+
+    bool _mounted;
+
+    //! Offset of the oldest undelivered message in the log
+    uint32_t _head;
+
+    //! Log open for draining, and the offset after the last peeked message
+    File _readFile;
+    bool _reading;
+    uint32_t _peekEnd;
+
+    //! Set when a corrupt record is found, endRead() truncates the log at
+    //! _corruptOffset
+    bool _corrupt;
+    uint32_t _corruptOffset;
+};
+
+extern Outbox gOutbox;
+
+#endif /* end of include guard: OUTBOX_H_7TNR4XKD */
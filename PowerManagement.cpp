@@ -0,0 +1,235 @@
+#include <WiFi.h>
+
+#include "PowerManagement.h"
+#include "Logger.h"
+#include "config.h"
+
+/*
+ * Rough ESP32 CPU current in each state, radio excluded, for the estimate
+ * in getAverageCpuCurrentMa()
+ */
+#define CPU_MAX_FREQ_CURRENT_MA 50.0f
+#define CPU_MIN_FREQ_CURRENT_MA 25.0f
+#define LIGHT_SLEEP_CURRENT_MA 0.8f
+
+static const char *lockNames[PowerManagement::LOCK_NUM_LOCKS] = {
+    "network",
+    "sampling",
+};
+
+PowerManagement gPowerManagement;
+
+PowerManagement::PowerManagement()
+    : _statsMux(portMUX_INITIALIZER_UNLOCKED),
+      _bothHeldSinceMs(0),
+      _bothHeldMs(0),
+      _idleWaitMs(0),
+      _lightSleepEnabled(false)
+{
+    for (int i = 0; i < LOCK_NUM_LOCKS; ++i) {
+        _locks[i] = nullptr;
+        _holdCount[i] = 0;
+        _heldSinceMs[i] = 0;
+        _heldMs[i] = 0;
+    }
+}
+
+status_t PowerManagement::init()
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pmConfig = {
+        .max_freq_mhz = PM_MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+
+    esp_err_t err = esp_pm_configure(&pmConfig);
+    if (err == ESP_OK) {
+        _lightSleepEnabled = true;
+    } else {
+        // Built without CONFIG_FREERTOS_USE_TICKLESS_IDLE, scale the
+        // frequency only
+        LOG_WARN("Automatic light sleep not available: " + String(esp_err_to_name(err)));
+
+        pmConfig.light_sleep_enable = false;
+        err = esp_pm_configure(&pmConfig);
+        if (err != ESP_OK) {
+            LOG_WARN("Frequency scaling not available: " + String(esp_err_to_name(err)));
+            return STATUS_FAIL;
+        }
+    }
+
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, lockNames[LOCK_NETWORK], &_locks[LOCK_NETWORK]);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, lockNames[LOCK_SAMPLING], &_locks[LOCK_SAMPLING]);
+
+    return STATUS_OK;
+#else
+    LOG_WARN("Power management not enabled, the CPU runs at full speed");
+
+    return STATUS_FAIL;
+#endif
+}
+
+void PowerManagement::acquire(Lock lock)
+{
+    if (_locks[lock] != nullptr) {
+        esp_pm_lock_acquire(_locks[lock]);
+    }
+
+    portENTER_CRITICAL(&_statsMux);
+    if (_holdCount[lock]++ == 0) {
+        _heldSinceMs[lock] = millis();
+
+        if (allHeld()) {
+            _bothHeldSinceMs = _heldSinceMs[lock];
+        }
+    }
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+void PowerManagement::release(Lock lock)
+{
+    portENTER_CRITICAL(&_statsMux);
+    if (_holdCount[lock] == 0) {
+        portEXIT_CRITICAL(&_statsMux);
+        LOG_ERROR("Released " + String(lockNames[lock]) + " lock that wasn't held");
+        return;
+    }
+
+    if (_holdCount[lock] == 1) {
+        uint32_t now = millis();
+
+        if (allHeld()) {
+            _bothHeldMs += now - _bothHeldSinceMs;
+        }
+        _heldMs[lock] += now - _heldSinceMs[lock];
+    }
+    _holdCount[lock]--;
+    portEXIT_CRITICAL(&_statsMux);
+
+    if (_locks[lock] != nullptr) {
+        esp_pm_lock_release(_locks[lock]);
+    }
+}
+
+void PowerManagement::wait(uint32_t ms)
+{
+    if (_lightSleepEnabled) {
+        // The UART is stopped in light sleep, don't cut off the logs
+        Serial.flush();
+    }
+
+    uint32_t start = millis();
+
+    vTaskDelay(pdMS_TO_TICKS(ms));
+
+    portENTER_CRITICAL(&_statsMux);
+    bool idle = true;
+    for (int i = 0; i < LOCK_NUM_LOCKS; ++i) {
+        if (_holdCount[i] != 0) {
+            idle = false;
+        }
+    }
+    if (idle) {
+        _idleWaitMs += millis() - start;
+    }
+    portEXIT_CRITICAL(&_statsMux);
+}
+
+void PowerManagement::enableLowPowerIdle()
+{
+    // Modem sleep, the radio wakes for each DTIM beacon so messages pushed
+    // by the broker are delivered within a beacon interval. With automatic
+    // light sleep the chip sleeps between beacons too.
+    WiFi.setSleep(true);
+
+    if (!_lightSleepEnabled) {
+        LOG_WARN("Automatic light sleep not available, using modem sleep only");
+    }
+}
+
+bool PowerManagement::allHeld()
+{
+    for (int i = 0; i < LOCK_NUM_LOCKS; ++i) {
+        if (_holdCount[i] == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PowerManagement::getResidency(Residency *residency)
+{
+    residency->awakeMs = millis();
+
+    portENTER_CRITICAL(&_statsMux);
+    for (int i = 0; i < LOCK_NUM_LOCKS; ++i) {
+        residency->heldMs[i] = _heldMs[i];
+        if (_holdCount[i] != 0) {
+            residency->heldMs[i] += residency->awakeMs - _heldSinceMs[i];
+        }
+    }
+    residency->bothHeldMs = _bothHeldMs;
+    if (allHeld()) {
+        residency->bothHeldMs += residency->awakeMs - _bothHeldSinceMs;
+    }
+    residency->idleWaitMs = _idleWaitMs;
+    portEXIT_CRITICAL(&_statsMux);
+
+    // The network task can hold its lock while the main task samples, count
+    // the overlap once
+    uint32_t accountedMs = residency->heldMs[LOCK_NETWORK]
+                           + residency->heldMs[LOCK_SAMPLING]
+                           - residency->bothHeldMs
+                           + residency->idleWaitMs;
+    residency->otherMs = accountedMs < residency->awakeMs
+                         ? residency->awakeMs - accountedMs : 0;
+}
+
+float PowerManagement::averageCurrentMa(const Residency &residency)
+{
+    if (residency.awakeMs == 0) {
+        return 0;
+    }
+
+    // Sampling while the network holds its lock runs at the max frequency
+    uint32_t samplingOnlyMs = residency.heldMs[LOCK_SAMPLING] - residency.bothHeldMs;
+
+    float sleepCurrentMa = _lightSleepEnabled ? LIGHT_SLEEP_CURRENT_MA : CPU_MIN_FREQ_CURRENT_MA;
+    float chargeMaMs = residency.heldMs[LOCK_NETWORK] * CPU_MAX_FREQ_CURRENT_MA
+                       + (samplingOnlyMs + residency.otherMs) * CPU_MIN_FREQ_CURRENT_MA
+                       + residency.idleWaitMs * sleepCurrentMa;
+
+    return chargeMaMs / residency.awakeMs;
+}
+
+float PowerManagement::getAverageCpuCurrentMa()
+{
+    Residency residency;
+
+    getResidency(&residency);
+
+    return averageCurrentMa(residency);
+}
+
+void PowerManagement::logStats()
+{
+    Residency residency;
+
+    getResidency(&residency);
+
+    if (residency.awakeMs == 0) {
+        return;
+    }
+
+    LOG_INFO("Awake " + String(residency.awakeMs) + " ms: "
+             + String(residency.heldMs[LOCK_NETWORK]) + " ms at "
+             + String(PM_MAX_CPU_FREQ_MHZ) + " MHz for the network, "
+             + String(residency.heldMs[LOCK_SAMPLING]) + " ms sampling ("
+             + String(residency.bothHeldMs) + " ms of it with the network), "
+             + String(residency.idleWaitMs) + " ms waiting"
+             + (_lightSleepEnabled ? " in light sleep, " : ", ")
+             + String(residency.otherMs) + " ms other. Estimated CPU current "
+             + String(averageCurrentMa(residency), 1) + " mA");
+}
@@ -0,0 +1,106 @@
+#ifndef POWERMANAGEMENT_H_W3FT8LCU
+#define POWERMANAGEMENT_H_W3FT8LCU
+
+#include <Arduino.h>
+#include "esp_pm.h"
+#include "Status.h"
+
+/*! \class PowerManagement
+ *  \brief Dynamic frequency scaling and automatic light sleep for the whole
+ *  wake
+ *
+ *  The CPU runs at PM_MIN_CPU_FREQ_MHZ unless a lock is held, and light
+ *  sleeps whenever every task is blocked. Locks are only held around the
+ *  phases that need them:
+ *
+ *  - LOCK_NETWORK: WiFi association, TLS handshakes and uploads run at
+ *    PM_MAX_CPU_FREQ_MHZ.
+ *  - LOCK_SAMPLING: sensor sampling doesn't light sleep, so sample timing
+ *    and the analog front end stay steady.
+ *
+ *  All waits go through wait(), which blocks the task so the chip can light
+ *  sleep rather than spinning. The time spent in each state is logged with
+ *  an estimate of the average CPU current before deep sleep.
+ */
+class PowerManagement
+{
+public:
+    enum Lock {
+        LOCK_NETWORK,
+        LOCK_SAMPLING,
+        LOCK_NUM_LOCKS,
+    };
+
+    PowerManagement();
+
+    /**
+     * @brief Enable frequency scaling and automatic light sleep, call first
+     * thing on wake
+     */
+    status_t init();
+
+    void acquire(Lock lock);
+    void release(Lock lock);
+
+    /**
+     * @brief Wait without keeping the CPU busy, the chip light sleeps if
+     * nothing else needs it
+     */
+    void wait(uint32_t ms);
+
+    /**
+     * @brief Idle with the WiFi in modem sleep while staying connected
+     */
+    void enableLowPowerIdle();
+
+    /**
+     * @brief Estimated average CPU current since wake, from the time spent in
+     * each state
+     */
+    float getAverageCpuCurrentMa();
+
+    void logStats();
+
+protected:
+    /**
+     * Time spent in each state since wake, locks can overlap
+     */
+    typedef struct {
+        uint32_t awakeMs;
+        uint32_t heldMs[LOCK_NUM_LOCKS];
+        //! Time with both locks held, also counted in each heldMs
+        uint32_t bothHeldMs;
+        uint32_t idleWaitMs;
+        uint32_t otherMs;
+    } Residency;
+
+    /**
+     * @brief Check if every lock is held, call with _statsMux taken
+     */
+    bool allHeld();
+
+    void getResidency(Residency *residency);
+
+    float averageCurrentMa(const Residency &residency);
+
+    esp_pm_lock_handle_t _locks[LOCK_NUM_LOCKS];
+
+    /*
+     * Statistics, locks and waits can come from the network task too
+     */
+    portMUX_TYPE _statsMux;
+    uint32_t _holdCount[LOCK_NUM_LOCKS];
+    uint32_t _heldSinceMs[LOCK_NUM_LOCKS];
+    uint32_t _heldMs[LOCK_NUM_LOCKS];
+    uint32_t _bothHeldSinceMs;
+    uint32_t _bothHeldMs;
+
+    //! Time waiting with no locks held, when the chip can light sleep
+    uint32_t _idleWaitMs;
+
+    bool _lightSleepEnabled;
+};
+
+extern PowerManagement gPowerManagement;
+
+#endif /* end of include guard: POWERMANAGEMENT_H_W3FT8LCU */
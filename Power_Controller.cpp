@@ -1,46 +1,137 @@
 #include "Arduino.h"
 #include "Power_Controller.h"
 #include "Logger.h"
+#include "PowerManagement.h"
 
 #define PIN_9V_12V_ENABLE 26
 #define PIN_3V3_ENABLE 23
 
-/// Time for power to turn on and stabilize. 20 ms is just a guess
-#define POWER_ON_DELAY_MS 20
+typedef struct {
+    const char *name;
+    uint8_t enablePin;
+
+    //! Time from switching on until the rail can be used
+    uint32_t settleMs;
+} PowerChannelConfig;
+
+static const PowerChannelConfig channelConfigs[PowerController::POWER_CHANNEL_NUM_CHANNELS] = {
+    // 20 ms is just a guess
+    { "3V3", PIN_3V3_ENABLE, 20 },
+    // Wait for the output capacitor on the 9/12V rail to charge up. There
+    // was issues turning on the pump without the capacitor, so the capacitor
+    // should be charged up to handle spikes in current draw on startup
+    { "9V/12V", PIN_9V_12V_ENABLE, 100 },
+};
 
 PowerController gPowerController;
 
 PowerController::PowerController()
 {
     initialized = false;
+
+    for (int channel = 0; channel < POWER_CHANNEL_NUM_CHANNELS; ++channel) {
+        for (int consumer = 0; consumer < POWER_CONSUMER_NUM_CONSUMERS; ++consumer) {
+            _refCounts[channel][consumer] = 0;
+        }
+        _onSinceMs[channel] = 0;
+        _isOn[channel] = false;
+    }
+}
+
+bool PowerController::isValid(PowerChannel channel, PowerConsumer consumer)
+{
+    if (channel >= POWER_CHANNEL_NUM_CHANNELS) {
+        LOG_WARN("Power Controller: invalid channel " + String(channel));
+        return false;
+    }
+
+    if (consumer >= POWER_CONSUMER_NUM_CONSUMERS) {
+        LOG_WARN("Power Controller: invalid consumer " + String(consumer));
+        return false;
+    }
+
+    return true;
+}
+
+status_t PowerController::acquire(PowerChannel channel, PowerConsumer consumer)
+{
+    if (!isValid(channel, consumer)) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    const PowerChannelConfig &config = channelConfigs[channel];
+
+    if (!_isOn[channel]) {
+        digitalWrite(config.enablePin, HIGH);
+        _onSinceMs[channel] = millis();
+        _isOn[channel] = true;
+
+        LOG_DEBUG(String(config.name) + " rail on");
+    }
+
+    _refCounts[channel][consumer]++;
+
+    // Also covers a consumer acquiring a rail another one just switched on
+    uint32_t onMs = millis() - _onSinceMs[channel];
+    if (onMs < config.settleMs) {
+        gPowerManagement.wait(config.settleMs - onMs);
+    }
+
+    return STATUS_OK;
 }
 
-status_t PowerController::setPowerChannel(PowerChannel channel,
-                                                           bool enable)
+status_t PowerController::release(PowerChannel channel, PowerConsumer consumer)
 {
-    switch (channel) {
-        case POWER_CHANNEL_3V3:
-            digitalWrite(PIN_3V3_ENABLE, enable);
-            break;
-        case POWER_CHANNEL_9V_12V:
-            digitalWrite(PIN_9V_12V_ENABLE, enable);
-            break;
-        default:
-            LOG_WARN("Set Power Channel: invalid channel " + String(channel));
-            return STATUS_INVALID_PARAMS;
-            break;
-    }
-
-    delay(POWER_ON_DELAY_MS);
+    if (!isValid(channel, consumer)) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (_refCounts[channel][consumer] == 0) {
+        LOG_WARN(String(channelConfigs[channel].name) + " rail released by consumer "
+                 + String(consumer) + " without a reference");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    _refCounts[channel][consumer]--;
+
+    for (int i = 0; i < POWER_CONSUMER_NUM_CONSUMERS; ++i) {
+        if (_refCounts[channel][i] != 0) {
+            return STATUS_OK;
+        }
+    }
+
+    digitalWrite(channelConfigs[channel].enablePin, LOW);
+    _isOn[channel] = false;
+
+    LOG_DEBUG(String(channelConfigs[channel].name) + " rail off after "
+              + String(millis() - _onSinceMs[channel]) + " ms");
+
     return STATUS_OK;
 }
 
+bool PowerController::isOn(PowerChannel channel)
+{
+    if (channel >= POWER_CHANNEL_NUM_CHANNELS) {
+        return false;
+    }
+
+    return _isOn[channel];
+}
+
 status_t PowerController::init()
 {
-    if (!initialized) {
-        pinMode(PIN_9V_12V_ENABLE, OUTPUT);
-        pinMode(PIN_3V3_ENABLE, OUTPUT);
+    if (initialized) {
+        return STATUS_OK;
     }
 
+    for (int channel = 0; channel < POWER_CHANNEL_NUM_CHANNELS; ++channel) {
+        uint8_t pin = channelConfigs[channel].enablePin;
+
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, LOW);
+    }
+
+    initialized = true;
+
     return STATUS_OK;
 }
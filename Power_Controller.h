@@ -1,8 +1,18 @@
 #ifndef POWER_CONTROLLER_H_HV0ZKTDT
 #define POWER_CONTROLLER_H_HV0ZKTDT
 
+#include "Arduino.h"
 #include "Status.h"
 
+/*! \class PowerController
+ *  \brief Switches the power rails, each rail is on while any consumer holds
+ *  a reference to it
+ *
+ *  Consumers acquire a rail for as long as they use it and release it when
+ *  done. The rail is switched off when the last reference is released, and
+ *  acquiring waits out the rail's settle time only after it was actually
+ *  switched on.
+ */
 class PowerController {
     public:
 
@@ -12,15 +22,46 @@ class PowerController {
         POWER_CHANNEL_NUM_CHANNELS
     };
 
+    enum PowerConsumer {
+        //! Sensor init and sampling, and CLI water level measurements
+        POWER_CONSUMER_SENSORS,
+        POWER_CONSUMER_WATER_PUMP,
+        POWER_CONSUMER_NUM_CONSUMERS
+    };
+
     PowerController();
 
+    /**
+     * @brief Switch every rail off, only does anything on the first call
+     */
     status_t init();
 
-    status_t setPowerChannel(PowerChannel channel, bool enable);
+    /**
+     * @brief Take a reference to a channel, switching it on and waiting for
+     * it to settle if needed
+     */
+    status_t acquire(PowerChannel channel, PowerConsumer consumer);
+
+    /**
+     * @brief Drop a reference to a channel, switching it off if it was the
+     * last one
+     */
+    status_t release(PowerChannel channel, PowerConsumer consumer);
+
+    bool isOn(PowerChannel channel);
 
     protected:
 
+    bool isValid(PowerChannel channel, PowerConsumer consumer);
+
     bool initialized;
+
+    uint8_t _refCounts[POWER_CHANNEL_NUM_CHANNELS][POWER_CONSUMER_NUM_CONSUMERS];
+
+    //! When each channel was last switched on, for its settle time
+    uint32_t _onSinceMs[POWER_CHANNEL_NUM_CHANNELS];
+
+    bool _isOn[POWER_CHANNEL_NUM_CHANNELS];
 };
 
 // Global power controller instance
@@ -0,0 +1,420 @@
+#include <sys/time.h>
+#include <time.h>
+
+#include "PublishScheduler.h"
+#include "Outbox.h"
+#include "Logger.h"
+#include "PowerManagement.h"
+#include "TimerServer.h"
+#include "config.h"
+
+/**
+ * Token bucket state
+ */
+typedef struct {
+    //! Time each token was last spent, 0 if never
+    uint64_t spentMs[PUBLISH_SCHEDULER_MAX_TOKENS];
+
+    /*
+     * Statistics
+     */
+    uint32_t numSent[PublishScheduler::NUM_PRIORITIES];
+    uint32_t numDeferred[PublishScheduler::NUM_PRIORITIES];
+    uint32_t numDropped[PublishScheduler::NUM_PRIORITIES];
+    uint32_t numFailed[PublishScheduler::NUM_PRIORITIES];
+    uint32_t numStored[PublishScheduler::NUM_PRIORITIES];
+} TokenBucket;
+
+RTC_DATA_ATTR static TokenBucket sBucket;
+
+PublishScheduler gPublishScheduler(AIO_PUBLISHES_PER_WINDOW, AIO_RATE_LIMIT_WINDOW_MS);
+
+PublishScheduler::PublishScheduler(uint32_t publishesPerWindow, uint32_t windowMs) :
+    _mqtt(nullptr),
+    _capacity(publishesPerWindow),
+    _windowMs(windowMs),
+    _numDeferred(0),
+    _inPublish(false),
+    _storeTelemetry(false)
+{
+    if (_capacity > PUBLISH_SCHEDULER_MAX_TOKENS) {
+        _capacity = PUBLISH_SCHEDULER_MAX_TOKENS;
+    }
+}
+
+void PublishScheduler::init(Adafruit_MQTT *mqtt)
+{
+    _mqtt = mqtt;
+}
+
+uint64_t PublishScheduler::nowMs()
+{
+    // System time keeps running through deep sleep, unlike millis()
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+uint32_t PublishScheduler::availableTokens()
+{
+    uint64_t now = nowMs();
+    uint32_t available = 0;
+
+    for (uint32_t i = 0; i < _capacity; ++i) {
+        uint64_t spent = sBucket.spentMs[i];
+
+        // A token spent in the future means the clock was set back, don't
+        // let it block the bucket
+        if (spent == 0 || spent > now || now - spent >= _windowMs) {
+            available++;
+        }
+    }
+
+    return available;
+}
+
+uint32_t PublishScheduler::msUntilNextToken()
+{
+    uint64_t now = nowMs();
+    uint32_t minWaitMs = _windowMs;
+
+    for (uint32_t i = 0; i < _capacity; ++i) {
+        uint64_t spent = sBucket.spentMs[i];
+
+        if (spent == 0 || spent > now || now - spent >= _windowMs) {
+            return 0;
+        }
+
+        uint32_t waitMs = _windowMs - (now - spent);
+        if (waitMs < minWaitMs) {
+            minWaitMs = waitMs;
+        }
+    }
+
+    return minWaitMs;
+}
+
+bool PublishScheduler::consumeToken()
+{
+    uint64_t now = nowMs();
+
+    for (uint32_t i = 0; i < _capacity; ++i) {
+        uint64_t spent = sBucket.spentMs[i];
+
+        if (spent == 0 || spent > now || now - spent >= _windowMs) {
+            sBucket.spentMs[i] = now;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t PublishScheduler::takeTokens(uint32_t maxTokens, Priority priority)
+{
+    uint32_t taken = 0;
+
+    if (priority >= NUM_PRIORITIES) {
+        return 0;
+    }
+
+    while (taken < maxTokens
+           && availableTokens() > reservedTokens(priority)
+           && consumeToken())
+    {
+        taken++;
+    }
+
+    sBucket.numSent[priority] += taken;
+
+    return taken;
+}
+
+void PublishScheduler::returnTokens(uint32_t numTokens, Priority priority)
+{
+    if (priority >= NUM_PRIORITIES) {
+        return;
+    }
+
+    // The tokens just taken are the most recently spent ones
+    for (uint32_t n = 0; n < numTokens; ++n) {
+        uint32_t latest = _capacity;
+
+        for (uint32_t i = 0; i < _capacity; ++i) {
+            if (sBucket.spentMs[i] != 0
+                && (latest == _capacity || sBucket.spentMs[i] > sBucket.spentMs[latest]))
+            {
+                latest = i;
+            }
+        }
+
+        if (latest == _capacity) {
+            break;
+        }
+
+        sBucket.spentMs[latest] = 0;
+
+        if (sBucket.numSent[priority] > 0) {
+            sBucket.numSent[priority]--;
+        }
+    }
+}
+
+uint32_t PublishScheduler::reservedTokens(Priority priority)
+{
+    switch (priority) {
+        case PRIORITY_ALARM:
+        case PRIORITY_CONTROL:
+            return 0;
+        case PRIORITY_TELEMETRY:
+            return TOKENS_RESERVED_FOR_ALARMS;
+        case PRIORITY_LOG:
+        default:
+            return TOKENS_RESERVED_FOR_TELEMETRY;
+    }
+}
+
+bool PublishScheduler::isDurable(Priority priority)
+{
+    return priority == PRIORITY_ALARM || priority == PRIORITY_TELEMETRY;
+}
+
+bool PublishScheduler::connected()
+{
+    return _mqtt != nullptr && _mqtt->connected();
+}
+
+status_t PublishScheduler::store(const char *topic, const char *payload,
+                                 Priority priority)
+{
+    if (!isDurable(priority)) {
+        sBucket.numDropped[priority]++;
+        return STATUS_FAIL;
+    }
+
+    // Only keep the time if it has been set, it is kept through deep sleep
+    uint32_t timestamp = TimerServer::clockIsSet() ? time(nullptr) : 0;
+
+    if (gOutbox.append(topic, payload, timestamp) != STATUS_OK) {
+        sBucket.numDropped[priority]++;
+        return STATUS_FAIL;
+    }
+
+    sBucket.numStored[priority]++;
+
+    return STATUS_OK;
+}
+
+status_t PublishScheduler::transmit(const char *topic, const char *payload,
+                                    uint8_t qos, Priority priority)
+{
+    if (!consumeToken()) {
+        return STATUS_TIMEOUT;
+    }
+
+    _inPublish = true;
+    bool published = _mqtt->publish(topic, payload, qos);
+    _inPublish = false;
+
+    if (!published) {
+        sBucket.numFailed[priority]++;
+        return STATUS_FAIL;
+    }
+
+    sBucket.numSent[priority]++;
+
+    return STATUS_OK;
+}
+
+status_t PublishScheduler::send(const char *topic, const char *payload,
+                                uint8_t qos, Priority priority)
+{
+    if (!connected()) {
+        return store(topic, payload, priority);
+    }
+
+    status_t rc = transmit(topic, payload, qos, priority);
+    if (rc != STATUS_OK && store(topic, payload, priority) == STATUS_OK) {
+        return STATUS_OK;
+    }
+
+    return rc;
+}
+
+status_t PublishScheduler::defer(const char *topic, const char *payload,
+                                 uint8_t qos, Priority priority)
+{
+    if (_numDeferred >= PUBLISH_SCHEDULER_MAX_DEFERRED
+        || strlen(payload) >= PUBLISH_SCHEDULER_MAX_DEFERRED_PAYLOAD_LEN)
+    {
+        return store(topic, payload, priority);
+    }
+
+    DeferredPublish *deferred = &_deferred[_numDeferred++];
+    deferred->topic = topic;
+    deferred->qos = qos;
+    strcpy(deferred->payload, payload);
+
+    sBucket.numDeferred[priority]++;
+
+    return STATUS_OK;
+}
+
+status_t PublishScheduler::publish(const char *topic, double value,
+                                   Priority priority)
+{
+    return publish(topic, String(value).c_str(), priority);
+}
+
+status_t PublishScheduler::publish(const char *topic, const char *payload,
+                                   Priority priority, uint8_t qos)
+{
+    if (topic == nullptr || payload == nullptr || priority >= NUM_PRIORITIES) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    // Anything logged over MQTT while publishing would recurse back in here
+    if (_inPublish) {
+        sBucket.numDropped[priority]++;
+        return STATUS_OK;
+    }
+
+    // No point waiting for a token we can't use
+    if (!connected()
+        || (_storeTelemetry && priority == PRIORITY_TELEMETRY))
+    {
+        return store(topic, payload, priority);
+    }
+
+    if (priority == PRIORITY_ALARM || priority == PRIORITY_CONTROL) {
+        uint32_t waitMs = msUntilNextToken();
+        // Alarms go out on the next wake, control is dropped and counted
+        if (waitMs > ALARM_MAX_WAIT_MS) {
+            if (store(topic, payload, priority) == STATUS_OK) {
+                return STATUS_OK;
+            }
+
+            LOG_WARN("Rate limited for " + String(waitMs) + " ms, dropping publish to "
+                     + String(topic));
+            return STATUS_TIMEOUT;
+        }
+
+        if (waitMs > 0) {
+            LOG_INFO("Rate limited, waiting " + String(waitMs) + " ms to publish");
+            gPowerManagement.wait(waitMs);
+        }
+
+        return send(topic, payload, qos, priority);
+    }
+
+    if (availableTokens() <= reservedTokens(priority)) {
+        if (priority == PRIORITY_TELEMETRY) {
+            return defer(topic, payload, qos, priority);
+        }
+
+        sBucket.numDropped[priority]++;
+        return STATUS_OK;
+    }
+
+    return send(topic, payload, qos, priority);
+}
+
+void PublishScheduler::setStoreTelemetry(bool storeTelemetry)
+{
+    _storeTelemetry = storeTelemetry;
+}
+
+status_t PublishScheduler::flush()
+{
+    status_t rc = STATUS_OK;
+    uint32_t i;
+
+    for (i = 0; i < _numDeferred; ++i) {
+        if (connected()
+            && availableTokens() <= reservedTokens(PRIORITY_TELEMETRY))
+        {
+            break;
+        }
+
+        if (send(_deferred[i].topic, _deferred[i].payload, _deferred[i].qos,
+                 PRIORITY_TELEMETRY) != STATUS_OK)
+        {
+            rc = STATUS_FAIL;
+        }
+    }
+
+    // Keep whatever the rate limit didn't let through for the next wake
+    for (; i < _numDeferred; ++i) {
+        if (store(_deferred[i].topic, _deferred[i].payload,
+                  PRIORITY_TELEMETRY) != STATUS_OK)
+        {
+            rc = STATUS_FAIL;
+        }
+    }
+
+    _numDeferred = 0;
+
+    return rc;
+}
+
+status_t PublishScheduler::drainOutbox()
+{
+    status_t rc;
+    OutboxRecord record;
+    uint32_t numDrained = 0;
+
+    if (!connected() || gOutbox.isEmpty()) {
+        return STATUS_OK;
+    }
+
+    rc = gOutbox.beginRead();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    while (connected()
+           && availableTokens() > reservedTokens(PRIORITY_TELEMETRY))
+    {
+        rc = gOutbox.peek(&record);
+        if (rc != STATUS_OK) {
+            break;
+        }
+
+        // Don't store it again on failure, it is still in the outbox
+        rc = transmit(record.topic, record.payload, 0, PRIORITY_TELEMETRY);
+        if (rc != STATUS_OK) {
+            break;
+        }
+
+        gOutbox.pop();
+        numDrained++;
+    }
+
+    gOutbox.endRead();
+
+    LOG_INFO("Drained " + String(numDrained) + " messages from outbox, "
+             + String(gOutbox.pendingBytes()) + " bytes left");
+
+    // Running out of messages or tokens isn't an error
+    return (rc == STATUS_FAIL) ? STATUS_FAIL : STATUS_OK;
+}
+
+void PublishScheduler::logStats()
+{
+    static const char *priorityNames[NUM_PRIORITIES] = {
+        "alarm", "control", "telemetry", "log"
+    };
+
+    for (uint32_t i = 0; i < NUM_PRIORITIES; ++i) {
+        LOG_DEBUG("Publish " + String(priorityNames[i])
+                  + ": sent " + String(sBucket.numSent[i])
+                  + " deferred " + String(sBucket.numDeferred[i])
+                  + " dropped " + String(sBucket.numDropped[i])
+                  + " failed " + String(sBucket.numFailed[i])
+                  + " stored " + String(sBucket.numStored[i]));
+    }
+
+    LOG_DEBUG("Publish tokens available " + String(availableTokens())
+              + "/" + String(_capacity));
+}
@@ -0,0 +1,196 @@
+#ifndef PUBLISHSCHEDULER_H_ME6TQ1RV
+#define PUBLISHSCHEDULER_H_ME6TQ1RV
+
+#include "Adafruit_MQTT.h"
+#include "Status.h"
+
+//! Max number of tokens (publishes per window) the bucket can hold
+#define PUBLISH_SCHEDULER_MAX_TOKENS 60
+
+//! Max number of deferred publishes held until the next flush
+#define PUBLISH_SCHEDULER_MAX_DEFERRED 16
+
+//! Max length of a deferred payload, including the null terminator
+#define PUBLISH_SCHEDULER_MAX_DEFERRED_PAYLOAD_LEN 24
+
+/*! \class PublishScheduler
+ *  \brief Central MQTT publish scheduler enforcing the broker data rate limit
+ *
+ *  Publishes are paced by a token bucket sized to the broker quota. A spent
+ *  token is returned to the bucket one rate limit window after it was used,
+ *  so no window ever sees more publishes than the quota, while bursts up to
+ *  the full quota are still allowed. The bucket is kept in RTC memory so the
+ *  quota is tracked across deep sleep.
+ *
+ *  Each publish has a priority class. Alarms and watering can use every
+ *  token, and wait up to ALARM_MAX_WAIT_MS for one. Past that alarms are
+ *  stored in the outbox and control traffic is dropped. Telemetry leaves
+ *  tokens in reserve for alarms and is deferred until flush() when short of
+ *  tokens. Logs leave tokens in reserve for telemetry, and are dropped when
+ *  short of tokens.
+ *
+ *  Alarms and telemetry that can't be sent, because we are offline, the
+ *  publish failed or the deferred telemetry wasn't sent by flush(), are
+ *  stored in the outbox. drainOutbox() sends them on the next good
+ *  connection, with the tokens telemetry is allowed to use.
+ */
+class PublishScheduler
+{
+public:
+    enum Priority {
+        //! Alarms and watering
+        PRIORITY_ALARM,
+        //! Control traffic, same as alarms but never stored in the outbox
+        PRIORITY_CONTROL,
+        //! Sensor readings
+        PRIORITY_TELEMETRY,
+        //! Log messages
+        PRIORITY_LOG,
+        NUM_PRIORITIES,
+    };
+
+    PublishScheduler(uint32_t publishesPerWindow, uint32_t windowMs);
+
+    /**
+     * @brief Set the client used to publish, messages are stored in the
+     * outbox until this is set
+     */
+    void init(Adafruit_MQTT *mqtt);
+
+    /**
+     * @brief Publish, defer or drop a message depending on its priority and
+     * the tokens available
+     *
+     * @param topic The topic to publish to, must stay valid until flush() in
+     * case the message is deferred
+     * @param payload The message payload
+     * @param priority The priority class of the message
+     *
+     * @return STATUS_OK if the message was published, deferred, stored in
+     * the outbox or dropped by policy, STATUS_FAIL if publishing failed
+     */
+    status_t publish(const char *topic, const char *payload, Priority priority,
+                     uint8_t qos = 0);
+
+    status_t publish(const char *topic, double value, Priority priority);
+
+    /**
+     * @brief Store telemetry in the outbox rather than sending it, e.g. on a
+     * poor link. Alarms and control traffic are still sent.
+     */
+    void setStoreTelemetry(bool storeTelemetry);
+
+    /**
+     * @brief Publish deferred messages while tokens are available, storing
+     * any that are left in the outbox
+     */
+    status_t flush();
+
+    /**
+     * @brief Send messages stored in the outbox, oldest first, while
+     * connected and telemetry tokens are available
+     *
+     * @return STATUS_OK if the outbox was drained or we ran out of tokens,
+     * STATUS_FAIL if a publish failed
+     */
+    status_t drainOutbox();
+
+    /**
+     * @brief Get the number of publishes currently allowed
+     */
+    uint32_t availableTokens();
+
+    /**
+     * @brief Spend tokens for data sent outside of MQTT, which counts
+     * against the same quota
+     *
+     * @param maxTokens Max number of tokens wanted
+     * @param priority Priority class the tokens are spent for, tokens
+     * reserved for higher priorities are not given out
+     *
+     * @return Number of tokens spent, may be 0
+     */
+    uint32_t takeTokens(uint32_t maxTokens, Priority priority);
+
+    /**
+     * @brief Give back tokens taken with takeTokens() that weren't used,
+     * e.g. because the upload failed or was rate limited
+     *
+     * @param numTokens Number of tokens to give back
+     * @param priority Priority class the tokens were taken for
+     */
+    void returnTokens(uint32_t numTokens, Priority priority);
+
+    void logStats();
+
+protected:
+    enum {
+        //! Tokens telemetry leaves for alarms
+        TOKENS_RESERVED_FOR_ALARMS = 3,
+        //! Tokens logs leave for alarms and telemetry
+        TOKENS_RESERVED_FOR_TELEMETRY = 10,
+
+        //! Max time an alarm waits for a token, every ms waited is a ms
+        //! awake with the radio on
+        ALARM_MAX_WAIT_MS = 3*1000,
+    };
+
+    typedef struct {
+        const char *topic;
+        uint8_t qos;
+        char payload[PUBLISH_SCHEDULER_MAX_DEFERRED_PAYLOAD_LEN];
+    } DeferredPublish;
+
+    uint64_t nowMs();
+
+    uint32_t reservedTokens(Priority priority);
+
+    /**
+     * @brief Get the time until the next token is returned to the bucket
+     */
+    uint32_t msUntilNextToken();
+
+    bool consumeToken();
+
+    bool connected();
+
+    /**
+     * @brief Check if messages of a priority are stored in the outbox when
+     * they can't be sent
+     */
+    bool isDurable(Priority priority);
+
+    /**
+     * @brief Spend a token and publish the message
+     */
+    status_t transmit(const char *topic, const char *payload, uint8_t qos,
+                      Priority priority);
+
+    /**
+     * @brief Publish the message, storing it in the outbox if it can't be sent
+     */
+    status_t send(const char *topic, const char *payload, uint8_t qos,
+                  Priority priority);
+
+    status_t defer(const char *topic, const char *payload, uint8_t qos,
+                   Priority priority);
+
+    status_t store(const char *topic, const char *payload, Priority priority);
+
+    Adafruit_MQTT *_mqtt;
+
+    uint32_t _capacity;
+    uint32_t _windowMs;
+
+    DeferredPublish _deferred[PUBLISH_SCHEDULER_MAX_DEFERRED];
+    uint32_t _numDeferred;
+
+    //! Set while publishing, logs generated by the publish itself are dropped
+    bool _inPublish;
+
+    bool _storeTelemetry;
+};
+
+extern PublishScheduler gPublishScheduler;
+
+#endif /* end of include guard: PUBLISHSCHEDULER_H_ME6TQ1RV */
@@ -0,0 +1,48 @@
+#include "RadioActivity.h"
+
+RadioActivity gRadioActivity;
+
+RadioActivity::RadioActivity() :
+    _events(nullptr)
+{}
+
+EventGroupHandle_t RadioActivity::getEvents()
+{
+    // Created on first use, the scheduler isn't running during static
+    // construction
+    if (_events == nullptr) {
+        _events = xEventGroupCreate();
+        if (_events != nullptr) {
+            xEventGroupSetBits(_events, EVENT_BIT_QUIET);
+        }
+    }
+
+    return _events;
+}
+
+void RadioActivity::setBusy(bool busy)
+{
+    EventGroupHandle_t events = getEvents();
+    if (events == nullptr) {
+        return;
+    }
+
+    if (busy) {
+        xEventGroupClearBits(events, EVENT_BIT_QUIET);
+    } else {
+        xEventGroupSetBits(events, EVENT_BIT_QUIET);
+    }
+}
+
+bool RadioActivity::waitForQuiet(uint32_t timeoutMs)
+{
+    EventGroupHandle_t events = getEvents();
+    if (events == nullptr) {
+        return true;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(events, EVENT_BIT_QUIET, pdFALSE,
+                                           pdFALSE, pdMS_TO_TICKS(timeoutMs));
+
+    return (bits & EVENT_BIT_QUIET) != 0;
+}
@@ -0,0 +1,47 @@
+#ifndef RADIOACTIVITY_H_QH3ZB8WN
+#define RADIOACTIVITY_H_QH3ZB8WN
+
+#include "Arduino.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+/*! \class RadioActivity
+ *  \brief Tracks when the radio is busy transmitting
+ *
+ *  The network bring up marks the radio busy while associating and running
+ *  the TLS handshake, so analog sampling running at the same time can wait
+ *  for a window where the radio isn't transmitting and adding noise to the
+ *  ADC readings.
+ */
+class RadioActivity
+{
+public:
+    RadioActivity();
+
+    /**
+     * @brief Mark the radio as busy or quiet
+     */
+    void setBusy(bool busy);
+
+    /**
+     * @brief Wait for the radio to be quiet
+     *
+     * @param timeoutMs Max time to wait
+     *
+     * @return True if the radio is quiet, false if we timed out
+     */
+    bool waitForQuiet(uint32_t timeoutMs);
+
+protected:
+    enum {
+        EVENT_BIT_QUIET = (1 << 0),
+    };
+
+    EventGroupHandle_t getEvents();
+
+    EventGroupHandle_t _events;
+};
+
+extern RadioActivity gRadioActivity;
+
+#endif /* end of include guard: RADIOACTIVITY_H_QH3ZB8WN */
@@ -0,0 +1,546 @@
+#include "ResumableTLSClient.h"
+#include "Logger.h"
+#include "WifiConnection.h"
+#include "mbedtls/net_sockets.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+/**
+ * Session cache
+ */
+typedef struct {
+    //! Hash of the host and port the session belongs to
+    uint32_t hostHash;
+    //! Length of the serialized session, 0 if there is no cached session
+    uint32_t sessionLen;
+    uint8_t session[TLS_SESSION_CACHE_MAX_LEN];
+
+    /*
+     * Statistics
+     */
+    uint32_t numHandshakes;
+    uint32_t numResumeAttempts;
+    uint32_t numResumed;
+    uint32_t totalHandshakeMs;
+} TLSSessionCache;
+
+RTC_DATA_ATTR static TLSSessionCache sSessionCache;
+
+ResumableTLSClient::~ResumableTLSClient()
+{
+    stop();
+}
+
+uint32_t ResumableTLSClient::hashHost(const char *host, uint16_t port)
+{
+    // djb2
+    uint32_t hash = 5381;
+
+    for (const char *c = host; *c != '\0'; ++c) {
+        hash = ((hash << 5) + hash) + *c;
+    }
+
+    return ((hash << 5) + hash) + port;
+}
+
+void ResumableTLSClient::setCACert(const char *caCert)
+{
+    _caCert = caCert;
+    _insecure = false;
+}
+
+void ResumableTLSClient::setInsecure()
+{
+    _caCert = nullptr;
+    _insecure = true;
+}
+
+void ResumableTLSClient::clearSession()
+{
+    sSessionCache.sessionLen = 0;
+}
+
+uint32_t ResumableTLSClient::getLastHandshakeMs()
+{
+    return _lastHandshakeMs;
+}
+
+bool ResumableTLSClient::lastHandshakeResumed()
+{
+    return _lastHandshakeResumed;
+}
+
+status_t ResumableTLSClient::openSocket(IPAddress address, uint16_t port)
+{
+    _socket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (_socket < 0) {
+        LOG_ERROR("TLS: failed to create socket");
+        return STATUS_FAIL;
+    }
+
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = (uint32_t)address;
+    serverAddress.sin_port = htons(port);
+
+    // Connect non blocking so we can time out, the socket stays non blocking
+    // and reads and writes retry on WANT_READ/WANT_WRITE
+    fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+
+    int res = lwip_connect(_socket, (struct sockaddr *)&serverAddress,
+                           sizeof(serverAddress));
+    if (res < 0 && errno != EINPROGRESS) {
+        LOG_ERROR("TLS: connect failed, errno " + String(errno));
+        return STATUS_FAIL;
+    }
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(_socket, &fdset);
+
+    struct timeval tv;
+    tv.tv_sec = CONNECT_TIMEOUT_MS / 1000;
+    tv.tv_usec = 0;
+
+    res = select(_socket + 1, nullptr, &fdset, nullptr, &tv);
+    if (res <= 0) {
+        LOG_ERROR("TLS: connect timed out");
+        return STATUS_TIMEOUT;
+    }
+
+    int sockErr = 0;
+    socklen_t sockErrLen = sizeof(sockErr);
+    getsockopt(_socket, SOL_SOCKET, SO_ERROR, &sockErr, &sockErrLen);
+    if (sockErr != 0) {
+        LOG_ERROR("TLS: connect failed, socket error " + String(sockErr));
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+int ResumableTLSClient::onVerifyCert(void *ctx, mbedtls_x509_crt *crt,
+                                     int depth, uint32_t *flags)
+{
+    ResumableTLSClient *client = (ResumableTLSClient *)ctx;
+
+    client->_certReceived = true;
+
+    if (client->_insecure) {
+        *flags = 0;
+    }
+
+    return 0;
+}
+
+status_t ResumableTLSClient::setupTLS(const char *host, uint32_t hostHash,
+                                      bool offerSession)
+{
+    const char *pers = "greenhouse";
+    int ret;
+
+    mbedtls_ssl_init(&_ssl);
+    mbedtls_ssl_config_init(&_conf);
+    mbedtls_ctr_drbg_init(&_drbg);
+    mbedtls_entropy_init(&_entropy);
+    mbedtls_x509_crt_init(&_caChain);
+    _tlsInitialised = true;
+
+    ret = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy,
+                                (const unsigned char *)pers, strlen(pers));
+    if (ret != 0) {
+        LOG_ERROR("TLS: failed to seed rng " + String(ret));
+        return STATUS_FAIL;
+    }
+
+    ret = mbedtls_ssl_config_defaults(&_conf,
+                                      MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        LOG_ERROR("TLS: failed to set config defaults " + String(ret));
+        return STATUS_FAIL;
+    }
+
+    if (_caCert != nullptr) {
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+
+        ret = mbedtls_x509_crt_parse(&_caChain, (const unsigned char *)_caCert,
+                                     strlen(_caCert) + 1);
+        if (ret != 0) {
+            LOG_ERROR("TLS: failed to parse CA cert " + String(ret));
+            return STATUS_FAIL;
+        }
+
+        mbedtls_ssl_conf_ca_chain(&_conf, &_caChain, nullptr);
+    } else if (_insecure) {
+        // Optional rather than none so the verify callback still sees the
+        // certificate, the callback clears the verify flags
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+    } else {
+        LOG_ERROR("TLS: no CA cert set");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    mbedtls_ssl_conf_verify(&_conf, onVerifyCert, this);
+    mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+    mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+    ret = mbedtls_ssl_setup(&_ssl, &_conf);
+    if (ret != 0) {
+        LOG_ERROR("TLS: failed to set up context " + String(ret));
+        return STATUS_FAIL;
+    }
+
+    ret = mbedtls_ssl_set_hostname(&_ssl, host);
+    if (ret != 0) {
+        LOG_ERROR("TLS: failed to set hostname " + String(ret));
+        return STATUS_FAIL;
+    }
+
+    mbedtls_ssl_set_bio(&_ssl, &_socket, mbedtls_net_send, mbedtls_net_recv,
+                        nullptr);
+
+    _sessionOffered = false;
+    _certReceived = false;
+
+    if (offerSession && sSessionCache.sessionLen > 0
+        && sSessionCache.hostHash == hostHash)
+    {
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+
+        ret = mbedtls_ssl_session_load(&session, sSessionCache.session,
+                                       sSessionCache.sessionLen);
+        if (ret == 0) {
+            ret = mbedtls_ssl_set_session(&_ssl, &session);
+        }
+
+        if (ret == 0) {
+            _sessionOffered = true;
+            sSessionCache.numResumeAttempts++;
+        } else {
+            LOG_WARN("TLS: failed to load cached session " + String(ret));
+            clearSession();
+        }
+
+        mbedtls_ssl_session_free(&session);
+    }
+
+    return STATUS_OK;
+}
+
+void ResumableTLSClient::freeTLS()
+{
+    if (_tlsInitialised) {
+        mbedtls_ssl_free(&_ssl);
+        mbedtls_ssl_config_free(&_conf);
+        mbedtls_ctr_drbg_free(&_drbg);
+        mbedtls_entropy_free(&_entropy);
+        mbedtls_x509_crt_free(&_caChain);
+        _tlsInitialised = false;
+    }
+
+    if (_socket >= 0) {
+        lwip_close(_socket);
+        _socket = -1;
+    }
+}
+
+int ResumableTLSClient::handshake()
+{
+    uint32_t startMs = millis();
+    int ret;
+
+    while ((ret = mbedtls_ssl_handshake(&_ssl)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return ret;
+        }
+
+        if (millis() - startMs > HANDSHAKE_TIMEOUT_MS) {
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+
+        vTaskDelay(2);
+    }
+
+    _lastHandshakeMs = millis() - startMs;
+
+    if (_caCert != nullptr && mbedtls_ssl_get_verify_result(&_ssl) != 0) {
+        return MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
+    }
+
+    return 0;
+}
+
+void ResumableTLSClient::saveSession(uint32_t hostHash)
+{
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    int ret = mbedtls_ssl_get_session(&_ssl, &session);
+    if (ret == 0) {
+        size_t len = 0;
+        ret = mbedtls_ssl_session_save(&session, sSessionCache.session,
+                                       sizeof(sSessionCache.session), &len);
+        if (ret == 0) {
+            sSessionCache.sessionLen = len;
+            sSessionCache.hostHash = hostHash;
+        }
+    }
+
+    if (ret != 0) {
+        LOG_WARN("TLS: failed to cache session " + String(ret));
+        clearSession();
+    }
+
+    mbedtls_ssl_session_free(&session);
+}
+
+void ResumableTLSClient::logStats()
+{
+    sSessionCache.numHandshakes++;
+    sSessionCache.totalHandshakeMs += _lastHandshakeMs;
+
+    LOG_INFO("TLS handshake " + String(_lastHandshakeMs) + " ms"
+             + (_lastHandshakeResumed ? " (resumed)" : " (full)")
+             + ", average " + String(sSessionCache.totalHandshakeMs / sSessionCache.numHandshakes)
+             + " ms, resumed " + String(sSessionCache.numResumed)
+             + "/" + String(sSessionCache.numResumeAttempts) + " attempts");
+}
+
+int ResumableTLSClient::connect(IPAddress ip, uint16_t port)
+{
+    return connectTo(ip.toString().c_str(), ip, port);
+}
+
+int ResumableTLSClient::connect(const char *host, uint16_t port)
+{
+    // The address may come from the cache, the host name is still used for
+    // SNI and certificate validation
+    IPAddress address;
+    if (gWifiConnection.resolveHost(host, address) != STATUS_OK) {
+        return 0;
+    }
+
+    return connectTo(host, address, port);
+}
+
+int ResumableTLSClient::connectTo(const char *host, IPAddress address,
+                                  uint16_t port)
+{
+    uint32_t hostHash = hashHost(host, port);
+
+    // Try resuming the cached session first, then fall back to a full
+    // handshake if that fails
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool offerSession = (attempt == 0);
+
+        stop();
+
+        if (openSocket(address, port) != STATUS_OK) {
+            // The cached address may be stale, look it up again next time
+            gWifiConnection.invalidateHost();
+            stop();
+            return 0;
+        }
+
+        if (setupTLS(host, hostHash, offerSession) != STATUS_OK) {
+            stop();
+            return 0;
+        }
+
+        int ret = handshake();
+        if (ret != 0) {
+            LOG_WARN("TLS: handshake failed " + String(ret)
+                     + (_sessionOffered ? ", retrying with full handshake" : ""));
+            clearSession();
+
+            if (_sessionOffered) {
+                continue;
+            }
+
+            stop();
+            return 0;
+        }
+
+        // A resumed handshake skips the server certificate, so the verify
+        // callback only runs on a full handshake. This works for both session
+        // IDs and tickets.
+        _lastHandshakeResumed = _sessionOffered && !_certReceived;
+        if (_lastHandshakeResumed) {
+            sSessionCache.numResumed++;
+        } else {
+            // New session, cache it for the next wake
+            saveSession(hostHash);
+        }
+
+        logStats();
+
+        _connected = true;
+        return 1;
+    }
+
+    stop();
+    return 0;
+}
+
+size_t ResumableTLSClient::write(uint8_t data)
+{
+    return write(&data, 1);
+}
+
+size_t ResumableTLSClient::write(const uint8_t *buf, size_t size)
+{
+    if (!_connected) {
+        return 0;
+    }
+
+    uint32_t startMs = millis();
+    size_t written = 0;
+
+    while (written < size) {
+        int ret = mbedtls_ssl_write(&_ssl, buf + written, size - written);
+        if (ret > 0) {
+            written += ret;
+            continue;
+        }
+
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            LOG_WARN("TLS: write failed " + String(ret));
+            stop();
+            break;
+        }
+
+        if (millis() - startMs > WRITE_TIMEOUT_MS) {
+            LOG_WARN("TLS: write timed out");
+            stop();
+            break;
+        }
+
+        vTaskDelay(2);
+    }
+
+    return written;
+}
+
+int ResumableTLSClient::available()
+{
+    if (!_connected) {
+        return 0;
+    }
+
+    // A zero length read processes any pending record without consuming data
+    int ret = mbedtls_ssl_read(&_ssl, nullptr, 0);
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ
+        && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        if (ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            LOG_WARN("TLS: read failed " + String(ret));
+        }
+        stop();
+        return 0;
+    }
+
+    return mbedtls_ssl_get_bytes_avail(&_ssl) + (_peeked >= 0 ? 1 : 0);
+}
+
+int ResumableTLSClient::read()
+{
+    uint8_t data;
+
+    if (read(&data, 1) != 1) {
+        return -1;
+    }
+
+    return data;
+}
+
+int ResumableTLSClient::read(uint8_t *buf, size_t size)
+{
+    if (!_connected || size == 0) {
+        return -1;
+    }
+
+    size_t offset = 0;
+    if (_peeked >= 0) {
+        buf[0] = (uint8_t)_peeked;
+        _peeked = -1;
+        offset = 1;
+
+        if (size == 1) {
+            return 1;
+        }
+    }
+
+    int ret = mbedtls_ssl_read(&_ssl, buf + offset, size - offset);
+    if (ret > 0) {
+        return offset + ret;
+    }
+
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        if (ret != 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            LOG_WARN("TLS: read failed " + String(ret));
+        }
+        stop();
+    }
+
+    return offset > 0 ? (int)offset : -1;
+}
+
+int ResumableTLSClient::peek()
+{
+    if (_peeked >= 0) {
+        return _peeked;
+    }
+
+    uint8_t data;
+    if (available() <= 0 || read(&data, 1) != 1) {
+        return -1;
+    }
+
+    _peeked = data;
+    return _peeked;
+}
+
+void ResumableTLSClient::flush()
+{
+}
+
+void ResumableTLSClient::stop()
+{
+    if (_connected) {
+        mbedtls_ssl_close_notify(&_ssl);
+    }
+
+    _connected = false;
+    _peeked = -1;
+    freeTLS();
+}
+
+uint8_t ResumableTLSClient::connected()
+{
+    if (!_connected) {
+        return 0;
+    }
+
+    if (_peeked >= 0 || mbedtls_ssl_get_bytes_avail(&_ssl) > 0) {
+        return 1;
+    }
+
+    // Check if the server closed the connection without reading anything
+    uint8_t data;
+    int res = lwip_recv(_socket, &data, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (res == 0 || (res < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
+        stop();
+        return 0;
+    }
+
+    return 1;
+}
+
+ResumableTLSClient::operator bool()
+{
+    return connected();
+}
@@ -0,0 +1,157 @@
+#ifndef RESUMABLETLSCLIENT_H_K2M7PZQA
+#define RESUMABLETLSCLIENT_H_K2M7PZQA
+
+#include <Client.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "Status.h"
+
+// Max size of a serialized TLS session, including the peer certificate
+#define TLS_SESSION_CACHE_MAX_LEN 2048
+
+/*! \class ResumableTLSClient
+ *  \brief TLS client that resumes the previous TLS session across deep sleep
+ *
+ *  The session (ID or ticket) negotiated by the last full handshake is kept in
+ *  RTC memory and offered to the server on the next connection, which skips
+ *  the key exchange and certificate chain validation when the server accepts
+ *  it. If a resumed handshake fails the cached session is dropped and a full
+ *  handshake is done instead.
+ *
+ *  WiFiClientSecure doesn't expose its TLS context, so this client owns its
+ *  own socket and mbedtls context and only uses the public mbedtls API.
+ */
+class ResumableTLSClient : public Client
+{
+public:
+    ~ResumableTLSClient();
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t data) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override;
+    using Print::write;
+
+    /**
+     * @brief Set the CA certificate used to validate the server
+     *
+     * @param caCert The PEM encoded certificate, must stay valid while the
+     * client is used
+     */
+    void setCACert(const char *caCert);
+
+    /**
+     * @brief Don't validate the server certificate
+     */
+    void setInsecure();
+
+    /**
+     * @brief Forget the cached session, forcing a full handshake on the next
+     * connection
+     */
+    void clearSession();
+
+    /**
+     * @brief Get the duration of the last handshake
+     *
+     * @return The handshake time in ms
+     */
+    uint32_t getLastHandshakeMs();
+
+    /**
+     * @brief Check if the last handshake resumed the cached session
+     */
+    bool lastHandshakeResumed();
+
+protected:
+    enum {
+        CONNECT_TIMEOUT_MS = 10*1000,
+        HANDSHAKE_TIMEOUT_MS = 120*1000,
+        WRITE_TIMEOUT_MS = 10*1000,
+    };
+
+    /**
+     * @brief Connect to the server at the given address, using the host name
+     * for SNI and certificate validation
+     *
+     * @return 1 on success, 0 on failure
+     */
+    int connectTo(const char *host, IPAddress address, uint16_t port);
+
+    /**
+     * @brief Open a TCP connection to the server
+     *
+     * @return status
+     */
+    status_t openSocket(IPAddress address, uint16_t port);
+
+    /**
+     * @brief Set up the TLS context for a new connection, offering the cached
+     * session if there is one for this host
+     *
+     * @return status
+     */
+    status_t setupTLS(const char *host, uint32_t hostHash, bool offerSession);
+
+    /**
+     * @brief Free the TLS context and close the socket
+     */
+    void freeTLS();
+
+    /**
+     * @brief Run the TLS handshake to completion
+     *
+     * @return The mbedtls error code, 0 on success
+     */
+    int handshake();
+
+    /**
+     * @brief Save the session negotiated by the last handshake to the cache
+     */
+    void saveSession(uint32_t hostHash);
+
+    /**
+     * @brief Certificate verify callback, only called when the server sends
+     * its certificate chain, which it skips when it resumes a session
+     */
+    static int onVerifyCert(void *ctx, mbedtls_x509_crt *crt, int depth,
+                            uint32_t *flags);
+
+    uint32_t hashHost(const char *host, uint16_t port);
+
+    void logStats();
+
+    int _socket = -1;
+    bool _connected = false;
+    bool _tlsInitialised = false;
+    int _peeked = -1;
+
+    const char *_caCert = nullptr;
+    bool _insecure = false;
+
+    mbedtls_ssl_context _ssl;
+    mbedtls_ssl_config _conf;
+    mbedtls_ctr_drbg_context _drbg;
+    mbedtls_entropy_context _entropy;
+    mbedtls_x509_crt _caChain;
+
+    //! Set when the server sent its certificate during the last handshake
+    bool _certReceived = false;
+    //! Set when the cached session was offered in the last handshake
+    bool _sessionOffered = false;
+
+    uint32_t _lastHandshakeMs = 0;
+    bool _lastHandshakeResumed = false;
+};
+
+#endif /* end of include guard: RESUMABLETLSCLIENT_H_K2M7PZQA */
@@ -0,0 +1,45 @@
+#ifndef SENSORSNAPSHOT_H_5JQK8MWT
+#define SENSORSNAPSHOT_H_5JQK8MWT
+
+#include <stdint.h>
+#include "EnergyAccounting.h"
+
+/**
+ * All sensor readings from one wake, passed to the telemetry backend
+ *
+ * Readings from sensors that are missing or failed are marked invalid, and
+ * aren't published
+ */
+typedef struct {
+    //! Time the readings were taken, seconds since the epoch, 0 if unknown
+    uint32_t timestamp;
+
+    double co2Ppm;
+    bool co2Valid;
+
+    double airTempCelsius;
+    double airHumidityPercent;
+    bool airValid;
+
+    double batterySocPercent;
+    double batteryVoltageV;
+    bool batteryValid;
+
+    double soilTempCelsius;
+    double soilMoisturePercent;
+    bool soilValid;
+
+    double waterLevelPercent;
+    bool waterLevelValid;
+
+    double solarPanelVoltageV;
+    double solarPanelCurrentmA;
+    double solarPanelPowermW;
+    bool solarValid;
+
+    //! Energy used by the previous wake, the current one isn't done yet
+    WakeEnergy lastWakeEnergy;
+    bool lastWakeEnergyValid;
+} SensorSnapshot;
+
+#endif /* end of include guard: SENSORSNAPSHOT_H_5JQK8MWT */
@@ -8,6 +8,10 @@
 #include "Power_Controller.h"
 #include "Status.h"
 #include "Logger.h"
+#include "RadioActivity.h"
+#include "PowerManagement.h"
+#include "WakeBudget.h"
+#include "TimerServer.h"
 
 // Sensor setup number retries
 #define NUM_SETUP_RETRIES 5
@@ -23,152 +27,193 @@
 
 #define WATERLEVEL_INVALID_MEASUREMENT (-1)
 
+// Max time to wait for the radio to stop transmitting before sampling the
+// analog sensors
+#define RADIO_QUIET_MAX_WAIT_MS (10*1000)
+
+Sensors::Sensors()
+    : _powered(false),
+      _bme280Ready(false),
+      _ccs811Ready(false),
+      _ggReady(false),
+      _ina219Ready(false),
+      _waterLevelReady(false)
+{
+    clear_values();
+}
+
 status_t Sensors::init() {
     status_t rc;
 
-    // turn on the power
     rc = gPowerController.init();
     if (rc != STATUS_OK) {
       return STATUS_FAIL;
     }
 
-    rc = gPowerController.setPowerChannel(PowerController::POWER_CHANNEL_3V3, true);
-    if (rc != STATUS_OK) {
-      return rc;
-    }
+    return power_up();
+}
 
-    rc = bme280_init();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+/**
+ * @brief Switch on the 3V3 rail and set up the sensors on it, they lose their
+ * setup every time the rail goes off
+ */
+status_t Sensors::power_up() {
+    status_t rc;
 
-    rc = ccs811_init();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (_powered) {
+        return STATUS_OK;
     }
 
-    rc = gg_init();
+    rc = gPowerController.acquire(PowerController::POWER_CHANNEL_3V3,
+                                  PowerController::POWER_CONSUMER_SENSORS);
     if (rc != STATUS_OK) {
-        return rc;
+      return rc;
     }
 
-    rc = ina219_init();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    _powered = true;
 
-    rc = waterLevel.init();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    Wire.begin();
+
+    // A missing sensor only loses its own readings
+    _bme280Ready = init_sensor(BREAKER_BME280, &Sensors::bme280_init);
+    _ccs811Ready = init_sensor(BREAKER_CCS811, &Sensors::ccs811_init);
+    _ggReady = init_sensor(BREAKER_GAS_GAUGE, &Sensors::gg_init);
+    _ina219Ready = init_sensor(BREAKER_INA219, &Sensors::ina219_init);
+    _waterLevelReady = init_sensor(BREAKER_WATER_LEVEL, &Sensors::water_level_init);
 
     return STATUS_OK;
 }
 
-status_t Sensors::update_all_values()
+bool Sensors::init_sensor(Breaker breaker, status_t (Sensors::*init)())
 {
-    status_t rc;
-
-    rc = update_ccs811_values();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (!gCircuitBreakers.allow(breaker)) {
+        return false;
     }
 
-    rc = update_bme280_values();
-    if (rc != STATUS_OK) {
-        return rc;
+    if ((this->*init)() != STATUS_OK) {
+        gCircuitBreakers.recordFailure(breaker);
+        return false;
     }
 
-    rc = update_gg_values();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    gCircuitBreakers.recordSuccess(breaker);
 
-    rc = update_ina219_values();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    return true;
+}
 
-    rc = update_thermistor_values();
-    if (rc != STATUS_OK) {
-        return rc;
+void Sensors::power_down() {
+    if (!_powered) {
+        return;
     }
 
-    rc = update_soil_moisture_values();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    // Don't power the sensors through the I2C pins
+    Wire.end();
 
-    rc = update_water_level_values();
-    if (rc != STATUS_OK) {
-        if (rc == STATUS_TIMEOUT) {
-            // timeouts aren't an error, just log it
-            LOG_WARN("Didn't get valid water level measurement");
-            return STATUS_OK;
-        } else {
-            return rc;
-        }
-    }
+    gPowerController.release(PowerController::POWER_CHANNEL_3V3,
+                             PowerController::POWER_CONSUMER_SENSORS);
 
-    delay(1000);
+    _powered = false;
+    _bme280Ready = false;
+    _ccs811Ready = false;
+    _ggReady = false;
+    _ina219Ready = false;
+    _waterLevelReady = false;
+}
 
-    return STATUS_OK;
+void Sensors::clear_values()
+{
+    co2_ppm = NAN;
+    air_temp_celsius = NAN;
+    air_humidity_percent = NAN;
+    battery_soc_percent = NAN;
+    battery_voltage_mv = NAN;
+    soil_temperature_celsius = NAN;
+    soil_moisture_percent = NAN;
+    water_level_percent = WATERLEVEL_INVALID_MEASUREMENT;
+    solar_panel_voltage_V = NAN;
+    solar_panel_current_mA = NAN;
+    solar_panel_power_mW = NAN;
 }
 
-status_t Sensors::publish_all_feeds() {
+status_t Sensors::update_all_values()
+{
     status_t rc;
 
-    rc = publish_co2();
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    // Don't leave readings from an earlier cycle behind
+    clear_values();
 
-    rc = publish_air_temp();
+    rc = power_up();
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = publish_air_humidity();
+    rc = sample_all_values();
+
+    // Nothing else on the rail needs it between samples
+    power_down();
+
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = publish_soc();
-    if (rc != STATUS_OK) {
-        return rc;
+    gPowerManagement.wait(1000);
+
+    return STATUS_OK;
+}
+
+status_t Sensors::sample_all_values()
+{
+    status_t rc;
+
+    if (_ccs811Ready) {
+        rc = update_ccs811_values();
+        if (rc != STATUS_OK) {
+            co2_ppm = NAN;
+            gCircuitBreakers.recordFailure(BREAKER_CCS811);
+        }
     }
 
-    rc = publish_cell_voltage();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (_bme280Ready) {
+        update_bme280_values();
     }
 
-    rc = publish_soil_temp();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (_ggReady) {
+        update_gg_values();
     }
 
-    rc = publish_soil_moisture();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (_ina219Ready) {
+        update_ina219_values();
     }
 
-    rc = publish_water_level();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (_waterLevelReady) {
+        rc = update_water_level_values();
+        if (rc == STATUS_OK) {
+            gCircuitBreakers.recordSuccess(BREAKER_WATER_LEVEL);
+        } else {
+            // A missed echo now and then isn't an error, the breaker only
+            // opens on a run of them
+            LOG_WARN("Didn't get valid water level measurement");
+            gCircuitBreakers.recordFailure(BREAKER_WATER_LEVEL);
+        }
     }
 
-    rc = publish_solar_panel_voltage();
-    if (rc != STATUS_OK) {
-        return rc;
+    // The digital sensors above can be sampled while the network is coming
+    // up, but the ADC picks up noise from the radio, so sample the analog
+    // sensors in a window where the radio isn't transmitting
+    if (!gRadioActivity.waitForQuiet(RADIO_QUIET_MAX_WAIT_MS)) {
+        LOG_WARN("Radio still busy, sampling analog sensors anyway");
     }
 
-    rc = publish_solar_panel_current();
-    if (rc != STATUS_OK) {
-        return rc;
+    // The ADC reads are averaged over a few ms, stay out of light sleep so
+    // they're evenly spaced
+    gPowerManagement.acquire(PowerManagement::LOCK_SAMPLING);
+
+    rc = update_thermistor_values();
+    if (rc == STATUS_OK) {
+        rc = update_soil_moisture_values();
     }
 
-    rc = publish_solar_panel_power();
+    gPowerManagement.release(PowerManagement::LOCK_SAMPLING);
+
     if (rc != STATUS_OK) {
         return rc;
     }
@@ -187,20 +232,20 @@ status_t Sensors::update_ccs811_values() {
     CCS811.writeBaseLine(CCS811_BASELINE);
 
     LOG_INFO("Waiting for ccs811 to warm up");
-    delay(15000);
+    gPowerManagement.wait(15000);
 
     LOG_INFO("Waiting for CCS811 data to be ready");
     int num_tries;
-    //for (num_tries = 0; num_tries < CCS811_MAX_WAITS; ++num_tries) {
-    while (1) {
-        if (!CCS811.checkDataReady()) {
-            delay(CCS811_WAIT_TIME_MS);
-        } else {
-          break;
+    for (num_tries = 0; num_tries < CCS811_MAX_WAITS; ++num_tries) {
+        if (CCS811.checkDataReady()
+            || gWakeBudget.remainingMs(WAKE_PHASE_SENSORS) <= CCS811_WAIT_TIME_MS) {
+            break;
         }
+
+        gPowerManagement.wait(CCS811_WAIT_TIME_MS);
     }
 
-    if (num_tries == NUM_SETUP_RETRIES) {
+    if (!CCS811.checkDataReady()) {
         LOG_ERROR("Failed to read ccs811 values, data not ready");
         return STATUS_FAIL;
     }
@@ -212,26 +257,6 @@ status_t Sensors::update_ccs811_values() {
     return STATUS_OK;
 }
 
-status_t Sensors::publish_co2() {
-#ifdef ENABLE_CCS811
-    if (_co2_feed == nullptr) {
-        LOG_ERROR("CO2 Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("Sending co2 ppm val: " + String(co2_ppm));
-    if (!_co2_feed->publish(co2_ppm)) {
-      LOG_ERROR("Failed to publish co2 ppm value");
-      return STATUS_FAIL;
-    } else {
-      LOG_INFO("OK!");
-      return STATUS_OK;
-    }
-#else
-    return STATUS_OK;
-#endif
-}
-
 status_t Sensors::update_bme280_values() {
    BME280::TempUnit tempUnit(BME280::TempUnit_Celsius);
    BME280::PresUnit presUnit(BME280::PresUnit_Pa);
@@ -245,54 +270,6 @@ status_t Sensors::update_bme280_values() {
   return STATUS_OK;
 }
 
-status_t Sensors::publish_air_temp() {
-    if (_air_temp_feed == nullptr) {
-        LOG_ERROR("Air Temp Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending air temp val: " + String(air_temp_celsius));
-    if (!_air_temp_feed->publish(air_temp_celsius)) {
-        LOG_ERROR("Failed to publish air temp value");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_air_humidity() {
-    if (_air_humidity_feed == nullptr) {
-        LOG_ERROR("Air Humidity Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending air humidity val: " + String(air_humidity_percent));
-    if (!_air_humidity_feed->publish(air_humidity_percent)) {
-        LOG_ERROR("Failed to publish air humidity value");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_soil_temp() {
-    if (_soil_temp_feed == nullptr) {
-        LOG_ERROR("Soil Temp Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending soil temp val: " + String(soil_temperature_celsius));
-    if (!_soil_temp_feed->publish(soil_temperature_celsius)) {
-        LOG_ERROR("Failed to publish soil temp value");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
 status_t Sensors::update_gg_values() {
     battery_soc_percent = double(gg.cellRemainingPercent10()) / 10;
     battery_voltage_mv = double(gg.cellVoltage_mV()) / 1000.0;
@@ -300,135 +277,15 @@ status_t Sensors::update_gg_values() {
     return STATUS_OK;
 }
 
-status_t Sensors::publish_soc() {
-    if (_soc_feed == nullptr) {
-        LOG_ERROR("SOC Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("Sending soc val: " + String(battery_soc_percent));
-    if (!_soc_feed->publish(battery_soc_percent)) {
-        LOG_ERROR("Failed to publish soc value");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_cell_voltage() {
-    if (_cell_voltage_feed == nullptr) {
-        LOG_ERROR("Cell Voltage Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending cell voltage val: " + String(battery_voltage_mv));
-    if (!_cell_voltage_feed->publish(battery_voltage_mv)) {
-        LOG_ERROR("Failed to publish cell voltage feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_solar_panel_voltage() {
-    if (_solar_panel_voltage_feed == nullptr) {
-        LOG_ERROR("Solar Panel Voltage Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending solar panel voltage val: " + String(solar_panel_voltage_V));
-    if (!_solar_panel_voltage_feed->publish(solar_panel_voltage_V)) {
-        LOG_ERROR("Failed to publish solar panel voltage feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_solar_panel_current() {
-    if (_solar_panel_current_feed == nullptr) {
-        LOG_ERROR("Solar Panel Current Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending solar panel current val: " + String(solar_panel_current_mA));
-    if (!_solar_panel_current_feed->publish(solar_panel_current_mA)) {
-        LOG_ERROR("Failed to publish solar panel current feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_solar_panel_power() {
-    if (_solar_panel_power_feed == nullptr) {
-        LOG_ERROR("Solar Panel Power Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending solar panel power val: " + String(solar_panel_power_mW));
-    if (!_solar_panel_power_feed->publish(solar_panel_power_mW)) {
-        LOG_ERROR("Failed to publish solar panel power feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_soil_moisture() {
-    if (_soil_moisture_feed == nullptr) {
-        LOG_ERROR("Soil Moisture Feed not set");
-        return STATUS_FAIL;
-    }
-
-    LOG_INFO("\nSending soil moisture val: " + String(soil_moisture_percent));
-    if (!_soil_moisture_feed->publish(soil_moisture_percent)) {
-        LOG_ERROR("Failed to publish soil moisture feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
-status_t Sensors::publish_water_level() {
-    if (_water_level_feed == nullptr) {
-        LOG_ERROR("Water Level Feed not set");
-        return STATUS_FAIL;
-    }
-
-    if (water_level_percent == WATERLEVEL_INVALID_MEASUREMENT) {
-        // Skip publishing invalid value
-        // Logging of this error happens in update function
-        return STATUS_OK;
-    }
-
-    LOG_INFO("\nSending water level val: " + String(water_level_percent));
-    if (!_water_level_feed->publish(water_level_percent)) {
-        LOG_ERROR("Failed to publish water level feed");
-        return STATUS_FAIL;
-    } else {
-        LOG_INFO("OK!");
-        return STATUS_OK;
-    }
-}
-
 status_t Sensors::bme280_init()
 {
   int setupRetries;
 
-  Wire.begin();
-
   LOG_INFO("Setting up bme280");
   for (setupRetries = 0; setupRetries < NUM_SETUP_RETRIES; setupRetries++) {
     if (!bme.begin()) {
       LOG_WARN("bme begin failed");
-      delay(500);
+      gPowerManagement.wait(500);
     } else {
       break;
     }
@@ -464,7 +321,7 @@ status_t Sensors::ccs811_init()
   for (setupRetries = 0; setupRetries < NUM_SETUP_RETRIES; setupRetries++) {
     if (CCS811.begin() != 0) {
       LOG_WARN("Failed to init CCS811");
-      delay(500);
+      gPowerManagement.wait(500);
     } else {
       break;
     }
@@ -488,7 +345,7 @@ status_t Sensors::gg_init()
   for (setupRetries = 0; setupRetries < NUM_SETUP_RETRIES; setupRetries++) {
     if (!gg.begin()) {
       LOG_WARN("Failed to init gas gauge");
-      delay(500);
+      gPowerManagement.wait(500);
     } else {
       break;
     }
@@ -517,7 +374,7 @@ status_t Sensors::ina219_init() {
   for (setupRetries = 0; setupRetries < NUM_SETUP_RETRIES; setupRetries++) {
     if (!ina219.begin()) {
       LOG_WARN("Failed to init INA219");
-      delay(500);
+      gPowerManagement.wait(500);
     } else {
       break;
     }
@@ -533,6 +390,10 @@ status_t Sensors::ina219_init() {
   return STATUS_OK;
 }
 
+status_t Sensors::water_level_init() {
+  return waterLevel.init();
+}
+
 status_t Sensors::update_ina219_values() {
   solar_panel_voltage_V = ina219.getBusVoltage_V();
   solar_panel_current_mA = ina219.getCurrent_mA();
@@ -558,68 +419,43 @@ status_t Sensors::update_water_level_values() {
     return rc;
 }
 
-status_t Sensors::set_soc_feed(Adafruit_MQTT_Publish *soc_feed) {
-    _soc_feed = soc_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_cell_voltage_feed(Adafruit_MQTT_Publish *cell_voltage_feed) {
-    _cell_voltage_feed = cell_voltage_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_co2_feed(Adafruit_MQTT_Publish *co2_feed) {
-    _co2_feed = co2_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_air_temp_feed(Adafruit_MQTT_Publish *air_temp_feed) {
-    _air_temp_feed = air_temp_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_air_humidity_feed(Adafruit_MQTT_Publish *air_humidity_feed) {
-    _air_humidity_feed = air_humidity_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_soil_temp_feed(Adafruit_MQTT_Publish *soil_temperature_feed) {
-    _soil_temp_feed = soil_temperature_feed;
-
-    return STATUS_OK;
-}
-
-status_t Sensors::set_soil_moisture_feed(Adafruit_MQTT_Publish *soil_moisture_feed) {
-    _soil_moisture_feed = soil_moisture_feed;
+status_t Sensors::getSnapshot(SensorSnapshot *snapshot) {
+  if (snapshot == nullptr) {
+    return STATUS_INVALID_PARAMS;
+  }
 
-    return STATUS_OK;
-}
+  // Only keep the time if it has been set, it is kept through deep sleep
+  snapshot->timestamp = TimerServer::clockIsSet() ? time(nullptr) : 0;
 
-status_t Sensors::set_water_level_feed(Adafruit_MQTT_Publish *water_level_feed) {
-    _water_level_feed = water_level_feed;
+  snapshot->co2Ppm = co2_ppm;
+#ifdef ENABLE_CCS811
+  snapshot->co2Valid = !isnan(co2_ppm);
+#else
+  snapshot->co2Valid = false;
+#endif
 
-    return STATUS_OK;
-}
+  snapshot->airTempCelsius = air_temp_celsius;
+  snapshot->airHumidityPercent = air_humidity_percent;
+  snapshot->airValid = !isnan(air_temp_celsius);
 
-status_t Sensors::set_solar_panel_voltage_feed(Adafruit_MQTT_Publish *solar_panel_voltage_feed) {
-  _solar_panel_voltage_feed = solar_panel_voltage_feed;
+  snapshot->batterySocPercent = battery_soc_percent;
+  snapshot->batteryVoltageV = battery_voltage_mv;
+  snapshot->batteryValid = !isnan(battery_soc_percent);
 
-  return STATUS_OK;
-}
+  snapshot->soilTempCelsius = soil_temperature_celsius;
+  snapshot->soilMoisturePercent = soil_moisture_percent;
+  snapshot->soilValid = !isnan(soil_moisture_percent);
 
-status_t Sensors::set_solar_panel_current_feed(Adafruit_MQTT_Publish *solar_panel_current_feed) {
-  _solar_panel_current_feed = solar_panel_current_feed;
+  snapshot->waterLevelPercent = water_level_percent;
+  snapshot->waterLevelValid = (water_level_percent != WATERLEVEL_INVALID_MEASUREMENT);
 
-  return STATUS_OK;
-}
+  snapshot->solarPanelVoltageV = solar_panel_voltage_V;
+  snapshot->solarPanelCurrentmA = solar_panel_current_mA;
+  snapshot->solarPanelPowermW = solar_panel_power_mW;
+  snapshot->solarValid = !isnan(solar_panel_power_mW);
 
-status_t Sensors::set_solar_panel_power_feed(Adafruit_MQTT_Publish *solar_panel_power_feed) {
-  _solar_panel_power_feed = solar_panel_power_feed;
+  // Filled in by whoever publishes the snapshot
+  snapshot->lastWakeEnergyValid = false;
 
   return STATUS_OK;
 }
@@ -640,14 +476,28 @@ status_t Sensors::updateWaterLevelCalibration(uint32_t distanceFullCm,
 
 uint32_t Sensors::getWaterDistanceCm()
 {
-  return waterLevel.getWaterDistanceCm();
+  gPowerController.acquire(PowerController::POWER_CHANNEL_3V3,
+                           PowerController::POWER_CONSUMER_SENSORS);
+
+  uint32_t distanceCm = waterLevel.getWaterDistanceCm();
+
+  gPowerController.release(PowerController::POWER_CHANNEL_3V3,
+                           PowerController::POWER_CONSUMER_SENSORS);
+
+  return distanceCm;
 }
 
 double Sensors::getWaterLevelPercent()
 {
   double percent;
 
+  gPowerController.acquire(PowerController::POWER_CHANNEL_3V3,
+                           PowerController::POWER_CONSUMER_SENSORS);
+
   waterLevel.getWaterLevelPercent(&percent);
 
+  gPowerController.release(PowerController::POWER_CHANNEL_3V3,
+                           PowerController::POWER_CONSUMER_SENSORS);
+
   return percent;
 }
@@ -1,38 +1,39 @@
 #ifndef __SENSORS_H
 #define __SENSORS_H
 
-#include "Adafruit_MQTT.h"
-#include "Adafruit_MQTT_Client.h"
 #include <Adafruit_INA219.h>
 #include "LC709203F.h"
 #include "DFRobot_CCS811.h"
 #include "BME280I2C.h"
 #include "Status.h"
+#include "SensorSnapshot.h"
 #include "Thermistor.h"
 #include "SoilMoisture.h"
 #include "WaterLevel.h"
+#include "CircuitBreakers.h"
 
 class Sensors {
     public:
 
-    Sensors() {}
+    Sensors();
 
+    /**
+      * @brief Power up and set up the sensors, they stay powered until the
+      * next update_all_values()
+      *
+      * Sensors that fail to set up, or whose circuit breaker is open, are
+      * left out and their readings are invalid
+      */
     status_t init();
 
+    /**
+      * @brief Sample every sensor that is set up, powering them up first if
+      * needed and down after
+      *
+      * Readings that weren't taken are NAN
+      */
     status_t update_all_values();
 
-    status_t set_soc_feed(Adafruit_MQTT_Publish *soc_feed);
-    status_t set_cell_voltage_feed(Adafruit_MQTT_Publish *cell_voltage_feed);
-    status_t set_co2_feed(Adafruit_MQTT_Publish *co2_feed);
-    status_t set_air_temp_feed(Adafruit_MQTT_Publish *air_temp_feed);
-    status_t set_air_humidity_feed(Adafruit_MQTT_Publish *air_humidity_feed);
-    status_t set_soil_temp_feed(Adafruit_MQTT_Publish *soil_temperature_feed);
-    status_t set_soil_moisture_feed(Adafruit_MQTT_Publish *soil_temperature_feed);
-    status_t set_water_level_feed(Adafruit_MQTT_Publish *water_level_feed);
-    status_t set_solar_panel_voltage_feed(Adafruit_MQTT_Publish *solar_panel_voltage_feed);
-    status_t set_solar_panel_current_feed(Adafruit_MQTT_Publish *solar_panel_current_feed);
-    status_t set_solar_panel_power_feed(Adafruit_MQTT_Publish *solar_panel_power_feed);
-
     double getSoilMoisturePercentage();
 
     double getBatterySOC();
@@ -44,16 +45,30 @@ class Sensors {
                                          uint32_t distanceEmptyCm);
 
     /**
-      * @brief Publishes current sensor data to the MQTT feeds
+      * @brief Get the readings from the last update_all_values()
       */
-    status_t publish_all_feeds();
+    status_t getSnapshot(SensorSnapshot *snapshot);
 
     protected:
 
+    status_t power_up();
+    void power_down();
+
+    /**
+      * @brief Set up a sensor if its circuit breaker allows it
+      *
+      * @return If the sensor is set up
+      */
+    bool init_sensor(Breaker breaker, status_t (Sensors::*init)());
+
+    void clear_values();
+    status_t sample_all_values();
+
     status_t bme280_init();
     status_t ccs811_init();
     status_t gg_init();
     status_t ina219_init();
+    status_t water_level_init();
 
     status_t update_ccs811_values();
     status_t update_bme280_values();
@@ -63,18 +78,6 @@ class Sensors {
     status_t update_water_level_values();
     status_t update_ina219_values();
 
-    status_t publish_co2();
-    status_t publish_air_temp();
-    status_t publish_air_humidity();
-    status_t publish_soc();
-    status_t publish_cell_voltage();
-    status_t publish_soil_temp();
-    status_t publish_soil_moisture();
-    status_t publish_water_level();
-    status_t publish_solar_panel_voltage();
-    status_t publish_solar_panel_current();
-    status_t publish_solar_panel_power();
-
     double co2_ppm;
     double air_temp_celsius;
     double air_humidity_percent;
@@ -87,18 +90,6 @@ class Sensors {
     double solar_panel_current_mA;
     double solar_panel_power_mW;
 
-    Adafruit_MQTT_Publish *_soc_feed = nullptr;
-    Adafruit_MQTT_Publish *_cell_voltage_feed = nullptr;
-    Adafruit_MQTT_Publish *_co2_feed = nullptr;
-    Adafruit_MQTT_Publish *_air_temp_feed = nullptr;
-    Adafruit_MQTT_Publish *_air_humidity_feed = nullptr;
-    Adafruit_MQTT_Publish *_soil_temp_feed = nullptr;
-    Adafruit_MQTT_Publish *_soil_moisture_feed = nullptr;
-    Adafruit_MQTT_Publish *_water_level_feed = nullptr;
-    Adafruit_MQTT_Publish *_solar_panel_voltage_feed = nullptr;
-    Adafruit_MQTT_Publish *_solar_panel_current_feed = nullptr;
-    Adafruit_MQTT_Publish *_solar_panel_power_feed = nullptr;
-
     // Gas Gauge
     LC709203F gg;
 
@@ -118,6 +109,16 @@ class Sensors {
 
     // current sensor
     Adafruit_INA219 ina219;
+
+    // If we hold the 3V3 rail and the sensors are set up
+    bool _powered;
+
+    // Sensors that set up after the last power up
+    bool _bme280Ready;
+    bool _ccs811Ready;
+    bool _ggReady;
+    bool _ina219Ready;
+    bool _waterLevelReady;
 };
 
 #endif /* end of include guard: __SENSORS_H */
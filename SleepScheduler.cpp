@@ -0,0 +1,202 @@
+#include <time.h>
+
+#include "SleepScheduler.h"
+#include "DryDownModel.h"
+#include "WateringPlanner.h"
+#include "TimerServer.h"
+#include "Logger.h"
+#include "config.h"
+
+#define SLEEP_STATE_MAGIC 0x534C5050
+
+// Weight of the newest reading in the smoothed solar power
+#define SMOOTHING_WEIGHT 0.3f
+
+// Wake when this fraction of the predicted time until the soil needs
+// watering has passed, the prediction gets better closer to it
+#define DRYDOWN_WAKE_FRACTION 0.8f
+
+// Time from the wake timer firing to millis() starting to count
+#define BOOT_OVERHEAD_MS 300
+
+// Sleep at least this long even when the wake overran the interval
+#define MIN_SLEEP_MS (10*1000)
+
+/**
+ * Smoothed readings
+ */
+typedef struct {
+    //! Set to SLEEP_STATE_MAGIC once readings were recorded
+    uint32_t magic;
+
+    float solarMw;
+    float batterySoc;
+
+    //! Negative when watering by soil moisture isn't configured
+    float waterThresholdPercent;
+} SleepState;
+
+RTC_DATA_ATTR static SleepState sSleepState;
+
+SleepScheduler gSleepScheduler;
+
+void SleepScheduler::recordReadings(const SensorSnapshot &snapshot)
+{
+    if (sSleepState.magic != SLEEP_STATE_MAGIC) {
+        sSleepState.solarMw = snapshot.solarValid ? snapshot.solarPanelPowermW : 0;
+        sSleepState.waterThresholdPercent = -1;
+        sSleepState.magic = SLEEP_STATE_MAGIC;
+    } else if (snapshot.solarValid) {
+        sSleepState.solarMw += SMOOTHING_WEIGHT
+                               * (snapshot.solarPanelPowermW - sSleepState.solarMw);
+    }
+
+    // Without a reading the schedule runs on the last one
+    if (snapshot.batteryValid) {
+        sSleepState.batterySoc = snapshot.batterySocPercent;
+    }
+
+    if (snapshot.soilValid) {
+        // time() counts through deep sleep even when it was never set
+        gDryDownModel.addReading(time(nullptr), snapshot.soilMoisturePercent);
+    }
+}
+
+void SleepScheduler::setWaterThreshold(float thresholdPercent)
+{
+    sSleepState.waterThresholdPercent = thresholdPercent;
+}
+
+int32_t SleepScheduler::localHour()
+{
+    if (!TimerServer::clockIsSet()) {
+        return -1;
+    }
+
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+
+    return local.tm_hour;
+}
+
+uint32_t SleepScheduler::intervalSeconds()
+{
+    if (sSleepState.magic != SLEEP_STATE_MAGIC) {
+        return SLEEP_BASE_S;
+    }
+
+    float interval = SLEEP_BASE_S;
+
+    bool dark = sSleepState.solarMw < SLEEP_DARK_SOLAR_MW;
+    if (dark) {
+        interval *= 2;
+    }
+
+    int32_t hour = localHour();
+    if (hour >= 0 && (hour >= SLEEP_NIGHT_START_HOUR || hour < SLEEP_NIGHT_END_HOUR)) {
+        interval *= 2;
+    }
+
+    float dryingPctPerHour;
+    if (!dark && sSleepState.batterySoc >= SLEEP_LOW_SOC
+        && gDryDownModel.getDryingRate(&dryingPctPerHour) == STATUS_OK
+        && dryingPctPerHour >= SLEEP_FAST_DRYING_PCT_PER_H)
+    {
+        interval /= 2;
+    }
+
+    // Below SLEEP_LOW_SOC the interval grows linearly to SLEEP_MAX_S at
+    // SLEEP_CRITICAL_SOC
+    if (sSleepState.batterySoc < SLEEP_LOW_SOC) {
+        float depth = (SLEEP_LOW_SOC - sSleepState.batterySoc)
+                      / (SLEEP_LOW_SOC - SLEEP_CRITICAL_SOC);
+        depth = std::min(depth, 1.0f);
+
+        float lowBatteryInterval = SLEEP_BASE_S + depth * (SLEEP_MAX_S - SLEEP_BASE_S);
+        interval = std::max(interval, lowBatteryInterval);
+    }
+
+    interval = std::max(interval, (float)SLEEP_MIN_S);
+    interval = std::min(interval, (float)SLEEP_MAX_S);
+
+    return applyWateringPlan(applyDryDown(interval));
+}
+
+uint32_t SleepScheduler::applyDryDown(uint32_t interval)
+{
+    if (sSleepState.waterThresholdPercent < 0) {
+        return interval;
+    }
+
+    uint32_t untilThreshold;
+    if (gDryDownModel.predictSecondsUntil(sSleepState.waterThresholdPercent,
+                                          time(nullptr), &untilThreshold) != STATUS_OK)
+    {
+        return interval;
+    }
+
+    // Already at the threshold, watering is up to the planner, whose planned
+    // time applyWateringPlan() wakes us for
+    if (untilThreshold == 0) {
+        return interval;
+    }
+
+    float wakeIn = untilThreshold * DRYDOWN_WAKE_FRACTION;
+
+    // Far from needing water, wakes only add readings, sleep up to the cap
+    if (wakeIn > interval) {
+        return std::min(wakeIn, (float)SLEEP_DRYDOWN_MAX_S);
+    }
+
+#if ULP_SOIL_MONITOR
+    // The ULP wakes us when the threshold is crossed
+    return interval;
+#else
+    // Wake in time to water, unless the battery couldn't run the pump
+    if (sSleepState.batterySoc >= SLEEP_LOW_SOC) {
+        return std::max(wakeIn, (float)SLEEP_MIN_S);
+    }
+
+    return interval;
+#endif
+}
+
+uint32_t SleepScheduler::applyWateringPlan(uint32_t interval)
+{
+    uint32_t plannedTime;
+    if (gWateringPlanner.getPlannedTime(&plannedTime) != STATUS_OK) {
+        return interval;
+    }
+
+    time_t now = time(nullptr);
+    if (plannedTime <= now) {
+        return interval;
+    }
+
+    uint32_t untilPlanned = std::max(plannedTime - (uint32_t)now, (uint32_t)SLEEP_MIN_S);
+
+    return std::min(interval, untilPlanned);
+}
+
+uint32_t SleepScheduler::sleepMs(uint32_t awakeMs)
+{
+    uint32_t interval = intervalSeconds();
+    uint32_t intervalMs = interval * 1000;
+
+    awakeMs += BOOT_OVERHEAD_MS;
+
+    uint32_t sleepMs = MIN_SLEEP_MS;
+    if (awakeMs + MIN_SLEEP_MS < intervalMs) {
+        sleepMs = intervalMs - awakeMs;
+    } else {
+        LOG_WARN("Awake for " + String(awakeMs) + " ms, longer than the "
+                 + String(interval) + " s interval");
+    }
+
+    LOG_INFO("Sleep interval " + String(interval) + " s (solar "
+             + String(sSleepState.solarMw) + " mW, SOC "
+             + String(sSleepState.batterySoc) + "%)");
+
+    return sleepMs;
+}
@@ -0,0 +1,72 @@
+#ifndef SLEEPSCHEDULER_H_R8DZ3KPN
+#define SLEEPSCHEDULER_H_R8DZ3KPN
+
+#include <Arduino.h>
+#include "SensorSnapshot.h"
+
+/*! \class SleepScheduler
+ *  \brief Picks the time until the next wake from the battery, solar and
+ *  soil state
+ *
+ *  Starts from SLEEP_BASE_S and:
+ *
+ *  - Doubles it when the smoothed solar power is low, and again at night,
+ *    nothing changes quickly without sun.
+ *  - Halves it when the soil is drying quickly in the sun, so watering
+ *    decisions are made on fresh readings.
+ *  - Stretches it towards SLEEP_MAX_S as the battery drops below
+ *    SLEEP_LOW_SOC, whatever else is going on.
+ *  - Moves the wake to just before the soil dry down is predicted to reach
+ *    the watering threshold, up to SLEEP_DRYDOWN_MAX_S away.
+ *  - Wakes in time for watering the planner deferred.
+ *
+ *  The readings are kept in RTC memory so the trends carry across deep
+ *  sleep. The time spent awake is subtracted from the interval so wakes stay
+ *  an interval apart on the wall clock.
+ */
+class SleepScheduler
+{
+public:
+    /**
+     * @brief Feed in the readings of a cycle
+     */
+    void recordReadings(const SensorSnapshot &snapshot);
+
+    /**
+     * @brief Set the soil moisture the plants are watered below, negative if
+     * not configured
+     */
+    void setWaterThreshold(float thresholdPercent);
+
+    /**
+     * @brief Get the time from one wake to the next
+     */
+    uint32_t intervalSeconds();
+
+    /**
+     * @brief Get the time to sleep for, the interval less the time awake
+     *
+     * @param awakeMs Time since this cycle started
+     */
+    uint32_t sleepMs(uint32_t awakeMs);
+
+protected:
+    /**
+     * @brief Move the wake to just before the soil needs watering
+     */
+    uint32_t applyDryDown(uint32_t interval);
+
+    /**
+     * @brief Wake no later than deferred watering is planned for
+     */
+    uint32_t applyWateringPlan(uint32_t interval);
+
+    /**
+     * @brief Get the local hour, -1 if the clock was never set
+     */
+    static int32_t localHour();
+};
+
+extern SleepScheduler gSleepScheduler;
+
+#endif /* end of include guard: SLEEPSCHEDULER_H_R8DZ3KPN */
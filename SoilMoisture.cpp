@@ -1,5 +1,6 @@
 #include "SoilMoisture.h"
 #include "Logger.h"
+#include "PowerManagement.h"
 #include "Utilities.h"
 
 //! Number of ADC readings to average per soil moisture reading
@@ -13,14 +14,24 @@ double SoilMoisture::soilMoistureADCValToPercent(double adcVal) {
     return moisturePercent;
 }
 
+uint32_t SoilMoisture::soilMoisturePercentToADCVal(double percent) {
+    return mapRange(100 - percent, 0, 100, _reading_water, _reading_air);
+}
+
 double SoilMoisture::soilMoisturePercent() {
     double average = 0;
 
+    pinMode(_power_pin, OUTPUT);
+    digitalWrite(_power_pin, HIGH);
+    gPowerManagement.wait(SOIL_MOISTURE_POWER_SETTLE_MS);
+
     for (int i = 0; i < SOIL_MOISTURE_NUMBER_ADC_READINGS; ++i) {
         average += analogRead(_sensor_pin);
-        delay(10);
+        gPowerManagement.wait(10);
     }
 
+    digitalWrite(_power_pin, LOW);
+
     average /= SOIL_MOISTURE_NUMBER_ADC_READINGS;
 
     return soilMoistureADCValToPercent(average);
@@ -8,6 +8,14 @@
 
 #define SOIL_MOISTURE_PIN 34
 
+//! The probe is powered from this RTC GPIO rather than the sensor rail, so
+//! the ULP can power it for each sample during deep sleep. It draws about
+//! 5 mA, well within what a GPIO can source.
+#define SOIL_MOISTURE_POWER_PIN 33
+
+//! Time from powering the probe until its output is stable
+#define SOIL_MOISTURE_POWER_SETTLE_MS 100
+
 /*!
  *  \class SoilMoisture
  *  \brief Soil moisture monitoring via DFRobot waterproof capacitive soil
@@ -20,7 +28,8 @@ public:
     SoilMoisture() :
         _reading_air(SOIL_MOISTURE_READING_AIR),
         _reading_water(SOIL_MOISTURE_READING_WATER),
-        _sensor_pin(SOIL_MOISTURE_PIN) {};
+        _sensor_pin(SOIL_MOISTURE_PIN),
+        _power_pin(SOIL_MOISTURE_POWER_PIN) {};
 
     /**
      * @brief Read the soil moisture as a percentage between dry (in air) vs
@@ -30,8 +39,6 @@ public:
      */
     double soilMoisturePercent();
 
-protected:
-
     /**
      * @brief Convert the adc reading to percentage
      *
@@ -43,6 +50,17 @@ protected:
      */
     double soilMoistureADCValToPercent(double adcVal);
 
+    /**
+     * @brief Convert a percentage to the adc reading it maps from
+     *
+     * @param percent The soil moisture percentage
+     *
+     * @return The sensor adc reading
+     */
+    uint32_t soilMoisturePercentToADCVal(double percent);
+
+protected:
+
     //! The adc reading in air
     uint32_t _reading_air;
 
@@ -51,6 +69,9 @@ protected:
 
     //! The pin the sensor is connected to
     uint32_t _sensor_pin;
+
+    //! The pin powering the sensor
+    uint32_t _power_pin;
 };
 
 #endif /* end of include guard: SOILMOISTURE_H_4TALNFYG */
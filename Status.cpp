@@ -6,6 +6,7 @@ String status_to_string(status_t status) {
       case STATUS_INVALID_PARAMS: return "Invalid Params"; break;
       case STATUS_TIMEOUT: return "Timeout"; break;
       case STATUS_FAIL:  return "Failure"; break;
+      case STATUS_EMPTY: return "Empty"; break;
       default: return "Unknown status"; break;
   }
 }
@@ -8,6 +8,7 @@ enum status_t {
     STATUS_INVALID_PARAMS,
     STATUS_FAIL,
     STATUS_TIMEOUT,
+    STATUS_EMPTY,
 };
 
 String status_to_string(status_t status);
@@ -5,16 +5,55 @@
 #include "Logger.h"
 #include "AppPreferences.h"
 #include "GreenhouseTelnet.h"
+#include "GreenhouseCLI.h"
+#include "WifiConnection.h"
+#include "RadioActivity.h"
+#include "PublishScheduler.h"
+#include "Outbox.h"
+#include "LinkQuality.h"
+#include "SleepScheduler.h"
+#include "UlpSoilMonitor.h"
+#include "WakeStub.h"
+#include "PowerManagement.h"
+#include "EnergyAccounting.h"
+#include "WateringPlanner.h"
+#include "WakeBudget.h"
+#include "CircuitBreakers.h"
 
 /************************* Config Constants *********************************/
 
 /************************* Deep Sleep *********************************/
 #define uS_TO_S_FACTOR 1000000  /* Conversion factor for micro seconds to seconds */
-#define TIME_TO_SLEEP  300        /* Time ESP32 will go to sleep (in seconds) */
+#define uS_TO_MS_FACTOR 1000
+
+/************************* Feeds *********************************/
+#define WATERING_TOPIC AIO_FEED_TOPIC("watering")
+#define LOCAL_IP_TOPIC AIO_FEED_TOPIC("local-ip")
+#define WATER_TIME_APPLIED_TOPIC AIO_FEED_TOPIC("water-time-applied")
+#define LOGGING_TOPIC AIO_FEED_TOPIC("greenhouse-log")
 
 /************************* Other Constants *********************************/
 #define NUM_SETUP_RETRIES 5
 
+#define WIFI_CONNECT_TIMEOUT_MS (10*1000)
+
+// Max time to wait for the network bring up to finish. Its retries stop at
+// the network phase deadline, the margin covers the attempt in progress.
+#define NETWORK_JOIN_MARGIN_MS (5*1000)
+#define NETWORK_JOIN_TIMEOUT_MS \
+    (WakeBudget::budgetMs(WAKE_PHASE_NETWORK) + NETWORK_JOIN_MARGIN_MS)
+
+// The TLS handshake needs a large stack
+#define NETWORK_TASK_STACK_SIZE (12*1024)
+#define NETWORK_TASK_PRIORITY 1
+// Run the network bring up on the same core as the WiFi stack, leaving the
+// app core free for the sensors
+#define NETWORK_TASK_CORE 0
+
+#define NETWORK_EVENT_DONE (1 << 0)
+
+#define MQTT_RETRY_WAIT_MS (5*1000)
+
 #define SOIL_MOISTURE_WATER_THRESHOLD_PERCENT_INVALID (-1)
 #define DEFAULT_SOIL_MOISTURE_WATER_THRESHOLD_PERCENT SOIL_MOISTURE_WATER_THRESHOLD_PERCENT_INVALID
 
@@ -26,91 +65,149 @@
 
 #define DEFAULT_MIN_WATER_BATTERY_SOC 50
 
-#define TELNET_CHECK_STOP_TIME_MS (30*1000)
+#define CONFIG_VERSION_INVALID (-1)
+#define DEFAULT_CONFIG_VERSION CONFIG_VERSION_INVALID
+
+
+// Shared deadline for fetching all MQTT config values
+#define CONFIG_SYNC_TIMEOUT_MS (5*1000)
+
+// Stay connected between cycles instead of deep sleeping while the battery
+// is at least this full, so pushed config takes effect within a second
+#define ALWAYS_CONNECTED_ENTER_SOC 80
+// Go back to deep sleep once the battery drops below this, the gap stops us
+// flapping between modes
+#define ALWAYS_CONNECTED_EXIT_SOC 65
+
+#define ALWAYS_CONNECTED_READ_TIMEOUT_MS 500
+
+// Well within the MQTT keep alive, 5 minutes for Adafruit_MQTT
+#define MQTT_KEEPALIVE_PING_MS (60*1000)
+// Reconnect if the broker doesn't answer a ping within this
+#define MQTT_PING_RESPONSE_TIMEOUT_MS (10*1000)
 
 SystemManager::SystemManager() :
-    _mqtt(&_client, AIO_SERVER, AIO_SERVERPORT, AIO_USERNAME, AIO_KEY),
-    _soc_feed(&_mqtt, AIO_USERNAME "/feeds/battery-soc"),
-    _cell_voltage_feed(&_mqtt, AIO_USERNAME "/feeds/battery-cell-voltage"),
-    _co2_ppm_feed(&_mqtt, AIO_USERNAME "/feeds/co2"),
-    _air_temp_feed(&_mqtt, AIO_USERNAME "/feeds/air-temperature"),
-    _air_humidity_feed(&_mqtt, AIO_USERNAME "/feeds/air-humidity"),
-    _soil_temperature_feed(&_mqtt, AIO_USERNAME "/feeds/soil-temperature"),
-    _soil_moisture_feed(&_mqtt, AIO_USERNAME "/feeds/soil-moisture"),
-    _water_level_feed(&_mqtt, AIO_USERNAME "/feeds/water-level"),
-    _solar_panel_voltage_feed(&_mqtt, AIO_USERNAME "/feeds/solar-panel-voltage"),
-    _solar_panel_current_feed(&_mqtt, AIO_USERNAME "/feeds/solar-panel-current"),
-    _solar_panel_power_feed(&_mqtt, AIO_USERNAME "/feeds/solar-panel-power"),
-    _watering_feed(&_mqtt, AIO_USERNAME "/feeds/watering"),
-    _local_ip_feed(&_mqtt, AIO_USERNAME "/feeds/local-ip"),
-    _logging_feed(&_mqtt, AIO_USERNAME "/feeds/greenhouse-log"),
-    _water_pump_override_mqtt_config(&_mqtt, AIO_USERNAME "/feeds/pump-control-override",
+    _mqtt(&_client, AIO_SERVER, AIO_SERVERPORT, MQTT_CLIENT_ID, AIO_USERNAME, AIO_KEY),
+    _router(&_mqtt),
+    _water_pump_override_mqtt_config(&_router, AIO_USERNAME "/feeds/pump-control-override",
                          AIO_USERNAME "/feeds/pump-control-override/get"),
-    _enable_telnet(&_mqtt, AIO_USERNAME "/feeds/enable-telnet",
-                         AIO_USERNAME "/feeds/enable-telnet/get"),
-    _should_update_mqtt_config(&_mqtt, AIO_USERNAME "/feeds/update-config",
-                          AIO_USERNAME "/feeds/update-config/get"),
-    _water_threshold_mqtt_config(&_mqtt, AIO_USERNAME "/feeds/water-threshold", 
+    _water_threshold_mqtt_config(&_router, AIO_USERNAME "/feeds/water-threshold", 
                                            AIO_USERNAME "/feeds/water-threshold/get"),
-    _water_time_mqtt_config(&_mqtt, AIO_USERNAME "/feeds/water-time", 
-                                           AIO_USERNAME "/feeds/water-time/get")
+    _water_time_mqtt_config(&_router, AIO_USERNAME "/feeds/water-time", 
+                                           AIO_USERNAME "/feeds/water-time/get"),
+    _config_version_mqtt_config(&_router, AIO_USERNAME "/feeds/config-version",
+                                AIO_USERNAME "/feeds/config-version/get"),
+    _configSync(&_router),
+    _configValuesSync(&_router),
+    _commandChannel(&_router, AIO_USERNAME "/feeds/greenhouse-command",
+                    AIO_USERNAME "/feeds/greenhouse-command/get",
+                    AIO_USERNAME "/feeds/greenhouse-response"),
+    _backfill(&_httpClient, AIO_HTTP_SERVER, AIO_HTTP_PORT, AIO_USERNAME, AIO_KEY),
+#if TELEMETRY_BACKEND == TELEMETRY_BACKEND_LAN_MQTT
+    _telemetry(LAN_MQTT_SERVER, LAN_MQTT_PORT, LAN_MQTT_USERNAME,
+               LAN_MQTT_PASSWORD, LAN_MQTT_TOPIC)
+#else
+    _telemetry()
+#endif
 { }
 
 void SystemManager::goToSleep()
 {
-    LOG_INFO("Going to sleep for (seconds): " + String(TIME_TO_SLEEP));
-    esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
+    // Never ended, deep sleep ends the wake
+    gWakeBudget.startPhase(WAKE_PHASE_SLEEP);
+
+    _telemetry.disconnect();
+
+    gEnergyAccounting.startPhase(ENERGY_PHASE_PUBLISH);
+    gPublishScheduler.flush();
+    gEnergyAccounting.endPhase(ENERGY_PHASE_PUBLISH);
+
+    gPublishScheduler.logStats();
+    gOutbox.logStats();
+    gLinkQuality.logStats();
+    gPowerManagement.logStats();
+    _timeServer.logStats();
+    gWakeBudget.logStats();
+    gCircuitBreakers.logStats();
+
+    // Without the ULP's readings the stub can't tell if the soil changed
+    double stubSoilMoisture = NAN;
+
+#if ULP_SOIL_MONITOR
+    if (gUlpSoilMonitor.start(_soil_moisture_water_threshold_percent.getValue(),
+                              _sensors.getSoilMoisturePercentage()) == STATUS_OK) {
+        stubSoilMoisture = _sensors.getSoilMoisturePercentage();
+    } else {
+        LOG_WARN("Failed to start ULP soil monitoring");
+    }
+#endif
+
+    // Planned watering needs a full boot
+    uint32_t plannedTime;
+    if (gWateringPlanner.getPlannedTime(&plannedTime) == STATUS_OK) {
+        stubSoilMoisture = NAN;
+    }
+
+    uint32_t sleepMs = gSleepScheduler.sleepMs(millis());
+
+    // Timer wakes without a soil moisture change, and soil alarms we
+    // couldn't water for, are sent back to sleep by the stub
+    gWakeStub.arm((uint64_t)sleepMs * uS_TO_MS_FACTOR,
+                  (uint64_t)gSleepScheduler.intervalSeconds() * uS_TO_S_FACTOR,
+                  _sensors.getBatterySOC() >= _minWaterBatterySOC.getValue(),
+                  stubSoilMoisture);
+
+    SensorSnapshot snapshot;
+    if (_sensors.getSnapshot(&snapshot) == STATUS_OK) {
+        gEnergyAccounting.finishWake(snapshot.batteryVoltageV, snapshot.solarPanelPowermW);
+        gEnergyAccounting.logStats();
+    }
+
+    LOG_INFO("Awake for " + String(millis()) + " ms");
+    LOG_INFO("Going to sleep for (seconds): " + String(sleepMs / 1000));
+    esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * uS_TO_MS_FACTOR);
     esp_deep_sleep_start();
 }
 
 void SystemManager::lightSleep(uint32_t seconds)
 {
-    delay(100);
+    gPowerManagement.wait(100);
 
     esp_sleep_enable_timer_wakeup(seconds * uS_TO_S_FACTOR);
     esp_light_sleep_start();
 }
 
 
-// Error handler sleeps to restart us
-void SystemManager::errorHandler() {
-    goToSleep();
-}
-
-long SystemManager::getAverageRSSI(int32_t numSamples)
-{
-    long averageRSSI = 0;
-    for (int i = 0; i < numSamples; ++i) {
-        averageRSSI += WiFi.RSSI();
-        delay(20);
-    }
-
-    averageRSSI /= numSamples;
-
-    return averageRSSI;
-}
-
+/**
+ * @brief Wait for the WiFi connection started by startNetwork() and connect
+ * to MQTT
+ */
 status_t SystemManager::initWifiMQTT()
 {
     // Connect to WiFi access point.
-    LOG_INFO("Connecting to " + String(WLAN_SSID));
+    status_t rc = gWifiConnection.waitForConnection(WIFI_CONNECT_TIMEOUT_MS);
+    gRadioActivity.setBusy(false);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_WIFI);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
 
-    WiFi.begin(WLAN_SSID, WLAN_PASS);
-    for (int i = 0; i < NUM_SETUP_RETRIES; i++) {
-        if (WiFi.status() != WL_CONNECTED) {
-            Serial.print(".");
-            delay(500);
-        } else {
-            break;
-        }
+    if (_networkCancelled) {
+        return STATUS_TIMEOUT;
     }
-    Serial.println();
 
-    LOG_INFO("WiFi connected, IP address: " + WiFi.localIP().toString() + " RSSI " + String(getAverageRSSI(5)) + " dBm");
+    gLinkQuality.measure();
 
+#if AIO_USE_TLS
     _client.setCACert(_test_root_ca);
+#endif
+#if AIO_HTTP_USE_TLS
+    _httpClient.setCACert(_test_root_ca);
+#endif
+
+    _mqtt.setPersistentSession(MQTT_PERSISTENT_SESSION);
 
-    status_t rc = MQTTConnect();
+    rc = MQTTConnect();
     if (rc != STATUS_OK) {
         return rc;
     }
@@ -118,65 +215,112 @@ status_t SystemManager::initWifiMQTT()
     return STATUS_OK;
 }
 
-status_t SystemManager::setSensorFeeds()
+static void networkTask(void *arg)
 {
-    status_t rc;
+    SystemManager *systemManager = static_cast<SystemManager *>(arg);
 
-    LOG_INFO("Setting sensor mqtt feeds");
+    systemManager->runNetworkBringUp();
 
-    rc = _sensors.set_soc_feed(&_soc_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
-    rc = _sensors.set_cell_voltage_feed(&_cell_voltage_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
-    rc = _sensors.set_co2_feed(&_co2_ppm_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
-    rc = _sensors.set_air_temp_feed(&_air_temp_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    vTaskDelete(nullptr);
+}
 
-    rc = _sensors.set_air_humidity_feed(&_air_humidity_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+void SystemManager::runNetworkBringUp()
+{
+    _networkStatus = initWifiMQTT();
 
-    rc = _sensors.set_soil_temp_feed(&_soil_temperature_feed);
-    if (rc != STATUS_OK) {
-        return rc;
-    }
+    gPowerManagement.release(PowerManagement::LOCK_NETWORK);
+    gWakeBudget.endPhase(WAKE_PHASE_NETWORK);
 
-    rc = _sensors.set_soil_moisture_feed(&_soil_moisture_feed);
-    if (rc != STATUS_OK) {
-        return rc;
+    xEventGroupSetBits(_networkEvents, NETWORK_EVENT_DONE);
+}
+
+/**
+ * @brief Start bringing up WiFi and MQTT in the background
+ *
+ * WiFi association, DHCP and the TLS handshake run in their own task while
+ * the sensors are powered up and sampled, call waitForNetwork() to join
+ * before publishing
+ */
+status_t SystemManager::startNetwork()
+{
+    status_t rc;
+
+    _networkEvents = xEventGroupCreate();
+    if (_networkEvents == nullptr) {
+        LOG_ERROR("Failed to create network event group");
+        return STATUS_FAIL;
     }
 
-    rc = _sensors.set_water_level_feed(&_water_level_feed);
+    _uplinkStartMs = millis();
+    _networkCancelled = false;
+
+    // Keep the analog sensors from sampling while the radio is associating,
+    // cleared once the association is done
+    gRadioActivity.setBusy(true);
+
+    // Association and the TLS handshake at full speed, released by the
+    // network task
+    gPowerManagement.acquire(PowerManagement::LOCK_NETWORK);
+
+    // Ended once the network task is associated
+    gEnergyAccounting.startPhase(ENERGY_PHASE_WIFI);
+
+    // Ended by the network task
+    gWakeBudget.startPhase(WAKE_PHASE_NETWORK);
+
+    rc = gWifiConnection.begin(WLAN_SSID, WLAN_PASS);
     if (rc != STATUS_OK) {
+        gRadioActivity.setBusy(false);
+        gPowerManagement.release(PowerManagement::LOCK_NETWORK);
+        gEnergyAccounting.endPhase(ENERGY_PHASE_WIFI);
+        gWakeBudget.endPhase(WAKE_PHASE_NETWORK);
         return rc;
     }
 
-    rc = _sensors.set_solar_panel_voltage_feed(&_solar_panel_voltage_feed);
-    if (rc != STATUS_OK) {
-        return rc;
+    if (xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK_SIZE,
+                                this, NETWORK_TASK_PRIORITY, nullptr,
+                                NETWORK_TASK_CORE) != pdPASS)
+    {
+        LOG_WARN("Failed to start network task, bringing up network in line");
+        runNetworkBringUp();
     }
 
-    rc = _sensors.set_solar_panel_current_feed(&_solar_panel_current_feed);
-    if (rc != STATUS_OK) {
-        return rc;
+    return STATUS_OK;
+}
+
+/**
+ * @brief Join the network bring up started by startNetwork()
+ *
+ * Always returns with the network task done, so only the main task uses
+ * the MQTT client from then on
+ *
+ * @return The result of the network bring up
+ */
+status_t SystemManager::waitForNetwork()
+{
+    if (_networkEvents == nullptr) {
+        return STATUS_FAIL;
     }
 
-    rc = _sensors.set_solar_panel_power_feed(&_solar_panel_power_feed);
-    if (rc != STATUS_OK) {
-        return rc;
+    EventBits_t bits = xEventGroupWaitBits(_networkEvents, NETWORK_EVENT_DONE,
+                                           pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(NETWORK_JOIN_TIMEOUT_MS));
+    if (bits & NETWORK_EVENT_DONE) {
+        return _networkStatus;
     }
 
-    return STATUS_OK;
+    LOG_ERROR("Timed out waiting for network, cancelling");
+
+    // The task stops before its next connection attempt. One stuck in an
+    // attempt is past its network phase deadline, and the wake budget
+    // supervisor forces deep sleep if it never returns.
+    _networkCancelled = true;
+    xEventGroupWaitBits(_networkEvents, NETWORK_EVENT_DONE, pdFALSE, pdFALSE,
+                        portMAX_DELAY);
+
+    _mqtt.disconnect();
+
+    return STATUS_TIMEOUT;
 }
 
 // Function to connect and reconnect as necessary to the MQTT server.
@@ -190,22 +334,50 @@ status_t SystemManager::MQTTConnect() {
 
   LOG_INFO("Connecting to MQTT... ");
 
+  // Retries stop at the network deadline, when bringing up the network this
+  // is the deadline of the whole bring up
+  gWakeBudget.startPhase(WAKE_PHASE_NETWORK);
+
   uint8_t retries = 3;
-  while ((ret = _mqtt.connect()) != 0) { // connect will return 0 for connected
+  while (true) {
+    // TLS handshake at full speed and with the radio marked busy, but not the
+    // wait between retries
+    gPowerManagement.acquire(PowerManagement::LOCK_NETWORK);
+    gEnergyAccounting.startPhase(ENERGY_PHASE_TLS);
+    gRadioActivity.setBusy(true);
+    ret = _mqtt.connect();
+    gRadioActivity.setBusy(false);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_TLS);
+    gPowerManagement.release(PowerManagement::LOCK_NETWORK);
+
+    if (ret == 0) { // connect will return 0 for connected
+      break;
+    }
+
     Serial.println(_mqtt.connectErrorString(ret));
     LOG_WARN(reinterpret_cast<const char *>(_mqtt.connectErrorString(ret)));
 
-    LOG_INFO("Retrying MQTT connection in 5 seconds...");
     _mqtt.disconnect();
-    delay(5000);  // wait 5 seconds
     retries--;
-    if (retries == 0) {
+    if (retries == 0 || _networkCancelled
+        || gWakeBudget.remainingMs(WAKE_PHASE_NETWORK) <= MQTT_RETRY_WAIT_MS) {
       LOG_ERROR("Failed to connect to MQTT");
+      gWakeBudget.endPhase(WAKE_PHASE_NETWORK);
       return STATUS_FAIL;
     }
+
+    LOG_INFO("Retrying MQTT connection in 5 seconds...");
+    gPowerManagement.wait(MQTT_RETRY_WAIT_MS);
   }
   LOG_INFO("MQTT Connected!");
 
+  gWakeBudget.endPhase(WAKE_PHASE_NETWORK);
+
+  if (_router.subscribe(MQTT_CONFIG_SUBSCRIBE_QOS) != STATUS_OK) {
+    LOG_ERROR("Failed to subscribe to MQTT topics");
+    return STATUS_FAIL;
+  }
+
   return STATUS_OK;
 }
 
@@ -231,6 +403,13 @@ status_t SystemManager::initAndLoadAppPreferences()
         return rc;
     }
 
+    // Stored before the limit was lowered
+    rc = limitWaterTime();
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to limit water time config value");
+        return rc;
+    }
+
     rc = _allowedWaterHoursStart.initAndLoad(
         "waterHourStart", DEFAULT_ALLOWED_WATER_HOURS_START);
     if (rc != STATUS_OK) {
@@ -252,6 +431,13 @@ status_t SystemManager::initAndLoadAppPreferences()
         return rc;
     }
 
+    rc = _configVersion.initAndLoad(
+        "configVersion", DEFAULT_CONFIG_VERSION);
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Failed to load config version");
+        return rc;
+    }
+
     return STATUS_OK;
 }
 
@@ -259,27 +445,58 @@ status_t SystemManager::initMQTTConfigValues()
 {
     status_t rc;
 
+#if MQTT_SUBSCRIBE_WILDCARD
+    rc = _router.addFilter(MQTT_SUBSCRIBE_WILDCARD_FILTER);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+#endif
+
     rc = _water_pump_override_mqtt_config.init();
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = _enable_telnet.init();
+    rc = _water_threshold_mqtt_config.init();
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = _should_update_mqtt_config.init();
+    rc = _water_time_mqtt_config.init();
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = _water_threshold_mqtt_config.init();
+    rc = _config_version_mqtt_config.init();
     if (rc != STATUS_OK) {
         return rc;
     }
 
-    rc = _water_time_mqtt_config.init();
+    MQTTConfigValue *syncValues[] = {
+        &_water_pump_override_mqtt_config,
+        &_config_version_mqtt_config,
+    };
+
+    for (MQTTConfigValue *value : syncValues) {
+        rc = _configSync.add(value);
+        if (rc != STATUS_OK) {
+            return rc;
+        }
+    }
+
+    MQTTConfigValue *configValuesSyncValues[] = {
+        &_water_threshold_mqtt_config,
+        &_water_time_mqtt_config,
+    };
+
+    for (MQTTConfigValue *value : configValuesSyncValues) {
+        rc = _configValuesSync.add(value);
+        if (rc != STATUS_OK) {
+            return rc;
+        }
+    }
+
+    rc = _commandChannel.init();
     if (rc != STATUS_OK) {
         return rc;
     }
@@ -292,63 +509,132 @@ void SystemManager::init()
     status_t rc;
 
     Serial.begin(115200);
-    delay(10);
+    gEnergyAccounting.begin();
+    gWakeBudget.begin();
+    gWakeBudget.startPhase(WAKE_PHASE_INIT);
+    gPowerManagement.init();
+    gPowerManagement.wait(10);
+    _timeServer.begin();
 
     LOG_INFO("Starting up...");
 
+#if ULP_SOIL_MONITOR
+    // Readings the ULP took while we slept, before the ADC is used again
+    gUlpSoilMonitor.collect();
+#endif
+    gWakeStub.logStats();
+
+    // Nothing below stops the wake, each subsystem that fails is left out
+    // and we carry on with the rest
+
     rc = initAndLoadAppPreferences();
     if (rc != STATUS_OK) {
-        LOG_ERROR("Error initing and loading app preferences: " + status_to_string(rc));
-        errorHandler();
+        LOG_ERROR("Error initing and loading app preferences, running on defaults: "
+                  + status_to_string(rc));
     }
 
     rc = initMQTTConfigValues();
     if (rc != STATUS_OK) {
         LOG_ERROR("Error initing MQTT Config values " + status_to_string(rc));
-        errorHandler();
     }
 
-    rc = initWifiMQTT();
+    // Without the outbox unsent messages are dropped, we can still run
+    rc = gOutbox.init();
     if (rc != STATUS_OK) {
-        LOG_ERROR("Error initing sensors: " + status_to_string(rc));
-        errorHandler();
+        LOG_ERROR("Error initing outbox: " + status_to_string(rc));
     }
 
-    // MQTT is connected, we can start logging over MQTT
-    gLogger.enableMqttLogging(&_logging_feed);
-
-    _timeServer.init();
+    gPublishScheduler.init(&_mqtt);
 
-    LOG_INFO("Initializing sensors");
-    rc = _sensors.init();
+    // Without the CLI, MQTT commands fail but everything else still runs
+    rc = gGreenhouseCLI.init(this);
     if (rc != STATUS_OK) {
-        LOG_ERROR("Error initing sensors: " + status_to_string(rc));
-        errorHandler();
+        LOG_ERROR("Error initing CLI: " + status_to_string(rc));
     }
 
-    rc = setSensorFeeds();
+    // While the network is out, readings wait in the outbox until a later
+    // wake. On a poor link only the readings wait, alarms, config and
+    // commands still go over the network.
+    if (!gCircuitBreakers.allow(BREAKER_NETWORK)) {
+        _uplinkDeferred = true;
+    } else {
+        _telemetryDeferred = gLinkQuality.shouldDeferTelemetry(gOutbox.pendingBytes());
+        if (_telemetryDeferred) {
+            LOG_INFO("Link is poor (" + String(gLinkQuality.getRssi())
+                     + " dBm), deferring telemetry");
+            gPublishScheduler.setStoreTelemetry(true);
+        }
+    }
+
+    gWakeBudget.endPhase(WAKE_PHASE_INIT);
+
+    // Bring up the network in the background while we deal with the sensors
+    if (!_uplinkDeferred) {
+        rc = startNetwork();
+        if (rc != STATUS_OK) {
+            LOG_ERROR("Error starting network, continuing offline: " + status_to_string(rc));
+            gCircuitBreakers.recordFailure(BREAKER_NETWORK);
+            _uplinkDeferred = true;
+        }
+    }
+
+    LOG_INFO("Initializing sensors");
+    gEnergyAccounting.startPhase(ENERGY_PHASE_SENSORS);
+    gWakeBudget.startPhase(WAKE_PHASE_SENSORS);
+    rc = _sensors.init();
+    gWakeBudget.endPhase(WAKE_PHASE_SENSORS);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_SENSORS);
     if (rc != STATUS_OK) {
-        LOG_ERROR("Error setting sensor MQTT feeds" + status_to_string(rc));
-        errorHandler();
+        LOG_ERROR("Error initing sensors, continuing without them: " + status_to_string(rc));
     }
 
+    // Watering fails to turn the pump on without it
     rc = _waterPump.init();
     if (rc != STATUS_OK) {
         LOG_ERROR("Failed to init water pump");
-        errorHandler();
     }
 }
 
-status_t SystemManager::updateAndPublishSensors() {
+status_t SystemManager::updateSensors() {
     LOG_INFO("Reading from sensors");
+    gEnergyAccounting.startPhase(ENERGY_PHASE_SENSORS);
+    gWakeBudget.startPhase(WAKE_PHASE_SENSORS);
     status_t rc = _sensors.update_all_values();
+    gWakeBudget.endPhase(WAKE_PHASE_SENSORS);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_SENSORS);
     if (rc != STATUS_OK) {
         LOG_ERROR("Error reading sensors: " + status_to_string(rc));
         return rc;
     }
 
-    LOG_INFO("Publishing sensor data");
-    rc = _sensors.publish_all_feeds();
+    SensorSnapshot snapshot;
+    if (_sensors.getSnapshot(&snapshot) == STATUS_OK) {
+        gSleepScheduler.recordReadings(snapshot);
+        gWateringPlanner.recordReadings(snapshot);
+    }
+
+    return STATUS_OK;
+}
+
+status_t SystemManager::publishSensors() {
+    SensorSnapshot snapshot;
+
+    status_t rc = _sensors.getSnapshot(&snapshot);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    snapshot.lastWakeEnergyValid =
+        (gEnergyAccounting.getLastWake(&snapshot.lastWakeEnergy) == STATUS_OK);
+
+    LOG_INFO("Publishing sensor data to " + String(_telemetry.getName()));
+
+    rc = _telemetry.connect();
+    if (rc != STATUS_OK) {
+        LOG_ERROR("Error connecting to telemetry backend: " + status_to_string(rc));
+    }
+
+    rc = _telemetry.publish(snapshot);
     if (rc != STATUS_OK) {
         LOG_ERROR("Error publishing sensor data: " + status_to_string(rc));
         return rc;
@@ -357,15 +643,85 @@ status_t SystemManager::updateAndPublishSensors() {
     return STATUS_OK;
 }
 
+/**
+ * @brief Fetch the MQTT config values needed on every wake in one batch
+ *
+ * Values that didn't arrive before the deadline are left unreceived, and are
+ * skipped by their users. The stored config values are only fetched by
+ * updateConfigValues() when the config version changes.
+ */
+status_t SystemManager::updateConfigFromMQTT()
+{
+    if (!gCircuitBreakers.allow(BREAKER_CONFIG)) {
+        LOG_INFO("Config unavailable, running on the stored config");
+        return STATUS_FAIL;
+    }
+
+    status_t rc = _configSync.sync(
+        std::min<uint32_t>(CONFIG_SYNC_TIMEOUT_MS, gWakeBudget.remainingMs(WAKE_PHASE_CONFIG)));
+
+    // Some feeds may never have been written, only the config version
+    // missing counts against the breaker
+    if (_config_version_mqtt_config.isReceived()) {
+        gCircuitBreakers.recordSuccess(BREAKER_CONFIG);
+    } else {
+        gCircuitBreakers.recordFailure(BREAKER_CONFIG);
+    }
+
+    if (rc != STATUS_OK) {
+        LOG_WARN("Not all config values received: " + status_to_string(rc));
+        return rc;
+    }
+
+    return STATUS_OK;
+}
+
+/**
+ * @brief Send readings left in the outbox from earlier wakes
+ *
+ * A small backlog is cheapest to publish over the MQTT connection we already
+ * have, the broker stamps it with the time it arrives. Larger backlogs are
+ * uploaded over HTTP so each reading keeps the time it was taken.
+ */
+status_t SystemManager::drainBacklog()
+{
+    if (gOutbox.pendingBytes() < HTTP_BACKFILL_MIN_BYTES) {
+        return gPublishScheduler.drainOutbox();
+    }
+
+    // Adafruit IO counts every data point in a batch against the rate limit
+    uint32_t maxPoints = gPublishScheduler.takeTokens(
+        PUBLISH_SCHEDULER_MAX_TOKENS, PublishScheduler::PRIORITY_TELEMETRY);
+    if (maxPoints == 0) {
+        LOG_DEBUG("No publish tokens left for backfill");
+        return STATUS_OK;
+    }
+
+    uint32_t numUploaded = 0;
+
+    gPowerManagement.acquire(PowerManagement::LOCK_NETWORK);
+    status_t rc = _backfill.upload(maxPoints, &numUploaded);
+    gPowerManagement.release(PowerManagement::LOCK_NETWORK);
+
+    _httpClient.stop();
+
+    // Only the points the server accepted count against the rate limit
+    if (numUploaded < maxPoints) {
+        gPublishScheduler.returnTokens(maxPoints - numUploaded,
+                                       PublishScheduler::PRIORITY_TELEMETRY);
+    }
+
+    return rc;
+}
+
 status_t SystemManager::updateConfigValueFromMQTT(ConfigValue& configValue,
                                                   MQTTConfigValue &mqttValue)
 {
     status_t rc;
-    rc = mqttValue.updateValue();
-    if (rc != STATUS_OK) {
-        return rc;
+    if (!mqttValue.isReceived()) {
+        return STATUS_TIMEOUT;
     }
-   
+
     rc = configValue.updateValue(
         mqttValue.getValueDouble());
     if (rc != STATUS_OK) {
@@ -375,19 +731,54 @@ status_t SystemManager::updateConfigValueFromMQTT(ConfigValue& configValue,
     return STATUS_OK;
 }
 
+/**
+ * @brief Check if the config version published over MQTT differs from the
+ * version of the config stored in preferences
+ */
+bool SystemManager::configVersionChanged()
+{
+    if (!_config_version_mqtt_config.isReceived()) {
+        return false;
+    }
+
+    double version = _config_version_mqtt_config.getValueDouble();
+
+    if (version == _configVersion.getValue()) {
+        return false;
+    }
+
+    LOG_INFO("Config version changed from " + String(_configVersion.getValue())
+             + " to " + String(version));
+
+    return true;
+}
+
+/**
+ * @brief Fetch and store the config values, only when the config version has
+ * changed. Bump the version to force an update.
+ *
+ * In the steady state this costs nothing beyond the config version read in
+ * updateConfigFromMQTT()
+ */
 status_t SystemManager::updateConfigValues()
 {
     status_t rc;
 
-    rc = _should_update_mqtt_config.updateValue();
-    if (rc != STATUS_OK) {
-        LOG_ERROR("Failed to update should update config mqtt value");
-        return rc;
+    if (!_config_version_mqtt_config.isReceived()) {
+        LOG_ERROR("Failed to update config version mqtt value");
+        return STATUS_TIMEOUT;
     }
 
-    if (_should_update_mqtt_config.getValueOnOff()) {
+    if (configVersionChanged()) {
         LOG_INFO("Updating Config values");
 
+        rc = _configValuesSync.sync(
+            std::min<uint32_t>(CONFIG_SYNC_TIMEOUT_MS, gWakeBudget.remainingMs(WAKE_PHASE_CONFIG)));
+        if (rc != STATUS_OK) {
+            LOG_ERROR("Failed to fetch config values: " + status_to_string(rc));
+            return rc;
+        }
+
         rc = updateConfigValueFromMQTT(_soil_moisture_water_threshold_percent,
                                        _water_threshold_mqtt_config);
         if (rc != STATUS_OK) {
@@ -400,14 +791,51 @@ status_t SystemManager::updateConfigValues()
             return rc;
         }
 
+        rc = limitWaterTime();
+        if (rc != STATUS_OK) {
+            return rc;
+        }
+
+        // Only record the new version once all of its values are stored, so
+        // a partial update is retried on the next wake
+        rc = _configVersion.updateValue(
+            _config_version_mqtt_config.getValueDouble());
+        if (rc != STATUS_OK) {
+            return rc;
+        }
+
         LOG_ALWAYS("New config: water threshold " +
                    String(_soil_moisture_water_threshold_percent.getValue()) +
-                   " water time " + String(_water_time_seconds.getValue()));
+                   " water time " + String(_water_time_seconds.getValue()) +
+                   " version " + String(_configVersion.getValue()));
+
+        // The water time may have been limited, report what we water for
+        gPublishScheduler.publish(WATER_TIME_APPLIED_TOPIC, _water_time_seconds.getValue(),
+                                  PublishScheduler::PRIORITY_CONTROL);
+    } else {
+        LOG_DEBUG("Config unchanged, not updating config values");
     }
 
     return STATUS_OK;
 }
 
+/**
+ * @brief Limit the stored water time to what the wake budget lets the pump
+ * run for, so the watering planner's energy estimate is for the time we
+ * actually water for
+ */
+status_t SystemManager::limitWaterTime()
+{
+    if (_water_time_seconds.getValue() <= WAKE_WATERING_MAX_S) {
+        return STATUS_OK;
+    }
+
+    LOG_WARN("Water time " + String(_water_time_seconds.getValue())
+             + " s is over the limit, watering for " + String(WAKE_WATERING_MAX_S) + " s");
+
+    return _water_time_seconds.updateValue(WAKE_WATERING_MAX_S);
+}
+
 status_t SystemManager::waterPlants()
 {
     if (_water_time_seconds.getValue() == WATER_TIME_MS_INVALID) {
@@ -415,52 +843,53 @@ status_t SystemManager::waterPlants()
         return STATUS_FAIL;
     }
 
+    // Limited to WAKE_WATERING_MAX_S when it was stored
+    uint32_t waterMs = _water_time_seconds.getValue() * 1000;
+
     LOG_DEBUG("Start watering");
-    _watering_feed.publish(1);
-    _waterPump.turnOn();
+    gPublishScheduler.publish(WATERING_TOPIC, "1", PublishScheduler::PRIORITY_ALARM);
+    gEnergyAccounting.startPhase(ENERGY_PHASE_WATERING);
+    gWakeBudget.startPhase(WAKE_PHASE_WATERING);
+    if (_waterPump.turnOn() != STATUS_OK) {
+        LOG_ERROR("Failed to turn on the water pump");
+        gWakeBudget.endPhase(WAKE_PHASE_WATERING);
+        gEnergyAccounting.endPhase(ENERGY_PHASE_WATERING);
+        gPublishScheduler.publish(WATERING_TOPIC, "0", PublishScheduler::PRIORITY_ALARM);
+        return STATUS_FAIL;
+    }
 
-    delay(_water_time_seconds.getValue() * 1000);
+    gPowerManagement.wait(waterMs);
 
     _waterPump.turnOff();
-    _watering_feed.publish(0);
+    gWakeBudget.endPhase(WAKE_PHASE_WATERING);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_WATERING);
+    gPublishScheduler.publish(WATERING_TOPIC, "0", PublishScheduler::PRIORITY_ALARM);
     LOG_DEBUG("Done watering");
+
+    return STATUS_OK;
 }
 
-bool SystemManager::checkShouldStopTelnet()
+status_t SystemManager::requestTelnet()
 {
-    status_t rc;
-
-    if (millis() - lastCheckedTelnetShouldStop > TELNET_CHECK_STOP_TIME_MS) {
-        lastCheckedTelnetShouldStop = millis();
-
-        rc = _enable_telnet.updateValue();
-        if (rc != STATUS_OK) {
-            LOG_ERROR("Failed to get enable telnet mqtt value, stopping telnet");
-            return true;
-        }
-
-        if (!_enable_telnet.getValueOnOff()) {
-            LOG_INFO("Telnet disabled");
-            return true;
-        }
+    _telnetRequested = true;
 
-        return false;
-    } else {
-        return false;
-    }
+    return STATUS_OK;
 }
+
 void SystemManager::runTelnet()
 {
-    status_t rc;
-
+    // Ends early when the session runs the close command
     while (1) {
         gGreenhouseTelnet.run();
 
+        if (gWakeBudget.remainingMs(WAKE_PHASE_TELNET) == 0) {
+            LOG_ALWAYS("Telnet session out of time, stopping telnet");
+            break;
+        }
+
         if (!gGreenhouseTelnet.isActive()) {
-            if (checkShouldStopTelnet()) {
-                LOG_ALWAYS("Stopping telnet");
-                break;
-            }
+            LOG_ALWAYS("Telnet session idle, stopping telnet");
+            break;
         }
     }
 }
@@ -469,15 +898,12 @@ void SystemManager::checkAndStartTelnet()
 {
     status_t rc;
 
-    LOG_INFO("Checking if should enable telnet");
-    rc = _enable_telnet.updateValue();
-    if (rc != STATUS_OK) {
-        LOG_ERROR("Failed to get enable telnet mqtt value");
-        return;
-    }
+    if (_telnetRequested) {
+        _telnetRequested = false;
 
-    if (_enable_telnet.getValueOnOff()) {
-        if (!_local_ip_feed.publish(WiFi.localIP().toString().c_str())) {
+        if (gPublishScheduler.publish(LOCAL_IP_TOPIC,
+                                      WiFi.localIP().toString().c_str(),
+                                      PublishScheduler::PRIORITY_CONTROL) != STATUS_OK) {
             LOG_ERROR("Failed to publish telnet ip");
             return;
         }
@@ -488,7 +914,9 @@ void SystemManager::checkAndStartTelnet()
             return;
         }
 
+        gWakeBudget.startPhase(WAKE_PHASE_TELNET);
         runTelnet();
+        gWakeBudget.endPhase(WAKE_PHASE_TELNET);
 
         goToSleep();
     } else {
@@ -496,83 +924,299 @@ void SystemManager::checkAndStartTelnet()
     }
 }
 
-void SystemManager::run()
+/**
+ * @brief Publish the sensor readings, sync the config values and water if
+ * needed, once per cycle
+ */
+void SystemManager::publishAndWater(bool networkUp)
 {
     status_t rc;
 
-    MQTTConnect();
-
-    checkAndStartTelnet();
+    gEnergyAccounting.startPhase(ENERGY_PHASE_PUBLISH);
+    gWakeBudget.startPhase(WAKE_PHASE_PUBLISH);
 
-    rc = updateAndPublishSensors();
+    rc = publishSensors();
     if (rc != STATUS_OK) {
-        errorHandler();
+        // Failed readings are in the outbox, keep going so we still water
     }
 
-    rc = updateConfigValues();
-    if (rc != STATUS_OK) {
-        // This is not a serious error, so continue with other operations
+    // Send any telemetry deferred by the rate limit, then any backlog left
+    // from earlier wakes with the tokens that are left
+    gPublishScheduler.flush();
+
+    if (networkUp && !_telemetryDeferred) {
+        rc = drainBacklog();
+        if (rc != STATUS_OK) {
+            LOG_WARN("Failed to drain outbox: " + status_to_string(rc));
+        }
+    }
+
+    gWakeBudget.endPhase(WAKE_PHASE_PUBLISH);
+    gEnergyAccounting.endPhase(ENERGY_PHASE_PUBLISH);
+
+    if (networkUp) {
+        gEnergyAccounting.startPhase(ENERGY_PHASE_CONFIG);
+        gWakeBudget.startPhase(WAKE_PHASE_CONFIG);
+
+        rc = updateConfigValues();
+        if (rc != STATUS_OK) {
+            // This is not a serious error, so continue with other operations
+        }
+
+        _commandChannel.process();
+
+        gWakeBudget.endPhase(WAKE_PHASE_CONFIG);
+        gEnergyAccounting.endPhase(ENERGY_PHASE_CONFIG);
+
+        // Only the first cycle of a wake brings the network up. A wake that
+        // deferred its telemetry isn't a full uplink, and doesn't reset how
+        // long telemetry has been deferred for.
+        if (_uplinkStartMs != 0) {
+            if (!_telemetryDeferred) {
+                gLinkQuality.recordUplink(millis() - _uplinkStartMs, true);
+            }
+            _uplinkStartMs = 0;
+        }
     }
 
-    if (shouldWater() && canWater()) {
+    if (!shouldWater()) {
+        LOG_DEBUG("Not watering the plants");
+        gWateringPlanner.clear();
+    } else if (canWater()) {
         LOG_DEBUG("Watering the plants");
-        waterPlants();
+        if (waterPlants() == STATUS_OK) {
+            gWateringPlanner.clear();
+        }
     } else {
-        LOG_DEBUG("Not watering the plants");
+        LOG_DEBUG("Watering deferred");
     }
 
-    goToSleep();
+    // The next wake is planned around when the soil reaches the threshold
+    gSleepScheduler.setWaterThreshold(_soil_moisture_water_threshold_percent.getValue());
 }
 
-/** 
- * @brief Checks criteria determining if now is a good time to water the
- * plants. This doesn't check if the plants need watering, only if it is
- * possible to water plants right now
- * 
- * @return True if it is ok to water now, false otherwise
+/**
+ * @brief Check if there is enough battery to stay connected between cycles
+ * rather than deep sleeping
+ *
+ * @param alwaysConnected If we are already staying connected, the battery
+ * can drain further before we go back to deep sleep so we don't flap between
+ * modes
  */
-bool SystemManager::canWater()
+bool SystemManager::shouldStayConnected(bool alwaysConnected)
 {
-    /*
-     * Check if we are in the allowed water hours
-     *
-     * Water hours are to ensure we are getting sunlight on the solar panel
-     */
-    struct tm time;
-    status_t rc;
-    rc = _timeServer.getTime(&time);
-    if (rc != STATUS_OK) {
-        return false;
+    double soc = _sensors.getBatterySOC();
+
+    if (alwaysConnected) {
+        return soc >= ALWAYS_CONNECTED_EXIT_SOC;
     }
 
-    if (!(time.tm_hour >= _allowedWaterHoursStart.getValue() 
-        && time.tm_hour < _allowedWaterHoursEnd.getValue())) {
-        LOG_INFO("Not watering, outside water hours");
-        return false;
+    return soc >= ALWAYS_CONNECTED_ENTER_SOC;
+}
+
+/**
+ * @brief Act on a config value or command pushed by the broker while staying
+ * connected
+ */
+void SystemManager::handlePushedConfig(MQTTMessageHandler *handler)
+{
+    if (handler == &_water_pump_override_mqtt_config) {
+        LOG_INFO("Pump override changed");
+        if (shouldWater() && canWater()) {
+            waterPlants();
+        }
+    } else if (handler == &_config_version_mqtt_config) {
+        updateConfigValues();
+    } else if (handler == &_commandChannel) {
+        _commandChannel.process();
+        checkAndStartTelnet();
     }
+}
 
-    /*
-     * Check if we have enough battery to water
-     */
-    double soc = _sensors.getBatterySOC();
+/**
+ * @brief Stay associated and connected to MQTT, reacting to pushed config
+ * within a second, and run a cycle every sleep schedule interval
+ *
+ * Returns once the battery drops below ALWAYS_CONNECTED_EXIT_SOC, the
+ * connection is lost or the session has run ALWAYS_CONNECTED_MAX_SESSION_S,
+ * to go back to deep sleep
+ */
+void SystemManager::runAlwaysConnected()
+{
+    LOG_ALWAYS("Battery SOC " + String(_sensors.getBatterySOC())
+               + ", staying connected");
 
-    if (soc < _minWaterBatterySOC.getValue()) {
-        LOG_WARN("Unable to water due to low battery, SOC " + String(soc));
-        return false;
+    gPowerManagement.enableLowPowerIdle();
+
+    // On a full battery the cost of a poor link doesn't matter
+    if (_telemetryDeferred) {
+        _telemetryDeferred = false;
+        gPublishScheduler.setStoreTelemetry(false);
     }
 
-    return true; 
+    uint64_t sessionStartMs = millis();
+    uint64_t lastCycleMs = millis();
+    uint64_t lastPingMs = millis();
+    bool pingOutstanding = false;
+
+    while (true) {
+        // Each pass is bounded like a wake, the session as a whole is bounded
+        // below
+        gWakeBudget.feed();
+
+        if (millis() - sessionStartMs >= ALWAYS_CONNECTED_MAX_SESSION_S * 1000ULL) {
+            LOG_ALWAYS("Connected for " + String(ALWAYS_CONNECTED_MAX_SESSION_S / 60)
+                       + " min, going back to deep sleep");
+            break;
+        }
+
+        if (!_mqtt.connected()) {
+            pingOutstanding = false;
+        }
+
+        if (MQTTConnect() != STATUS_OK) {
+            LOG_ERROR("Lost MQTT connection, going back to deep sleep");
+            break;
+        }
+
+        // Polls with short delays, the chip can light sleep during them
+        MQTTMessageHandler *handler = _router.poll(ALWAYS_CONNECTED_READ_TIMEOUT_MS);
+        if (handler != nullptr) {
+            handlePushedConfig(handler);
+        }
+
+        // Received messages don't count as activity for the keep alive. The
+        // PINGRESP is read by the poll above, so messages arriving before it
+        // are still routed.
+        if (pingOutstanding && _mqtt.pingResponded()) {
+            pingOutstanding = false;
+        }
+
+        if (pingOutstanding) {
+            if (millis() - lastPingMs >= MQTT_PING_RESPONSE_TIMEOUT_MS) {
+                LOG_WARN("MQTT ping not answered, reconnecting");
+                _mqtt.disconnect();
+                pingOutstanding = false;
+            }
+        } else if (millis() - lastPingMs >= MQTT_KEEPALIVE_PING_MS) {
+            lastPingMs = millis();
+            if (_mqtt.sendPing()) {
+                pingOutstanding = true;
+            } else {
+                LOG_WARN("MQTT ping failed, reconnecting");
+                _mqtt.disconnect();
+            }
+        }
+
+        if (millis() - lastCycleMs >= gSleepScheduler.intervalSeconds() * 1000) {
+            lastCycleMs = millis();
+
+            if (updateSensors() == STATUS_OK) {
+                publishAndWater(true);
+            }
+
+            if (!shouldStayConnected(true)) {
+                LOG_ALWAYS("Battery SOC " + String(_sensors.getBatterySOC())
+                           + ", going back to deep sleep");
+                break;
+            }
+        }
+    }
 }
 
-bool SystemManager::shouldWater()
+void SystemManager::run()
 {
     status_t rc;
-    rc = _water_pump_override_mqtt_config.updateValue();
-    if (rc != STATUS_OK) {
-        LOG_ERROR("Failed to update water pump override mqtt value");
+
+    // Sample the sensors while the network is still coming up. Readings of
+    // sensors that failed are left out, watering only needs the soil
+    // moisture.
+    updateSensors();
+
+    // Without the network we still publish, to the outbox, and water using
+    // the stored config
+    bool networkUp = false;
+    if (!_uplinkDeferred) {
+        rc = waitForNetwork();
+        networkUp = (rc == STATUS_OK);
+        if (networkUp) {
+            gCircuitBreakers.recordSuccess(BREAKER_NETWORK);
+        } else {
+            LOG_ERROR("Error initing WiFi and MQTT, continuing offline: "
+                      + status_to_string(rc));
+            gLinkQuality.recordUplink(millis() - _uplinkStartMs, false);
+            gCircuitBreakers.recordFailure(BREAKER_NETWORK);
+        }
+    }
+
+    if (networkUp) {
+        // MQTT is connected, we can start logging over MQTT
+        gLogger.enableMqttLogging(LOGGING_TOPIC);
+    }
+
+    if (gCircuitBreakers.isDegraded()) {
+        LOG_WARN("Running degraded, skipping " + gCircuitBreakers.openBreakers());
+    }
+
+    if (networkUp) {
+        _timeServer.syncIfNeeded();
+
+        MQTTConnect();
+
+        gEnergyAccounting.startPhase(ENERGY_PHASE_CONFIG);
+        gWakeBudget.startPhase(WAKE_PHASE_CONFIG);
+
+        // The latest command arrives along with the config values
+        _commandChannel.requestLatest();
+
+        updateConfigFromMQTT();
+
+        _commandChannel.process();
+
+        gWakeBudget.endPhase(WAKE_PHASE_CONFIG);
+        gEnergyAccounting.endPhase(ENERGY_PHASE_CONFIG);
+
+        checkAndStartTelnet();
     }
 
-    if (_water_pump_override_mqtt_config.getValueOnOff()) {
+    publishAndWater(networkUp);
+
+    if (networkUp && shouldStayConnected(false)) {
+        runAlwaysConnected();
+    }
+
+    goToSleep();
+}
+
+/**
+ * @brief Checks criteria determining if now is a good time to water the
+ * plants. This doesn't check if the plants need watering, only if it is
+ * possible to water plants right now
+ *
+ * The watering planner keeps to the allowed water hours, which ensure we are
+ * getting sunlight on the solar panel, and to the min water battery SOC
+ * after the pump's predicted energy. Within those it waits for the sun,
+ * so watering that isn't possible now is deferred rather than skipped.
+ *
+ * @return True if it is ok to water now, false otherwise
+ */
+bool SystemManager::canWater()
+{
+    bool override = _water_pump_override_mqtt_config.isReceived()
+                    && _water_pump_override_mqtt_config.getValueOnOff();
+
+    WateringPlanner::Plan plan = gWateringPlanner.plan(
+        std::max(_water_time_seconds.getValue(), 0.0), _allowedWaterHoursStart.getValue(),
+        _allowedWaterHoursEnd.getValue(), _minWaterBatterySOC.getValue(), override);
+
+    return plan.decision == WateringPlanner::DECISION_WATER_NOW;
+}
+
+bool SystemManager::shouldWater()
+{
+    if (!_water_pump_override_mqtt_config.isReceived()) {
+        LOG_ERROR("Failed to update water pump override mqtt value");
+    } else if (_water_pump_override_mqtt_config.getValueOnOff()) {
         LOG_INFO("Water override is set, watering");
         return true;
     }
@@ -585,6 +1229,10 @@ bool SystemManager::shouldWater()
     }
 
     double soil_moisture_percent = _sensors.getSoilMoisturePercentage();
+    if (isnan(soil_moisture_percent)) {
+        LOG_WARN("No soil moisture reading, skipping watering");
+        return false;
+    }
 
     if (soil_moisture_percent <
         _soil_moisture_water_threshold_percent.getValue())
@@ -2,12 +2,24 @@
 #define SYSTEMMANAGER_H_HO5YVCME
 
 #include <WiFiClientSecure.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "Adafruit_MQTT.h"
 #include "Adafruit_MQTT_Client.h"
+#include "GreenhouseMQTTClient.h"
+#include "MQTTTopicRouter.h"
+#include "ResumableTLSClient.h"
+#include "config.h"
 #include "Status.h"
 #include "Sensors.h"
 #include "ConfigValue.h"
 #include "MQTTConfigValue.h"
+#include "MQTTConfigSync.h"
+#include "MQTTCommandChannel.h"
+#include "HTTPBackfill.h"
+#include "TelemetryBackend.h"
+#include "AdafruitIOTelemetry.h"
+#include "LanMQTTTelemetry.h"
 #include "WaterPump.h"
 #include "TimerServer.h"
 
@@ -37,12 +49,28 @@ public:
 
     double getWaterLevelPercent();
 
+    /**
+     * @brief Start a telnet session once the current commands have run
+     */
+    status_t requestTelnet();
+
+    /**
+     * Private, only to be used by the network task
+     */
+    void runNetworkBringUp();
+
 protected:
     bool canWater();
 
     bool shouldWater();
 
-    status_t updateAndPublishSensors();
+    status_t updateSensors();
+
+    status_t publishSensors();
+
+    status_t startNetwork();
+
+    status_t waitForNetwork();
 
     status_t initMQTTConfigValues();
 
@@ -50,13 +78,19 @@ protected:
 
     status_t initAndLoadAppPreferences();
 
-    status_t setSensorFeeds();
-
     status_t MQTTConnect();
 
     status_t updateConfigFromMQTT();
 
-    void errorHandler();
+    status_t drainBacklog();
+
+    void publishAndWater(bool networkUp);
+
+    bool shouldStayConnected(bool alwaysConnected);
+
+    void handlePushedConfig(MQTTMessageHandler *handler);
+
+    void runAlwaysConnected();
 
     void lightSleep(uint32_t seconds);
     
@@ -64,17 +98,17 @@ protected:
 
     status_t updateConfigValues();
 
+    bool configVersionChanged();
+
     status_t updateConfigValueFromMQTT(ConfigValue& configValue,
                                                       MQTTConfigValue &mqttValue);
 
-    long getAverageRSSI(int32_t numSamples);
+    status_t limitWaterTime();
 
     void checkAndStartTelnet();
 
     void runTelnet();
 
-    bool checkShouldStopTelnet();
-
     /**
      * Variables
      */
@@ -88,50 +122,102 @@ protected:
 
     ConfigValue _minWaterBatterySOC;
 
+    //! Version of the config values stored in preferences
+    ConfigValue _configVersion;
+
     Sensors _sensors;
 
     WaterPump _waterPump;
 
     TimerServer _timeServer;
 
-    uint64_t lastCheckedTelnetShouldStop = 0;
+    //! Set by the telnet command, the session starts after the commands
+    bool _telnetRequested = false;
+
+    //! Signals when the network bring up task is done
+    EventGroupHandle_t _networkEvents = nullptr;
+
+    //! Result of the network bring up
+    status_t _networkStatus = STATUS_FAIL;
+
+    //! Set when waitForNetwork() gives up, the network task stops retrying
+    volatile bool _networkCancelled = false;
+
+    //! The network is out, this wake runs offline
+    bool _uplinkDeferred = false;
+
+    //! The link is poor, this wake's readings wait in the outbox
+    bool _telemetryDeferred = false;
+
+    //! When the network bring up started, 0 once the uplink is recorded
+    uint32_t _uplinkStartMs = 0;
 
     /**
      * MQTT
      */
-    WiFiClientSecure _client;
-
-    Adafruit_MQTT_Client _mqtt;
-
-    Adafruit_MQTT_Publish _soc_feed;
-    Adafruit_MQTT_Publish _cell_voltage_feed;
-    Adafruit_MQTT_Publish _co2_ppm_feed;
-    Adafruit_MQTT_Publish _air_temp_feed;
-    Adafruit_MQTT_Publish _air_humidity_feed;
-    Adafruit_MQTT_Publish _soil_temperature_feed;
-    Adafruit_MQTT_Publish _soil_moisture_feed;
-    Adafruit_MQTT_Publish _water_level_feed;
-    Adafruit_MQTT_Publish _solar_panel_voltage_feed;
-    Adafruit_MQTT_Publish _solar_panel_current_feed;
-    Adafruit_MQTT_Publish _solar_panel_power_feed;
-    Adafruit_MQTT_Publish _watering_feed;
-    Adafruit_MQTT_Publish _local_ip_feed;
-
-    Adafruit_MQTT_Publish _logging_feed;
+#if AIO_USE_TLS
+    ResumableTLSClient _client;
+#else
+    WiFiClient _client;
+#endif
+
+    GreenhouseMQTTClient _mqtt;
+
+    //! Hands incoming messages to the config values and command channel
+    MQTTTopicRouter _router;
+
+    /**
+     * HTTP, used to upload the outbox backlog with timestamps
+     */
+#if AIO_HTTP_USE_TLS
+    WiFiClientSecure _httpClient;
+#else
+    WiFiClient _httpClient;
+#endif
+
+    HTTPBackfill _backfill;
+
+    /**
+     * Where sensor readings are sent
+     */
+#if TELEMETRY_BACKEND == TELEMETRY_BACKEND_LAN_MQTT
+    LanMQTTTelemetry _telemetry;
+#else
+    AdafruitIOTelemetry _telemetry;
+#endif
 
     /*
      * Config values used to control system behaviour, always updated
      */
     MQTTConfigValue _water_pump_override_mqtt_config;
-    MQTTConfigValue _enable_telnet;
 
     /*
-     * Config values, only updated if _should_update_config is set to ON
+     * Config values, only updated if the config version changes
      */
-    MQTTConfigValue _should_update_mqtt_config;
     MQTTConfigValue _water_threshold_mqtt_config;
     MQTTConfigValue _water_time_mqtt_config;
 
+    /*
+     * Version of the config values, bump it after changing any config value
+     * so the greenhouse fetches and stores the new values
+     */
+    MQTTConfigValue _config_version_mqtt_config;
+
+    /*
+     * Fetches the values needed on every wake in one batch
+     */
+    MQTTConfigSync _configSync;
+
+    /*
+     * Fetches the stored config values, only when the config version changes
+     */
+    MQTTConfigSync _configValuesSync;
+
+    /*
+     * CLI commands sent over MQTT, answered on the response feed
+     */
+    MQTTCommandChannel _commandChannel;
+
     const char* _test_root_ca= \
          "-----BEGIN CERTIFICATE-----\n" \
          "MIIDrzCCApegAwIBAgIQCDvgVpBCRrGhdWrJWZHHSjANBgkqhkiG9w0BAQUFADBh\n" \
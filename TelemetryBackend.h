@@ -0,0 +1,36 @@
+#ifndef TELEMETRYBACKEND_H_R6NB3VZE
+#define TELEMETRYBACKEND_H_R6NB3VZE
+
+#include "Status.h"
+#include "SensorSnapshot.h"
+
+/*! \class TelemetryBackend
+ *  \brief Where sensor readings are sent
+ *
+ *  Selected with TELEMETRY_BACKEND in config.h. Config values and control
+ *  traffic always go through the Adafruit IO MQTT connection.
+ */
+class TelemetryBackend
+{
+public:
+    virtual ~TelemetryBackend() {}
+
+    virtual const char *getName() = 0;
+
+    /**
+     * @brief Connect to the backend, once WiFi is up
+     */
+    virtual status_t connect() = 0;
+
+    /**
+     * @brief Send one set of sensor readings
+     */
+    virtual status_t publish(const SensorSnapshot &snapshot) = 0;
+
+    /**
+     * @brief Close the connection before sleeping
+     */
+    virtual void disconnect() {}
+};
+
+#endif /* end of include guard: TELEMETRYBACKEND_H_R6NB3VZE */
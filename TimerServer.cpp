@@ -1,9 +1,189 @@
+#include <time.h>
+#include <sys/time.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+
 #include "TimerServer.h"
 #include "Logger.h"
+#include "config.h"
+
+#define CLOCK_STATE_MAGIC 0x434C4F43
+
+// Times before this are from a clock that was never set
+#define MIN_VALID_EPOCH_S 1600000000
+
+#define US_PER_S 1000000LL
+
+// Error of the clock straight after a sync, NTP over WiFi
+#define NTP_SYNC_ERROR_MS 100
+
+// Drift assumed before it has been measured, the 150 kHz RC slow clock is
+// only calibrated to around a percent
+#define UNMEASURED_DRIFT_PPM 10000.0f
+
+// Temperature moves the RC slow clock, so the drift is never trusted to
+// better than this, which also bounds how long we go between syncs
+#define MIN_DRIFT_UNCERTAINTY_PPM 20.0f
+
+// Syncs closer together than this are too short to measure the drift over
+#define MIN_DRIFT_SAMPLE_S (10*60)
+
+// Weight of the newest measurement in the drift and its uncertainty
+#define DRIFT_WEIGHT 0.5f
 
-void TimerServer::init()
+/**
+ * Clock drift and syncs
+ */
+typedef struct {
+    //! Set to CLOCK_STATE_MAGIC once the clock has been synced
+    uint32_t magic;
+
+    //! Time of the last sync, us since the epoch
+    int64_t lastSyncUs;
+    //! Time the drift correction was last applied up to
+    int64_t lastCorrectionUs;
+
+    //! Rate the clock is corrected by, positive when the RTC runs slow
+    float driftPpm;
+    //! How far off driftPpm may be, negative until measured
+    float uncertaintyPpm;
+
+    //! Clock error found by the last sync, positive when we were behind
+    int32_t lastOffsetMs;
+    uint32_t numSyncs;
+} ClockState;
+
+RTC_DATA_ATTR static ClockState sClockState;
+
+// Clock and esp_timer when the sync was started, the clock runs off the
+// crystal while awake so the time it should read at the sync is known
+static int64_t sSyncStartClockUs;
+static int64_t sSyncStartTimerUs;
+
+static int64_t getClockUs()
 {
-    configTime(_gmtOffsetSeconds, _daylightOffsetSeconds, _ntpServer);
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    return (int64_t)tv.tv_sec * US_PER_S + tv.tv_usec;
+}
+
+/**
+ * SNTP sync notification, called from the lwIP task once the clock has been
+ * set to tv
+ */
+static void onTimeSync(struct timeval *tv)
+{
+    int64_t syncUs = (int64_t)tv->tv_sec * US_PER_S + tv->tv_usec;
+    int64_t expectedUs = sSyncStartClockUs + (esp_timer_get_time() - sSyncStartTimerUs);
+
+    if (sClockState.magic == CLOCK_STATE_MAGIC && sSyncStartClockUs >= MIN_VALID_EPOCH_S * US_PER_S) {
+        int64_t offsetUs = syncUs - expectedUs;
+        int64_t elapsedUs = expectedUs - sClockState.lastSyncUs;
+
+        sClockState.lastOffsetMs = offsetUs / 1000;
+
+        // The offset is what's left after the corrections made since the
+        // last sync, so it adjusts the drift rather than replacing it
+        if (elapsedUs >= MIN_DRIFT_SAMPLE_S * US_PER_S) {
+            float residualPpm = (float)offsetUs * US_PER_S / elapsedUs;
+
+            sClockState.driftPpm += DRIFT_WEIGHT * residualPpm;
+
+            if (sClockState.uncertaintyPpm < 0) {
+                sClockState.uncertaintyPpm = fabsf(residualPpm);
+            } else {
+                sClockState.uncertaintyPpm +=
+                    DRIFT_WEIGHT * (fabsf(residualPpm) - sClockState.uncertaintyPpm);
+            }
+            sClockState.uncertaintyPpm = std::max(sClockState.uncertaintyPpm,
+                                                  MIN_DRIFT_UNCERTAINTY_PPM);
+        }
+    } else {
+        memset(&sClockState, 0, sizeof(sClockState));
+        sClockState.uncertaintyPpm = -1;
+        sClockState.magic = CLOCK_STATE_MAGIC;
+    }
+
+    sClockState.lastSyncUs = syncUs;
+    sClockState.lastCorrectionUs = syncUs;
+    sClockState.numSyncs++;
+
+    // SNTP polls again while we stay awake, measure from this sync
+    sSyncStartClockUs = syncUs;
+    sSyncStartTimerUs = esp_timer_get_time();
+}
+
+void TimerServer::begin()
+{
+    // The time zone lives in the environment, which doesn't survive deep
+    // sleep
+    setenv("TZ", _timeZone, 1);
+    tzset();
+
+    if (sClockState.magic != CLOCK_STATE_MAGIC) {
+        return;
+    }
+
+    int64_t nowUs = getClockUs();
+    if (nowUs < MIN_VALID_EPOCH_S * US_PER_S || nowUs <= sClockState.lastCorrectionUs) {
+        return;
+    }
+
+    // Awake time is counted too, it runs off the crystal but is a small part
+    // of the time between wakes
+    int64_t correctionUs = (nowUs - sClockState.lastCorrectionUs) * sClockState.driftPpm / US_PER_S;
+    nowUs += correctionUs;
+
+    struct timeval tv;
+    tv.tv_sec = nowUs / US_PER_S;
+    tv.tv_usec = nowUs % US_PER_S;
+    settimeofday(&tv, nullptr);
+
+    sClockState.lastCorrectionUs = nowUs;
+
+    LOG_DEBUG("Clock corrected by " + String((int32_t)(correctionUs / 1000)) + " ms for drift");
+}
+
+uint32_t TimerServer::getEstimatedErrorMs()
+{
+    int64_t nowUs = getClockUs();
+
+    if (sClockState.magic != CLOCK_STATE_MAGIC || nowUs < MIN_VALID_EPOCH_S * US_PER_S) {
+        return UINT32_MAX;
+    }
+
+    float uncertaintyPpm = sClockState.uncertaintyPpm < 0 ? UNMEASURED_DRIFT_PPM
+                                                          : sClockState.uncertaintyPpm;
+    float elapsedS = (float)(nowUs - sClockState.lastSyncUs) / US_PER_S;
+
+    // s by ppm is us, /1000 is ms
+    float errorMs = NTP_SYNC_ERROR_MS + fabsf(elapsedS) * uncertaintyPpm / 1000;
+
+    return errorMs < UINT32_MAX ? errorMs : UINT32_MAX;
+}
+
+void TimerServer::syncIfNeeded()
+{
+    uint32_t errorMs = getEstimatedErrorMs();
+
+    if (errorMs <= TIME_MAX_ERROR_MS) {
+        LOG_DEBUG("Clock within " + String(errorMs) + " ms, skipping NTP");
+        return;
+    }
+
+    if (sntp_enabled()) {
+        // Already syncing
+        return;
+    }
+
+    LOG_INFO("Clock error estimated at " + String(errorMs) + " ms, syncing with NTP");
+
+    sSyncStartClockUs = getClockUs();
+    sSyncStartTimerUs = esp_timer_get_time();
+
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    configTzTime(_timeZone, _ntpServer);
 }
 
 status_t TimerServer::getTime(struct tm *tm)
@@ -13,11 +193,34 @@ status_t TimerServer::getTime(struct tm *tm)
         return STATUS_INVALID_PARAMS;
     }
 
-    if (!getLocalTime(tm)) {
-        LOG_ERROR("Failed to get local time");
+    if (!clockIsSet()) {
+        LOG_WARN("Clock not set");
         return STATUS_FAIL;
     }
 
+    time_t now = time(nullptr);
+    localtime_r(&now, tm);
+
     return STATUS_OK;
 }
 
+bool TimerServer::clockIsSet()
+{
+    return time(nullptr) >= MIN_VALID_EPOCH_S;
+}
+
+void TimerServer::logStats()
+{
+    if (sClockState.magic != CLOCK_STATE_MAGIC) {
+        LOG_INFO("Clock never synced");
+        return;
+    }
+
+    String uncertainty = sClockState.uncertaintyPpm < 0
+                         ? String("unmeasured") : String(sClockState.uncertaintyPpm, 0) + " ppm";
+
+    LOG_INFO("Clock synced " + String(sClockState.numSyncs) + " times, drift "
+             + String(sClockState.driftPpm, 0) + " ppm (+/- " + uncertainty
+             + "), last sync off by " + String(sClockState.lastOffsetMs)
+             + " ms, error now estimated at " + String(getEstimatedErrorMs()) + " ms");
+}
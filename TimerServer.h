@@ -7,19 +7,56 @@
 /*! \class TimerServer
  *  \brief Class to manage system time based on NTP server
  *
- *  Detailed description
+ *  The system clock keeps counting through deep sleep on the RTC slow clock,
+ *  which drifts. Each NTP sync measures the drift against the time since the
+ *  last sync, and the clock is corrected by it on every wake. The drift
+ *  estimate and the time of the last sync are kept in RTC memory.
+ *
+ *  NTP only runs when the estimated clock error, from how far the drift
+ *  estimate is off and the time since the last sync, is over
+ *  TIME_MAX_ERROR_MS. The sync runs in the background and sets the clock
+ *  when the reply arrives, nothing waits for it.
  */
 class TimerServer
 {
 public:
-    void init();
+    /**
+     * @brief Set the time zone and correct the clock for drift, call on every
+     * wake before the time is used
+     */
+    void begin();
+
+    /**
+     * @brief Start a background NTP sync if the clock needs it, call once the
+     * network is up
+     */
+    void syncIfNeeded();
 
+    /**
+     * @brief Get the local time, doesn't block
+     *
+     * @return STATUS_FAIL if the clock was never set
+     */
     status_t getTime(struct tm *tm);
 
+    /**
+     * @brief Check if the clock was ever set, it keeps counting through deep
+     * sleep once it is
+     */
+    static bool clockIsSet();
+
+    /**
+     * @brief Estimated error of the clock
+     *
+     * @return UINT32_MAX if the clock was never synced
+     */
+    uint32_t getEstimatedErrorMs();
+
+    void logStats();
+
 protected:
     const char *_ntpServer = "pool.ntp.org"; // NTP server url
-    const long _gmtOffsetSeconds = -18000; // UTC-5
-    const int  _daylightOffsetSeconds = 3600;
+    const char *_timeZone = "EST5EDT,M3.2.0,M11.1.0"; // UTC-5, daylight saving in summer
 };
 
 #endif /* end of include guard: TIMERSERVER_H_KQFGXLRA */
@@ -0,0 +1,281 @@
+#include <time.h>
+#include "esp32/ulp.h"
+#include "driver/adc.h"
+#include "driver/rtc_io.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/rtc_io_reg.h"
+#include "esp_sleep.h"
+
+#include "UlpSoilMonitor.h"
+#include "DryDownModel.h"
+#include "Logger.h"
+
+#define ULP_MONITOR_MAGIC 0x554C5053
+
+// SOIL_MOISTURE_PIN, GPIO 34
+#define ULP_SOIL_ADC_CHANNEL ADC1_CHANNEL_6
+
+// SOIL_MOISTURE_POWER_PIN, GPIO 33
+#define ULP_SOIL_POWER_RTC_IO 8
+
+// The ULP runs from the 8 MHz RTC fast clock
+#define ULP_DELAY_CYCLES_PER_MS 8000
+
+#define ULP_OVERSAMPLES (1 << ULP_OVERSAMPLE_SHIFT)
+#define ULP_DECIMATION (1 << ULP_DECIMATION_SHIFT)
+
+static_assert((4095 << ULP_OVERSAMPLE_SHIFT) <= 0xFFFF
+              && (4095 << ULP_DECIMATION_SHIFT) <= 0xFFFF,
+              "ULP soil moisture sums overflow 16 bits");
+
+enum {
+    LABEL_SETTLE,
+    LABEL_OVERSAMPLE,
+    LABEL_WAKE_THRESHOLD,
+    LABEL_WAKE_FULL,
+    LABEL_WAKE,
+    LABEL_WAIT_READY,
+    LABEL_DONE,
+};
+
+/**
+ * Monitoring state
+ */
+typedef struct {
+    //! Set to ULP_MONITOR_MAGIC while the ULP is monitoring
+    uint32_t magic;
+
+    //! time() the ULP was started
+    uint32_t startTime;
+} UlpMonitorState;
+
+RTC_DATA_ATTR static UlpMonitorState sMonitorState;
+
+UlpSoilMonitor gUlpSoilMonitor;
+
+UlpSoilMonitor::UlpSoilMonitor() :
+    _wakeReason(WAKE_REASON_NONE)
+{}
+
+uint16_t UlpSoilMonitor::readVariable(uint32_t offset)
+{
+    return RTC_SLOW_MEM[offset] & 0xFFFF;
+}
+
+void UlpSoilMonitor::writeVariable(uint32_t offset, uint16_t value)
+{
+    RTC_SLOW_MEM[offset] = value;
+}
+
+status_t UlpSoilMonitor::loadProgram()
+{
+    // R3 holds 0 throughout, the base address of the variables
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, 0),
+
+        // Power the probe and wait for its output to settle
+        I_WR_REG_BIT(RTC_GPIO_OUT_W1TS_REG,
+                     RTC_GPIO_OUT_DATA_W1TS_S + ULP_SOIL_POWER_RTC_IO, 1),
+        I_MOVI(R1, 0),
+        M_LABEL(LABEL_SETTLE),
+        I_DELAY(ULP_DELAY_CYCLES_PER_MS),
+        I_ADDI(R1, R1, 1),
+        I_MOVR(R0, R1),
+        M_BL(LABEL_SETTLE, SOIL_MOISTURE_POWER_SETTLE_MS),
+
+        // Average ULP_OVERSAMPLES ADC reads into one sample in R2
+        I_MOVI(R2, 0),
+        I_MOVI(R1, 0),
+        M_LABEL(LABEL_OVERSAMPLE),
+        I_ADC(R0, 0, ULP_SOIL_ADC_CHANNEL),
+        I_ADDR(R2, R2, R0),
+        I_ADDI(R1, R1, 1),
+        I_MOVR(R0, R1),
+        M_BL(LABEL_OVERSAMPLE, ULP_OVERSAMPLES),
+        I_RSHI(R2, R2, ULP_OVERSAMPLE_SHIFT),
+
+        I_WR_REG_BIT(RTC_GPIO_OUT_W1TC_REG,
+                     RTC_GPIO_OUT_DATA_W1TC_S + ULP_SOIL_POWER_RTC_IO, 1),
+
+        // Add it to the reading in progress, done once there are
+        // ULP_DECIMATION samples
+        I_LD(R0, R3, ULP_VAR_SUM),
+        I_ADDR(R0, R0, R2),
+        I_ST(R0, R3, ULP_VAR_SUM),
+        I_LD(R0, R3, ULP_VAR_COUNT),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, ULP_VAR_COUNT),
+        M_BL(LABEL_DONE, ULP_DECIMATION),
+
+        // Store the reading and start the next one
+        I_LD(R0, R3, ULP_VAR_SUM),
+        I_RSHI(R0, R0, ULP_DECIMATION_SHIFT),
+        I_MOVI(R1, 0),
+        I_ST(R1, R3, ULP_VAR_SUM),
+        I_ST(R1, R3, ULP_VAR_COUNT),
+        I_LD(R1, R3, ULP_VAR_NUM_READINGS),
+        I_ST(R0, R1, ULP_VAR_READINGS),
+        I_ADDI(R1, R1, 1),
+        I_ST(R1, R3, ULP_VAR_NUM_READINGS),
+
+        // The threshold less the reading overflows when the soil is drier
+        I_LD(R2, R3, ULP_VAR_WAKE_THRESHOLD),
+        I_SUBR(R2, R2, R0),
+        M_BXF(LABEL_WAKE_THRESHOLD),
+
+        I_MOVR(R0, R1),
+        M_BGE(LABEL_WAKE_FULL, ULP_BUFFER_LEN),
+        M_BX(LABEL_DONE),
+
+        M_LABEL(LABEL_WAKE_THRESHOLD),
+        I_MOVI(R0, WAKE_REASON_THRESHOLD),
+        M_BX(LABEL_WAKE),
+
+        M_LABEL(LABEL_WAKE_FULL),
+        I_MOVI(R0, WAKE_REASON_BUFFER_FULL),
+
+        M_LABEL(LABEL_WAKE),
+        I_ST(R0, R3, ULP_VAR_WAKE_REASON),
+
+        // Waking before the SoC is fully asleep is lost
+        M_LABEL(LABEL_WAIT_READY),
+        I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG, RTC_CNTL_RDY_FOR_WAKEUP_S,
+                 RTC_CNTL_RDY_FOR_WAKEUP_S),
+        M_BL(LABEL_WAIT_READY, 1),
+        I_WAKE(),
+
+        // Stop the ULP timer, the main cores start it again before sleeping
+        I_END(),
+
+        M_LABEL(LABEL_DONE),
+        I_HALT(),
+    };
+
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+
+    esp_err_t err = ulp_process_macros_and_load(ULP_PROGRAM_OFFSET, program, &size);
+    if (err != ESP_OK) {
+        LOG_ERROR("Failed to load ULP program: " + String(esp_err_to_name(err)));
+        return STATUS_FAIL;
+    }
+
+    // Past the reserved memory the program would overwrite RTC_DATA_ATTR
+    // variables
+    if ((ULP_PROGRAM_OFFSET + size) * sizeof(uint32_t)
+        > CONFIG_ESP32_ULP_COPROC_RESERVE_MEM)
+    {
+        LOG_ERROR("ULP program doesn't fit in the reserved RTC memory");
+        return STATUS_FAIL;
+    }
+
+    return STATUS_OK;
+}
+
+status_t UlpSoilMonitor::start(double waterThresholdPercent, double moisturePercent)
+{
+    status_t rc;
+
+    // Already drier than the threshold, this cycle's watering decision
+    // stands until the next timer wake
+    uint16_t threshold = ULP_THRESHOLD_DISARMED;
+    if (waterThresholdPercent >= 0 && moisturePercent > waterThresholdPercent) {
+        threshold = _soilMoisture.soilMoisturePercentToADCVal(waterThresholdPercent);
+    }
+
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten(ULP_SOIL_ADC_CHANNEL, ADC_ATTEN_DB_11);
+    adc1_ulp_enable();
+
+    rc = loadProgram();
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    writeVariable(ULP_VAR_WAKE_THRESHOLD, threshold);
+    writeVariable(ULP_VAR_SUM, 0);
+    writeVariable(ULP_VAR_COUNT, 0);
+    writeVariable(ULP_VAR_NUM_READINGS, 0);
+    writeVariable(ULP_VAR_WAKE_REASON, WAKE_REASON_NONE);
+    writeVariable(ULP_VAR_DROPPED, 0);
+
+    // Hand the probe's supply to the ULP, off between samples. The RTC
+    // peripherals stay powered in deep sleep for it and the ADC.
+    gpio_num_t powerPin = (gpio_num_t)SOIL_MOISTURE_POWER_PIN;
+    if (rtc_gpio_init(powerPin) != ESP_OK
+        || rtc_gpio_set_direction(powerPin, RTC_GPIO_MODE_OUTPUT_ONLY) != ESP_OK
+        || rtc_gpio_set_level(powerPin, 0) != ESP_OK
+        || esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON) != ESP_OK)
+    {
+        LOG_ERROR("Failed to set up the soil moisture power pin for the ULP");
+        rtc_gpio_deinit(powerPin);
+        return STATUS_FAIL;
+    }
+
+    if (ulp_set_wakeup_period(0, ULP_SAMPLE_PERIOD_MS * 1000) != ESP_OK
+        || esp_sleep_enable_ulp_wakeup() != ESP_OK
+        || ulp_run(ULP_PROGRAM_OFFSET) != ESP_OK)
+    {
+        LOG_ERROR("Failed to start ULP");
+        rtc_gpio_deinit(powerPin);
+        return STATUS_FAIL;
+    }
+
+    sMonitorState.startTime = time(nullptr);
+    sMonitorState.magic = ULP_MONITOR_MAGIC;
+
+    LOG_DEBUG("ULP monitoring soil moisture, wake threshold " + String(threshold));
+
+    return STATUS_OK;
+}
+
+status_t UlpSoilMonitor::collect()
+{
+    _wakeReason = WAKE_REASON_NONE;
+
+    if (sMonitorState.magic != ULP_MONITOR_MAGIC) {
+        return STATUS_EMPTY;
+    }
+
+    sMonitorState.magic = 0;
+
+    // Woken by the timer the ULP is still running, it would fight us for
+    // the ADC
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+
+    // Back to a digital GPIO for SoilMoisture
+    rtc_gpio_deinit((gpio_num_t)SOIL_MOISTURE_POWER_PIN);
+
+    _wakeReason = (WakeReason)readVariable(ULP_VAR_WAKE_REASON);
+
+    uint32_t numReadings = std::min(readVariable(ULP_VAR_NUM_READINGS),
+                                    (uint16_t)ULP_BUFFER_LEN);
+
+    uint32_t readingSpanS = (ULP_SAMPLE_PERIOD_MS / 1000) * ULP_DECIMATION;
+
+    // Readings the wake stub dropped to make room came first
+    uint32_t dropped = readVariable(ULP_VAR_DROPPED);
+
+    // Each reading is timestamped with the end of the samples it averages
+    for (uint32_t i = 0; i < numReadings; ++i) {
+        uint16_t adcVal = readVariable(ULP_VAR_READINGS + i);
+        uint32_t time = sMonitorState.startTime + (dropped + i + 1) * readingSpanS;
+
+        gDryDownModel.addReading(time,
+                                 _soilMoisture.soilMoistureADCValToPercent(adcVal));
+    }
+
+    if (_wakeReason == WAKE_REASON_THRESHOLD) {
+        LOG_INFO("ULP woke us, soil moisture below the watering threshold");
+    } else if (_wakeReason == WAKE_REASON_BUFFER_FULL) {
+        LOG_INFO("ULP woke us, reading buffer full");
+    }
+
+    LOG_DEBUG("Collected " + String(numReadings) + " ULP soil moisture readings");
+
+    return STATUS_OK;
+}
+
+UlpSoilMonitor::WakeReason UlpSoilMonitor::getWakeReason()
+{
+    return _wakeReason;
+}
@@ -0,0 +1,110 @@
+#ifndef ULPSOILMONITOR_H_P5KE2WNV
+#define ULPSOILMONITOR_H_P5KE2WNV
+
+#include <Arduino.h>
+#include "Status.h"
+#include "SoilMoisture.h"
+
+/*
+ * ULP program tuning, also read by scripts/ulp_soil_model.py
+ */
+
+//! Time between soil moisture samples during deep sleep
+#define ULP_SAMPLE_PERIOD_MS (10*1000)
+
+//! ADC reads averaged into each sample, as a power of 2
+#define ULP_OVERSAMPLE_SHIFT 2
+
+//! Samples averaged into each stored reading, as a power of 2. With the
+//! oversampling, 12 bit readings must still sum into 16 bits.
+#define ULP_DECIMATION_SHIFT 4
+
+//! Readings stored before the main cores are woken to collect them, a bit
+//! more than SLEEP_DRYDOWN_MAX_S worth so a normal sleep doesn't fill it
+#define ULP_BUFFER_LEN 48
+
+//! Wake threshold no 12 bit reading exceeds
+#define ULP_THRESHOLD_DISARMED 0xFFFF
+
+/**
+ * Word offsets in RTC slow memory shared with the ULP, the program is loaded
+ * after the variables. The ULP only writes the low 16 bits of a word.
+ */
+enum {
+    //! Readings above this, drier, wake the main cores
+    ULP_VAR_WAKE_THRESHOLD,
+    //! Sum of the samples of the reading in progress
+    ULP_VAR_SUM,
+    //! Samples in ULP_VAR_SUM
+    ULP_VAR_COUNT,
+    //! Readings in ULP_VAR_READINGS
+    ULP_VAR_NUM_READINGS,
+    ULP_VAR_WAKE_REASON,
+    //! Readings dropped from the start of the buffer by the wake stub
+    ULP_VAR_DROPPED,
+    ULP_VAR_READINGS,
+    ULP_PROGRAM_OFFSET = ULP_VAR_READINGS + ULP_BUFFER_LEN,
+};
+
+/*! \class UlpSoilMonitor
+ *  \brief Samples the soil moisture with the ULP coprocessor during deep
+ *  sleep
+ *
+ *  The ULP samples the soil moisture ADC every ULP_SAMPLE_PERIOD_MS,
+ *  averages the samples down to readings and stores them in RTC memory. It
+ *  wakes the main cores early when a reading is drier than the watering
+ *  threshold or the buffer fills. Otherwise the readings are collected on
+ *  the next timer wake and added to the dry down model.
+ *
+ *  The ULP powers the probe from its RTC GPIO only while sampling, the
+ *  sensor rail stays off through deep sleep.
+ */
+class UlpSoilMonitor
+{
+public:
+    enum WakeReason {
+        WAKE_REASON_NONE,
+        WAKE_REASON_THRESHOLD,
+        WAKE_REASON_BUFFER_FULL,
+    };
+
+    UlpSoilMonitor();
+
+    /**
+     * @brief Start monitoring, call right before deep sleep
+     *
+     * @param waterThresholdPercent Soil moisture to wake at, negative if not
+     * configured
+     * @param moisturePercent The latest soil moisture, the threshold is only
+     * armed while the soil is wetter than it
+     */
+    status_t start(double waterThresholdPercent, double moisturePercent);
+
+    /**
+     * @brief Stop the ULP and add its readings to the dry down model, call on
+     * wake before the ADC is used
+     *
+     * @return STATUS_EMPTY if the ULP wasn't monitoring
+     */
+    status_t collect();
+
+    /**
+     * @brief Get why the ULP woke us, valid after collect()
+     */
+    WakeReason getWakeReason();
+
+protected:
+    static uint16_t readVariable(uint32_t offset);
+    static void writeVariable(uint32_t offset, uint16_t value);
+
+    status_t loadProgram();
+
+    //! For converting between ADC readings and percentages
+    SoilMoisture _soilMoisture;
+
+    WakeReason _wakeReason;
+};
+
+extern UlpSoilMonitor gUlpSoilMonitor;
+
+#endif /* end of include guard: ULPSOILMONITOR_H_P5KE2WNV */
@@ -0,0 +1,256 @@
+#include <esp_sleep.h>
+
+#include "WakeBudget.h"
+#include "Logger.h"
+#include "config.h"
+
+#define WAKE_BUDGET_MAGIC 0x42554447
+
+#define US_PER_MS 1000ULL
+#define US_PER_S 1000000ULL
+
+// How often the supervisor checks the deadlines
+#define WAKE_BUDGET_CHECK_MS 1000
+
+// Time past its deadline a phase has to notice and give up, before the
+// supervisor decides it is stuck and forces deep sleep
+#define WAKE_BUDGET_ABORT_GRACE_MS (10*1000)
+
+/*
+ * Deadline of each phase from its start, well above a normal run so only
+ * hangs and retry storms hit them
+ */
+static const struct {
+    const char *name;
+    uint32_t budgetMs;
+} phaseBudgets[WAKE_NUM_PHASES] = {
+    { "init", 10*1000 },
+    // CCS811 warm up when it is enabled, and waiting for the radio to be
+    // quiet
+    { "sensors", 30*1000 },
+    // The network join timeout, with time for the last MQTT retry
+    { "network", 45*1000 },
+    // Two config syncs and the command
+    { "config", 20*1000 },
+    // HTTP backfill of a large outbox
+    { "publish", 60*1000 },
+    // The pump runs for at most WAKE_WATERING_MAX_S
+    { "watering", (WAKE_WATERING_MAX_S + 10)*1000 },
+    { "telnet", WAKE_TELNET_MAX_S*1000 },
+    { "sleep", 15*1000 },
+};
+
+/**
+ * Overruns and aborts
+ */
+typedef struct {
+    //! Set to WAKE_BUDGET_MAGIC once the counts are valid
+    uint32_t magic;
+
+    uint32_t overruns[WAKE_NUM_PHASES];
+    //! Aborts by the phase that was stuck, the last is running out of time
+    //! for the wake
+    uint32_t aborts[WAKE_NUM_PHASES + 1];
+
+    //! Set by an abort, cleared once logged
+    bool abortPending;
+    uint32_t lastAbortPhase;
+} WakeBudgetState;
+
+RTC_DATA_ATTR static WakeBudgetState sBudgetState;
+
+WakeBudget gWakeBudget;
+
+WakeBudget::WakeBudget()
+    : _mux(portMUX_INITIALIZER_UNLOCKED),
+      _supervisor(nullptr),
+      _wakeStartMs(0)
+{
+    for (int i = 0; i < WAKE_NUM_PHASES; ++i) {
+        _activeCount[i] = 0;
+        _startMs[i] = 0;
+        _overran[i] = false;
+        _overruns[i] = 0;
+    }
+}
+
+void WakeBudget::begin()
+{
+    if (sBudgetState.magic != WAKE_BUDGET_MAGIC) {
+        memset(&sBudgetState, 0, sizeof(sBudgetState));
+        sBudgetState.magic = WAKE_BUDGET_MAGIC;
+    }
+
+    // The wake started at boot, not here
+    _wakeStartMs = 0;
+
+    if (_supervisor != nullptr) {
+        return;
+    }
+
+    esp_timer_create_args_t args = {
+        .callback = supervisorCallback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "wake_budget",
+        .skip_unhandled_events = true,
+    };
+
+    if (esp_timer_create(&args, &_supervisor) != ESP_OK
+        || esp_timer_start_periodic(_supervisor, WAKE_BUDGET_CHECK_MS * US_PER_MS) != ESP_OK)
+    {
+        LOG_ERROR("Failed to start wake budget supervisor, wakes aren't bounded");
+    }
+}
+
+void WakeBudget::feed()
+{
+    portENTER_CRITICAL(&_mux);
+    _wakeStartMs = millis();
+    portEXIT_CRITICAL(&_mux);
+}
+
+void WakeBudget::startPhase(WakePhase phase)
+{
+    if (phase >= WAKE_NUM_PHASES) {
+        return;
+    }
+
+    portENTER_CRITICAL(&_mux);
+    if (_activeCount[phase]++ == 0) {
+        _startMs[phase] = millis();
+        _overran[phase] = false;
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+void WakeBudget::endPhase(WakePhase phase)
+{
+    if (phase >= WAKE_NUM_PHASES) {
+        return;
+    }
+
+    portENTER_CRITICAL(&_mux);
+    if (_activeCount[phase] != 0) {
+        _activeCount[phase]--;
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+uint32_t WakeBudget::remainingMs(WakePhase phase)
+{
+    if (phase >= WAKE_NUM_PHASES) {
+        return UINT32_MAX;
+    }
+
+    uint32_t remaining = UINT32_MAX;
+
+    portENTER_CRITICAL(&_mux);
+    if (_activeCount[phase] != 0) {
+        uint32_t elapsedMs = millis() - _startMs[phase];
+        remaining = elapsedMs < phaseBudgets[phase].budgetMs
+                    ? phaseBudgets[phase].budgetMs - elapsedMs : 0;
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    return remaining;
+}
+
+uint32_t WakeBudget::budgetMs(WakePhase phase)
+{
+    if (phase >= WAKE_NUM_PHASES) {
+        return 0;
+    }
+
+    return phaseBudgets[phase].budgetMs;
+}
+
+const char *WakeBudget::phaseName(WakePhase phase)
+{
+    if (phase >= WAKE_NUM_PHASES) {
+        return "wake";
+    }
+
+    return phaseBudgets[phase].name;
+}
+
+void WakeBudget::supervisorCallback(void *arg)
+{
+    static_cast<WakeBudget *>(arg)->check();
+}
+
+void WakeBudget::check()
+{
+    uint32_t now = millis();
+    int32_t stuckPhase = -1;
+
+    portENTER_CRITICAL(&_mux);
+    for (int i = 0; i < WAKE_NUM_PHASES; ++i) {
+        if (_activeCount[i] == 0) {
+            continue;
+        }
+
+        uint32_t elapsedMs = now - _startMs[i];
+        if (elapsedMs <= phaseBudgets[i].budgetMs) {
+            continue;
+        }
+
+        if (!_overran[i]) {
+            _overran[i] = true;
+            _overruns[i]++;
+            sBudgetState.overruns[i]++;
+        }
+
+        if (elapsedMs > phaseBudgets[i].budgetMs + WAKE_BUDGET_ABORT_GRACE_MS) {
+            stuckPhase = i;
+        }
+    }
+
+    if (stuckPhase < 0 && now - _wakeStartMs > WAKE_MAX_AWAKE_S * 1000) {
+        stuckPhase = WAKE_NUM_PHASES;
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    if (stuckPhase >= 0) {
+        abort((WakePhase)stuckPhase);
+    }
+}
+
+void WakeBudget::abort(WakePhase phase)
+{
+    // Nothing is logged here, the logger can block on the network and this
+    // is the esp_timer task. The abort is logged on the next wake.
+    sBudgetState.aborts[phase]++;
+    sBudgetState.lastAbortPhase = phase;
+    sBudgetState.abortPending = true;
+
+    // Outputs aren't driven in deep sleep, so the pump and the rails switch
+    // off
+    esp_sleep_enable_timer_wakeup((uint64_t)SLEEP_BASE_S * US_PER_S);
+    esp_deep_sleep_start();
+}
+
+void WakeBudget::logStats()
+{
+    if (sBudgetState.magic != WAKE_BUDGET_MAGIC) {
+        return;
+    }
+
+    if (sBudgetState.abortPending) {
+        sBudgetState.abortPending = false;
+
+        WakePhase phase = (WakePhase)sBudgetState.lastAbortPhase;
+        LOG_WARN("An earlier wake was forced to sleep, stuck in " + String(phaseName(phase))
+                 + " (" + String(sBudgetState.aborts[phase]) + " times)");
+    }
+
+    for (int i = 0; i < WAKE_NUM_PHASES; ++i) {
+        if (_overruns[i] == 0) {
+            continue;
+        }
+
+        LOG_WARN("Phase " + String(phaseBudgets[i].name) + " overran its "
+                 + String(phaseBudgets[i].budgetMs / 1000) + " s budget ("
+                 + String(sBudgetState.overruns[i]) + " times)");
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef WAKEBUDGET_H_T4HX9WQC
+#define WAKEBUDGET_H_T4HX9WQC
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "Status.h"
+
+/**
+ * Parts of a wake with a deadline
+ */
+enum WakePhase {
+    //! Preferences, config values, outbox and CLI set up
+    WAKE_PHASE_INIT,
+    //! Sensor set up and sampling
+    WAKE_PHASE_SENSORS,
+    //! WiFi association and MQTT connection, including retries
+    WAKE_PHASE_NETWORK,
+    //! Fetching config and commands
+    WAKE_PHASE_CONFIG,
+    //! Publishing readings and uploading the outbox backlog
+    WAKE_PHASE_PUBLISH,
+    WAKE_PHASE_WATERING,
+    //! A telnet session
+    WAKE_PHASE_TELNET,
+    //! Flushing publishes and setting up deep sleep
+    WAKE_PHASE_SLEEP,
+    WAKE_NUM_PHASES,
+};
+
+/*! \class WakeBudget
+ *  \brief Bounds how long each wake stays awake
+ *
+ *  Each phase has a deadline, counted from when it starts, in the table in
+ *  WakeBudget.cpp. A supervisor timer checks the active phases every
+ *  WAKE_BUDGET_CHECK_MS:
+ *
+ *  - Past its deadline a phase is expired. Code that waits or retries
+ *    checks remainingMs() and gives up, so an overrun normally costs no more
+ *    than one wait.
+ *  - A phase still running WAKE_BUDGET_ABORT_GRACE_MS after its deadline is
+ *    stuck, and the supervisor forces deep sleep. So does being awake for
+ *    WAKE_MAX_AWAKE_S, whatever the phases.
+ *
+ *  Overruns and aborts are counted per phase in RTC memory, and logged at
+ *  the end of the wake, or the next wake when the wake was aborted.
+ */
+class WakeBudget
+{
+public:
+    WakeBudget();
+
+    /**
+     * @brief Start the wake and its supervisor, call first thing on wake
+     */
+    void begin();
+
+    /**
+     * @brief Restart the awake time limit, for staying connected where each
+     * pass of the loop counts as a wake. The session is bounded by
+     * ALWAYS_CONNECTED_MAX_SESSION_S instead.
+     */
+    void feed();
+
+    /**
+     * @brief Start a phase's deadline, can be called from any task and
+     * nested, the deadline runs from the outermost start
+     */
+    void startPhase(WakePhase phase);
+
+    void endPhase(WakePhase phase);
+
+    /**
+     * @brief Time left before the phase's deadline
+     *
+     * @return 0 once expired, UINT32_MAX if the phase isn't running
+     */
+    uint32_t remainingMs(WakePhase phase);
+
+    /**
+     * @brief Deadline of a phase from its start
+     */
+    static uint32_t budgetMs(WakePhase phase);
+
+    static const char *phaseName(WakePhase phase);
+
+    /**
+     * @brief Log the phases that overran this wake, and the abort of the
+     * last wake if there was one
+     */
+    void logStats();
+
+protected:
+    static void supervisorCallback(void *arg);
+
+    /**
+     * @brief Check the deadlines, runs in the esp_timer task
+     */
+    void check();
+
+    /**
+     * @brief Force deep sleep, recording the phase that caused it
+     *
+     * @param phase WAKE_NUM_PHASES when the wake ran out of time
+     */
+    void abort(WakePhase phase);
+
+    portMUX_TYPE _mux;
+    esp_timer_handle_t _supervisor;
+
+    uint32_t _wakeStartMs;
+    uint32_t _activeCount[WAKE_NUM_PHASES];
+    uint32_t _startMs[WAKE_NUM_PHASES];
+    //! If the current run of the phase has been counted as an overrun
+    bool _overran[WAKE_NUM_PHASES];
+    //! Overruns this boot
+    uint32_t _overruns[WAKE_NUM_PHASES];
+};
+
+extern WakeBudget gWakeBudget;
+
+#endif /* end of include guard: WAKEBUDGET_H_T4HX9WQC */
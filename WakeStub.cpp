@@ -0,0 +1,239 @@
+#include "esp_sleep.h"
+#include "esp32/ulp.h"
+#include "esp32/rom/rtc.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/timer_group_reg.h"
+
+#include "WakeStub.h"
+#include "UlpSoilMonitor.h"
+#include "Logger.h"
+#include "config.h"
+
+/*
+ * Everything the stub touches must be in RTC memory, the flash cache isn't
+ * up yet. No logging, library calls or 64 bit division from the stub.
+ */
+
+#define WAKE_STUB_MAGIC 0x5354554B
+
+// Wakes due within this many RTC slow clock ticks, about 10 ms, are handled
+// by a full boot rather than a sleep too short to be worth it
+#define MIN_RESLEEP_TICKS 1500
+
+/**
+ * Flags and counters for the stub
+ */
+typedef struct {
+    //! Set to WAKE_STUB_MAGIC by arm()
+    uint32_t magic;
+
+    //! Set by arm() and cleared on a full boot, so a sleep that didn't arm
+    //! the stub, like a wake budget abort, isn't handled with stale state
+    bool armed;
+
+    //! RTC time, in slow clock ticks, of the next timer wake
+    uint64_t timerDueTicks;
+
+    //! Time between timer wakes sent back to sleep, in slow clock ticks
+    uint64_t intervalTicks;
+
+    //! RTC time, in slow clock ticks, a full boot is due whatever the soil
+    uint64_t fullBootDueTicks;
+
+    bool wateringCandidate;
+
+    //! If timer wakes are sent back to sleep while the soil doesn't change
+    bool skipTimerWakes;
+
+    //! The ADC reading of the reported soil moisture, and how far the ULP's
+    //! readings may move from it
+    uint32_t reportedSoilReading;
+    uint32_t soilReadingDelta;
+
+    //! Wakes sent back to sleep since the last full boot
+    uint32_t numStubSleeps;
+    uint32_t numTimerWakesSkipped;
+    uint32_t numThresholdsDisarmed;
+    uint32_t numBuffersTrimmed;
+} WakeStubState;
+
+RTC_DATA_ATTR static WakeStubState sWakeStubState;
+
+WakeStub gWakeStub;
+
+static uint64_t RTC_IRAM_ATTR rtcTicks()
+{
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+    }
+    SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+
+    return READ_PERI_REG(RTC_CNTL_TIME0_REG)
+           | ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32);
+}
+
+/**
+ * @brief Make room in the full ULP buffer by dropping its oldest half
+ */
+static void RTC_IRAM_ATTR trimUlpReadings()
+{
+    volatile uint32_t *mem = RTC_SLOW_MEM;
+    const uint32_t half = ULP_BUFFER_LEN / 2;
+
+    for (uint32_t i = 0; i < ULP_BUFFER_LEN - half; ++i) {
+        mem[ULP_VAR_READINGS + i] = mem[ULP_VAR_READINGS + half + i];
+    }
+
+    mem[ULP_VAR_NUM_READINGS] = ULP_BUFFER_LEN - half;
+    mem[ULP_VAR_DROPPED] = (mem[ULP_VAR_DROPPED] & 0xFFFF) + half;
+}
+
+/**
+ * @brief Check if the ULP's latest reading is still near the reported one
+ */
+static bool RTC_IRAM_ATTR soilUnchanged()
+{
+    volatile uint32_t *mem = RTC_SLOW_MEM;
+    uint32_t numReadings = mem[ULP_VAR_NUM_READINGS] & 0xFFFF;
+
+    if (numReadings == 0 || numReadings > ULP_BUFFER_LEN) {
+        return false;
+    }
+
+    uint32_t latest = mem[ULP_VAR_READINGS + numReadings - 1] & 0xFFFF;
+    uint32_t reported = sWakeStubState.reportedSoilReading;
+    uint32_t diff = latest > reported ? latest - reported : reported - latest;
+
+    return diff <= sWakeStubState.soilReadingDelta;
+}
+
+static void RTC_IRAM_ATTR wakeStub()
+{
+    esp_default_wake_deep_sleep();
+
+    if (sWakeStubState.magic != WAKE_STUB_MAGIC || !sWakeStubState.armed) {
+        return;
+    }
+
+    // Cleared until we know this wake goes back to sleep
+    sWakeStubState.armed = false;
+
+    uint32_t cause = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE);
+    uint64_t now = rtcTicks();
+
+    if (now + MIN_RESLEEP_TICKS >= sWakeStubState.fullBootDueTicks) {
+        return;
+    }
+
+    if (cause & RTC_ULP_TRIG_EN) {
+        if (now + MIN_RESLEEP_TICKS >= sWakeStubState.timerDueTicks) {
+            return;
+        }
+
+        volatile uint32_t *mem = RTC_SLOW_MEM;
+        uint32_t reason = mem[ULP_VAR_WAKE_REASON] & 0xFFFF;
+
+        if (reason == UlpSoilMonitor::WAKE_REASON_THRESHOLD) {
+            if (sWakeStubState.wateringCandidate) {
+                return;
+            }
+
+            mem[ULP_VAR_WAKE_THRESHOLD] = ULP_THRESHOLD_DISARMED;
+            sWakeStubState.numThresholdsDisarmed++;
+        } else if (reason == UlpSoilMonitor::WAKE_REASON_BUFFER_FULL) {
+            trimUlpReadings();
+            sWakeStubState.numBuffersTrimmed++;
+        } else {
+            return;
+        }
+
+        mem[ULP_VAR_WAKE_REASON] = UlpSoilMonitor::WAKE_REASON_NONE;
+
+        // The ULP stopped its timer when it woke us
+        SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+    } else if (cause & RTC_TIMER_TRIG_EN) {
+        if (!sWakeStubState.skipTimerWakes || !soilUnchanged()) {
+            return;
+        }
+
+        // The ULP kept sampling, it's only stopped when it wakes us
+        sWakeStubState.timerDueTicks = now + sWakeStubState.intervalTicks;
+        if (sWakeStubState.timerDueTicks > sWakeStubState.fullBootDueTicks) {
+            sWakeStubState.timerDueTicks = sWakeStubState.fullBootDueTicks;
+        }
+
+        sWakeStubState.numTimerWakesSkipped++;
+    } else {
+        return;
+    }
+
+    sWakeStubState.armed = true;
+    sWakeStubState.numStubSleeps++;
+
+    // The wake sources are still enabled from the last sleep, only the
+    // timer target needs setting again
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, sWakeStubState.timerDueTicks & UINT32_MAX);
+    WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, sWakeStubState.timerDueTicks >> 32);
+
+    REG_WRITE(TIMG_WDTFEED_REG(0), 1);
+
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)(uintptr_t)&wakeStub);
+    set_rtc_memory_crc();
+
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+
+    // Sleep takes a few cycles to start
+    while (true) {
+    }
+}
+
+void WakeStub::arm(uint64_t sleepUs, uint64_t intervalUs, bool wateringCandidate,
+                   double soilMoisturePercent)
+{
+    // Slow clock period in microseconds, as a fixed point number
+    uint32_t calibration = REG_READ(RTC_SLOW_CLK_CAL_REG);
+    uint64_t maxSkipUs = std::max(sleepUs, (uint64_t)WAKE_STUB_MAX_SKIP_S * 1000000);
+    uint64_t now = rtcTicks();
+
+    sWakeStubState.timerDueTicks = now + (sleepUs << RTC_CLK_CAL_FRACT) / calibration;
+    sWakeStubState.intervalTicks = (intervalUs << RTC_CLK_CAL_FRACT) / calibration;
+    sWakeStubState.fullBootDueTicks = now + (maxSkipUs << RTC_CLK_CAL_FRACT) / calibration;
+    sWakeStubState.wateringCandidate = wateringCandidate;
+
+    sWakeStubState.skipTimerWakes = !isnan(soilMoisturePercent);
+    if (sWakeStubState.skipTimerWakes) {
+        uint32_t reading = _soilMoisture.soilMoisturePercentToADCVal(soilMoisturePercent);
+        uint32_t wetter = _soilMoisture.soilMoisturePercentToADCVal(
+                              soilMoisturePercent + WAKE_STUB_SOIL_DELTA_PCT);
+
+        sWakeStubState.reportedSoilReading = reading;
+        sWakeStubState.soilReadingDelta = reading > wetter ? reading - wetter
+                                                           : wetter - reading;
+    }
+
+    sWakeStubState.armed = true;
+    sWakeStubState.magic = WAKE_STUB_MAGIC;
+
+    esp_set_deep_sleep_wake_stub(wakeStub);
+}
+
+void WakeStub::logStats()
+{
+    if (sWakeStubState.magic != WAKE_STUB_MAGIC || sWakeStubState.numStubSleeps == 0) {
+        return;
+    }
+
+    LOG_INFO("Wake stub sent " + String(sWakeStubState.numStubSleeps)
+             + " wakes back to sleep (" + String(sWakeStubState.numTimerWakesSkipped)
+             + " timer wakes without a soil moisture change, "
+             + String(sWakeStubState.numThresholdsDisarmed)
+             + " soil alarms without charge to water, "
+             + String(sWakeStubState.numBuffersTrimmed) + " ULP buffers trimmed)");
+
+    sWakeStubState.numStubSleeps = 0;
+    sWakeStubState.numTimerWakesSkipped = 0;
+    sWakeStubState.numThresholdsDisarmed = 0;
+    sWakeStubState.numBuffersTrimmed = 0;
+}
@@ -0,0 +1,57 @@
+#ifndef WAKESTUB_H_J7NQ4EXB
+#define WAKESTUB_H_J7NQ4EXB
+
+#include <Arduino.h>
+#include "SoilMoisture.h"
+
+/*! \class WakeStub
+ *  \brief Deep sleep wake stub that goes back to sleep when a wake has
+ *  nothing to do
+ *
+ *  The stub runs from RTC memory straight out of the ROM bootloader, before
+ *  the app is loaded. It checks the flags left in RTC memory and only lets
+ *  the boot continue when there is work:
+ *
+ *  - Report due: the timer woke us and the ULP's latest soil moisture
+ *    reading moved away from the last report, watering is planned, or
+ *    WAKE_STUB_MAX_SKIP_S passed since the last full boot. Without the ULP
+ *    every timer wake is a report.
+ *  - Watering candidate: the ULP saw the soil cross the watering threshold
+ *    and the battery had enough charge to water. Without the charge the
+ *    threshold is disarmed until the report.
+ *  - ULP buffer full: the oldest half of the readings is dropped to make
+ *    room, the dry down model only fits the most recent ones anyway.
+ *
+ *  Otherwise the stub sleeps until the next timer wake, restarting the ULP
+ *  if it woke us, without the bootloader, app load and init of a full boot.
+ */
+class WakeStub
+{
+public:
+    /**
+     * @brief Install the stub for the coming deep sleep, call right before it
+     *
+     * @param sleepUs Time until the timer wake
+     * @param intervalUs Time between the timer wakes the stub sends back to
+     * sleep
+     * @param wateringCandidate If a soil moisture alarm could lead to
+     * watering
+     * @param soilMoisturePercent The reported soil moisture, NAN if every
+     * timer wake has work to do
+     */
+    void arm(uint64_t sleepUs, uint64_t intervalUs, bool wateringCandidate,
+             double soilMoisturePercent);
+
+    /**
+     * @brief Log how many wakes the stub handled since the last full boot
+     */
+    void logStats();
+
+protected:
+    //! For converting the reported soil moisture to an ADC reading
+    SoilMoisture _soilMoisture;
+};
+
+extern WakeStub gWakeStub;
+
+#endif /* end of include guard: WAKESTUB_H_J7NQ4EXB */
@@ -11,19 +11,14 @@ status_t WaterPump::init()
 
 status_t WaterPump::turnOn()
 {
+    // Waits for the output capacitor on the rail to charge up
     status_t rc =
-        gPowerController.setPowerChannel(PowerController::POWER_CHANNEL_9V_12V,
-                                         true);
+        gPowerController.acquire(PowerController::POWER_CHANNEL_9V_12V,
+                                 PowerController::POWER_CONSUMER_WATER_PUMP);
     if (rc != STATUS_OK) {
       return rc;
     }
 
-    // Wait for the output capacitor on the 9/12V rail to charge up
-    // There was issues turning on the pump without the capacitor, so the
-    // capacitor should be charged up to handle spikes in current draw on
-    // startup
-    delay(100);
-
     pinMode(_pump_enable_pin, OUTPUT);
     digitalWrite(_pump_enable_pin, HIGH);
 
@@ -41,8 +36,8 @@ status_t WaterPump::turnOff()
     pinMode(_pump_enable_pin, INPUT);
 
     status_t rc =
-        gPowerController.setPowerChannel(PowerController::POWER_CHANNEL_9V_12V,
-                                         false);
+        gPowerController.release(PowerController::POWER_CHANNEL_9V_12V,
+                                 PowerController::POWER_CONSUMER_WATER_PUMP);
     if (rc != STATUS_OK) {
       return rc;
     }
@@ -0,0 +1,280 @@
+#include <time.h>
+
+#include "WateringPlanner.h"
+#include "EnergyAccounting.h"
+#include "PublishScheduler.h"
+#include "TimerServer.h"
+#include "Logger.h"
+#include "config.h"
+
+#define WATERING_PLAN_TOPIC AIO_FEED_TOPIC("watering-plan")
+
+#define WATERING_PLAN_MAGIC 0x504C414E
+
+// Weight of the newest reading in the solar power of its hour, about a week
+// of memory at a few wakes an hour
+#define SOLAR_SMOOTHING_WEIGHT 0.05f
+
+#define HOURS_PER_DAY 24
+#define SECONDS_PER_HOUR (60*60)
+
+#define BATTERY_NOMINAL_VOLTAGE_V 3.7f
+
+/**
+ * Learnt solar profile and the plan
+ */
+typedef struct {
+    //! Set to WATERING_PLAN_MAGIC once the state is valid
+    uint32_t magic;
+
+    //! Smoothed solar power by local hour, negative until first seen
+    float hourlySolarMw[HOURS_PER_DAY];
+
+    float solarMw;
+    float batterySoc;
+
+    //! If watering is needed and hasn't happened yet
+    bool pending;
+    //! When watering was first needed
+    uint32_t neededSince;
+    uint32_t plannedTime;
+
+    //! Last plan published, so only changes are published
+    char publishedPlan[PUBLISH_SCHEDULER_MAX_DEFERRED_PAYLOAD_LEN];
+} WateringPlanState;
+
+RTC_DATA_ATTR static WateringPlanState sPlanState;
+
+WateringPlanner gWateringPlanner;
+
+static const char *reasonNames[] = {
+    "solar peak",
+    "battery full",
+    "waited for sun",
+    "override",
+    "wait for sun",
+    "low battery",
+    "water hours",
+    "no clock",
+};
+
+static void initState()
+{
+    if (sPlanState.magic == WATERING_PLAN_MAGIC) {
+        return;
+    }
+
+    memset(&sPlanState, 0, sizeof(sPlanState));
+    for (int i = 0; i < HOURS_PER_DAY; ++i) {
+        sPlanState.hourlySolarMw[i] = -1;
+    }
+    sPlanState.magic = WATERING_PLAN_MAGIC;
+}
+
+void WateringPlanner::recordReadings(const SensorSnapshot &snapshot)
+{
+    initState();
+
+    // Without a reading the plan runs on the last one
+    if (snapshot.batteryValid) {
+        sPlanState.batterySoc = snapshot.batterySocPercent;
+    }
+
+    if (!snapshot.solarValid) {
+        return;
+    }
+
+    sPlanState.solarMw = snapshot.solarPanelPowermW;
+
+    if (!TimerServer::clockIsSet()) {
+        return;
+    }
+
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+
+    float *hourMw = &sPlanState.hourlySolarMw[local.tm_hour];
+    if (*hourMw < 0) {
+        *hourMw = snapshot.solarPanelPowermW;
+    } else {
+        *hourMw += SOLAR_SMOOTHING_WEIGHT * (snapshot.solarPanelPowermW - *hourMw);
+    }
+}
+
+bool WateringPlanner::inWindow(int32_t hour, int32_t windowStartHour, int32_t windowEndHour)
+{
+    return hour >= windowStartHour && hour < windowEndHour;
+}
+
+uint32_t WateringPlanner::findSunniestHour(time_t now, uint32_t maxSeconds,
+                                           int32_t windowStartHour, int32_t windowEndHour,
+                                           float *bestSolarMw)
+{
+    struct tm local;
+    localtime_r(&now, &local);
+
+    time_t hourStart = now - local.tm_min * 60 - local.tm_sec;
+    uint32_t bestTime = 0;
+    *bestSolarMw = -1;
+
+    for (int i = 0; i < HOURS_PER_DAY; ++i) {
+        time_t candidate = (i == 0) ? now : hourStart + i * SECONDS_PER_HOUR;
+        if ((uint32_t)(candidate - now) > maxSeconds) {
+            break;
+        }
+
+        int32_t hour = (local.tm_hour + i) % HOURS_PER_DAY;
+        if (!inWindow(hour, windowStartHour, windowEndHour)) {
+            continue;
+        }
+
+        // Hours not seen yet count as dark, so the earliest wins when
+        // nothing is known
+        float solarMw = std::max(sPlanState.hourlySolarMw[hour], 0.0f);
+        if (solarMw > *bestSolarMw) {
+            *bestSolarMw = solarMw;
+            bestTime = candidate;
+        }
+    }
+
+    return bestTime;
+}
+
+WateringPlanner::Plan WateringPlanner::plan(uint32_t waterSeconds, int32_t windowStartHour,
+                                            int32_t windowEndHour, double minSoc,
+                                            bool override)
+{
+    Plan plan;
+
+    initState();
+
+    time_t now = time(nullptr);
+
+    if (!sPlanState.pending) {
+        sPlanState.pending = true;
+        sPlanState.neededSince = now;
+    }
+
+    float capacityMj = WATER_BATTERY_CAPACITY_MAH * 3.6f * BATTERY_NOMINAL_VOLTAGE_V * 1000;
+    plan.pumpMj = EnergyAccounting::predictMj(ENERGY_PHASE_WATERING, waterSeconds * 1000);
+    plan.socAfter = sPlanState.batterySoc - plan.pumpMj / capacityMj * 100;
+    plan.plannedTime = 0;
+
+    struct tm local;
+    localtime_r(&now, &local);
+
+    float bestSolarMw;
+
+    if (!TimerServer::clockIsSet()) {
+        plan.decision = DECISION_DEFER;
+        plan.reason = REASON_NO_CLOCK;
+    } else if (!inWindow(local.tm_hour, windowStartHour, windowEndHour)) {
+        plan.decision = DECISION_DEFER;
+        plan.reason = REASON_OUTSIDE_WINDOW;
+        plan.plannedTime = findSunniestHour(now, HOURS_PER_DAY * SECONDS_PER_HOUR,
+                                            windowStartHour, windowEndHour, &bestSolarMw);
+    } else if (plan.socAfter < minSoc) {
+        // Retry in the sunniest hour, when the battery is most likely to
+        // have charged, checking on every wake until then
+        plan.decision = DECISION_DEFER;
+        plan.reason = REASON_LOW_ENERGY;
+        plan.plannedTime = findSunniestHour(now, HOURS_PER_DAY * SECONDS_PER_HOUR,
+                                            windowStartHour, windowEndHour, &bestSolarMw);
+    } else if (override) {
+        plan.decision = DECISION_WATER_NOW;
+        plan.reason = REASON_OVERRIDE;
+    } else if (sPlanState.batterySoc >= WATER_FULL_SOC) {
+        plan.decision = DECISION_WATER_NOW;
+        plan.reason = REASON_BATTERY_FULL;
+    } else {
+        uint32_t waitedS = now - sPlanState.neededSince;
+        uint32_t maxWaitS = waitedS < WATER_MAX_SOLAR_DEFER_S
+                            ? WATER_MAX_SOLAR_DEFER_S - waitedS : 0;
+
+        uint32_t sunniest = findSunniestHour(now, maxWaitS, windowStartHour,
+                                             windowEndHour, &bestSolarMw);
+
+        if (maxWaitS == 0) {
+            plan.decision = DECISION_WATER_NOW;
+            plan.reason = REASON_DEFER_LIMIT;
+        } else if (sunniest == (uint32_t)now
+                   || sPlanState.solarMw >= WATER_PEAK_SOLAR_FRACTION * bestSolarMw) {
+            plan.decision = DECISION_WATER_NOW;
+            plan.reason = REASON_SOLAR_PEAK;
+        } else {
+            plan.decision = DECISION_DEFER;
+            plan.reason = REASON_WAIT_FOR_SUN;
+            plan.plannedTime = sunniest;
+        }
+    }
+
+    if (plan.decision == DECISION_WATER_NOW) {
+        plan.plannedTime = now;
+    }
+    sPlanState.plannedTime = plan.plannedTime;
+
+    LOG_INFO("Watering plan: " + String(plan.decision == DECISION_WATER_NOW ? "water now" : "defer")
+             + " (" + String(reasonNames[plan.reason]) + "), pump "
+             + String(plan.pumpMj, 0) + " mJ leaves SOC " + String(plan.socAfter, 1)
+             + "%, solar " + String(sPlanState.solarMw, 0) + " mW");
+
+    publish(plan);
+
+    return plan;
+}
+
+void WateringPlanner::clear()
+{
+    initState();
+
+    sPlanState.pending = false;
+    sPlanState.plannedTime = 0;
+
+    // The next time watering is needed starts a new plan
+    sPlanState.publishedPlan[0] = '\0';
+}
+
+status_t WateringPlanner::getPlannedTime(uint32_t *time)
+{
+    if (time == nullptr) {
+        return STATUS_INVALID_PARAMS;
+    }
+
+    if (sPlanState.magic != WATERING_PLAN_MAGIC || !sPlanState.pending
+        || sPlanState.plannedTime == 0)
+    {
+        return STATUS_EMPTY;
+    }
+
+    *time = sPlanState.plannedTime;
+
+    return STATUS_OK;
+}
+
+void WateringPlanner::publish(const Plan &plan)
+{
+    char payload[PUBLISH_SCHEDULER_MAX_DEFERRED_PAYLOAD_LEN];
+
+    if (plan.decision == DECISION_WATER_NOW) {
+        snprintf(payload, sizeof(payload), "now, %s", reasonNames[plan.reason]);
+    } else if (plan.plannedTime != 0) {
+        time_t planned = plan.plannedTime;
+        struct tm local;
+        localtime_r(&planned, &local);
+
+        snprintf(payload, sizeof(payload), "%02d:%02d, %s", local.tm_hour,
+                 local.tm_min, reasonNames[plan.reason]);
+    } else {
+        snprintf(payload, sizeof(payload), "later, %s", reasonNames[plan.reason]);
+    }
+
+    if (strcmp(payload, sPlanState.publishedPlan) == 0) {
+        return;
+    }
+
+    if (gPublishScheduler.publish(WATERING_PLAN_TOPIC, payload,
+                                  PublishScheduler::PRIORITY_TELEMETRY) == STATUS_OK) {
+        strcpy(sPlanState.publishedPlan, payload);
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef WATERINGPLANNER_H_B6VN3QXJ
+#define WATERINGPLANNER_H_B6VN3QXJ
+
+#include <Arduino.h>
+#include "Status.h"
+#include "SensorSnapshot.h"
+
+/*! \class WateringPlanner
+ *  \brief Picks when, within the allowed hours, to water once the soil needs
+ *  it
+ *
+ *  The solar power of each hour of the day is learnt across days in RTC
+ *  memory. Once watering is needed it:
+ *
+ *  - Waits for the allowed hours.
+ *  - Waits while the pump, at its predicted energy, would take the battery
+ *    below the minimum SOC.
+ *  - Waits for the sunniest allowed hour, for up to WATER_MAX_SOLAR_DEFER_S,
+ *    unless the sun is already near its best or the battery is nearly full.
+ *
+ *  Watering is deferred rather than skipped, the plan is kept until the
+ *  plants are watered or the soil no longer needs it, and the sleep schedule
+ *  wakes us for it. Each new plan is published to the watering-plan feed.
+ */
+class WateringPlanner
+{
+public:
+    enum Decision {
+        DECISION_WATER_NOW,
+        DECISION_DEFER,
+    };
+
+    enum Reason {
+        //! Water now, the sun is near its best for the day
+        REASON_SOLAR_PEAK,
+        //! Water now, the battery is nearly full
+        REASON_BATTERY_FULL,
+        //! Water now, waited WATER_MAX_SOLAR_DEFER_S for sun already
+        REASON_DEFER_LIMIT,
+        //! Water now, asked for by the override
+        REASON_OVERRIDE,
+        //! Defer to a sunnier hour
+        REASON_WAIT_FOR_SUN,
+        //! Defer until the battery has the charge to water
+        REASON_LOW_ENERGY,
+        //! Defer to the allowed hours
+        REASON_OUTSIDE_WINDOW,
+        //! Defer, the clock was never set
+        REASON_NO_CLOCK,
+    };
+
+    typedef struct {
+        Decision decision;
+        Reason reason;
+
+        //! When to water, seconds since the epoch, 0 if not known
+        uint32_t plannedTime;
+
+        //! Predicted pump energy, and the SOC it would leave
+        float pumpMj;
+        float socAfter;
+    } Plan;
+
+    /**
+     * @brief Feed in the readings of a cycle
+     */
+    void recordReadings(const SensorSnapshot &snapshot);
+
+    /**
+     * @brief Plan watering the soil that needs it, and publish the plan if
+     * it changed
+     *
+     * @param waterSeconds Time the pump runs for
+     * @param windowStartHour First local hour watering is allowed
+     * @param windowEndHour Local hour watering is allowed until
+     * @param minSoc SOC the battery must stay above after watering
+     * @param override Water as soon as the window and battery allow
+     */
+    Plan plan(uint32_t waterSeconds, int32_t windowStartHour, int32_t windowEndHour,
+              double minSoc, bool override);
+
+    /**
+     * @brief Clear the plan once watered, or when the soil no longer needs
+     * water
+     */
+    void clear();
+
+    /**
+     * @brief Get when the deferred watering is planned for
+     *
+     * @return STATUS_EMPTY if no watering is deferred
+     */
+    status_t getPlannedTime(uint32_t *time);
+
+protected:
+    /**
+     * @brief Find the start of the sunniest allowed hour from now
+     *
+     * @param maxSeconds Only look this far ahead
+     * @param bestSolarMw Output, the learnt solar power of that hour
+     *
+     * @return The time, now if the current hour is the best, 0 if no hour
+     * in range is allowed
+     */
+    uint32_t findSunniestHour(time_t now, uint32_t maxSeconds, int32_t windowStartHour,
+                              int32_t windowEndHour, float *bestSolarMw);
+
+    static bool inWindow(int32_t hour, int32_t windowStartHour, int32_t windowEndHour);
+
+    void publish(const Plan &plan);
+};
+
+extern WateringPlanner gWateringPlanner;
+
+#endif /* end of include guard: WATERINGPLANNER_H_B6VN3QXJ */
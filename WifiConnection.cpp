@@ -0,0 +1,301 @@
+#include "WifiConnection.h"
+#include "Logger.h"
+#include "LinkQuality.h"
+
+#define WIFI_CACHE_MAGIC 0x57494649
+
+/**
+ * Connection cache
+ */
+typedef struct {
+    //! Set to WIFI_CACHE_MAGIC when the connection fields are valid
+    uint32_t magic;
+
+    uint8_t bssid[6];
+    int32_t channel;
+
+    uint32_t localIP;
+    uint32_t gatewayIP;
+    uint32_t subnetMask;
+    uint32_t dnsIP;
+
+    //! Number of fast connects since the lease was last renewed with DHCP
+    uint32_t fastConnectsSinceDHCP;
+
+    //! Hash of the host name of the cached host address, 0 if none
+    uint32_t hostHash;
+    uint32_t hostAddress;
+    //! When the cached host address was resolved, from time()
+    uint32_t hostResolvedTime;
+
+    /*
+     * Statistics
+     */
+    uint32_t numFastConnects;
+    uint32_t numFastConnectFailures;
+} WifiCache;
+
+RTC_DATA_ATTR static WifiCache sWifiCache;
+
+WifiConnection gWifiConnection;
+
+static void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+    gWifiConnection.handleEvent(event, info);
+}
+
+WifiConnection::WifiConnection() :
+    _events(nullptr),
+    _ssid(nullptr),
+    _password(nullptr),
+    _beginMs(0),
+    _connectTimeMs(0),
+    _fastConnect(false),
+    _eventsRegistered(false)
+{}
+
+void WifiConnection::handleEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            xEventGroupClearBits(_events, EVENT_BIT_DISCONNECTED);
+            xEventGroupSetBits(_events, EVENT_BIT_CONNECTED);
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            xEventGroupClearBits(_events, EVENT_BIT_CONNECTED);
+            xEventGroupSetBits(_events, EVENT_BIT_DISCONNECTED);
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t WifiConnection::hashHost(const char *host)
+{
+    // djb2, never 0 so 0 can mean no cached host
+    uint32_t hash = 5381;
+
+    for (const char *c = host; *c != '\0'; ++c) {
+        hash = ((hash << 5) + hash) + *c;
+    }
+
+    return hash == 0 ? 1 : hash;
+}
+
+status_t WifiConnection::beginFast()
+{
+    LOG_INFO("WiFi: fast reconnect on channel " + String(sWifiCache.channel));
+
+    if (!WiFi.config(IPAddress(sWifiCache.localIP),
+                     IPAddress(sWifiCache.gatewayIP),
+                     IPAddress(sWifiCache.subnetMask),
+                     IPAddress(sWifiCache.dnsIP)))
+    {
+        LOG_WARN("WiFi: failed to set cached IP config");
+        return STATUS_FAIL;
+    }
+
+    WiFi.begin(_ssid, _password, sWifiCache.channel, sWifiCache.bssid);
+
+    _fastConnect = true;
+
+    return STATUS_OK;
+}
+
+status_t WifiConnection::beginFull()
+{
+    LOG_INFO("WiFi: connecting to " + String(_ssid));
+
+    // An all zero config switches back to DHCP
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0),
+                IPAddress((uint32_t)0));
+
+    WiFi.begin(_ssid, _password);
+
+    _fastConnect = false;
+
+    return STATUS_OK;
+}
+
+status_t WifiConnection::begin(const char *ssid, const char *password)
+{
+    if (ssid == nullptr) {
+        LOG_ERROR("WiFi: null ssid");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    _ssid = ssid;
+    _password = password;
+
+    if (_events == nullptr) {
+        _events = xEventGroupCreate();
+        if (_events == nullptr) {
+            LOG_ERROR("WiFi: failed to create event group");
+            return STATUS_FAIL;
+        }
+    }
+
+    if (!_eventsRegistered) {
+        WiFi.onEvent(onWifiEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+        WiFi.onEvent(onWifiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        _eventsRegistered = true;
+    }
+
+    xEventGroupClearBits(_events, EVENT_BIT_CONNECTED | EVENT_BIT_DISCONNECTED);
+
+    // The connection is cached in RTC memory, don't wear the flash saving
+    // the credentials on every connect
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+
+    // Don't shout at an access point that hears us fine
+    gLinkQuality.applyTxPower();
+
+    _beginMs = millis();
+
+    if (sWifiCache.magic == WIFI_CACHE_MAGIC
+        && sWifiCache.fastConnectsSinceDHCP < FAST_CONNECTS_PER_LEASE_REFRESH
+        && beginFast() == STATUS_OK)
+    {
+        return STATUS_OK;
+    }
+
+    return beginFull();
+}
+
+status_t WifiConnection::waitForConnection(uint32_t timeoutMs)
+{
+    if (_events == nullptr) {
+        LOG_ERROR("WiFi: waiting for connection before begin");
+        return STATUS_FAIL;
+    }
+
+    if (_fastConnect) {
+        // Wait for either outcome, a disconnect means the cached access point
+        // rejected us and there is no point waiting for the timeout
+        EventBits_t bits = xEventGroupWaitBits(_events,
+                                               EVENT_BIT_CONNECTED | EVENT_BIT_DISCONNECTED,
+                                               pdFALSE, pdFALSE,
+                                               pdMS_TO_TICKS(FAST_CONNECT_TIMEOUT_MS));
+
+        if (!(bits & EVENT_BIT_CONNECTED)) {
+            LOG_WARN("WiFi: fast reconnect failed, falling back to full connect");
+            sWifiCache.numFastConnectFailures++;
+            sWifiCache.magic = 0;
+
+            WiFi.disconnect();
+            xEventGroupClearBits(_events, EVENT_BIT_CONNECTED | EVENT_BIT_DISCONNECTED);
+            beginFull();
+        }
+    }
+
+    if (!_fastConnect) {
+        EventBits_t bits = xEventGroupWaitBits(_events, EVENT_BIT_CONNECTED,
+                                               pdFALSE, pdFALSE,
+                                               pdMS_TO_TICKS(timeoutMs));
+
+        if (!(bits & EVENT_BIT_CONNECTED)) {
+            LOG_ERROR("WiFi: timed out connecting");
+            return STATUS_TIMEOUT;
+        }
+    }
+
+    _connectTimeMs = millis() - _beginMs;
+
+    if (_fastConnect) {
+        sWifiCache.numFastConnects++;
+        sWifiCache.fastConnectsSinceDHCP++;
+    } else {
+        sWifiCache.fastConnectsSinceDHCP = 0;
+    }
+
+    saveConnection();
+
+    LOG_INFO("WiFi connected in " + String(_connectTimeMs) + " ms"
+             + (_fastConnect ? " (fast)" : " (full)")
+             + ", IP address: " + WiFi.localIP().toString()
+             + ", fast reconnects " + String(sWifiCache.numFastConnects)
+             + " failed " + String(sWifiCache.numFastConnectFailures));
+
+    return STATUS_OK;
+}
+
+status_t WifiConnection::connect(const char *ssid, const char *password,
+                                 uint32_t timeoutMs)
+{
+    status_t rc = begin(ssid, password);
+    if (rc != STATUS_OK) {
+        return rc;
+    }
+
+    return waitForConnection(timeoutMs);
+}
+
+bool WifiConnection::isConnected()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+
+void WifiConnection::saveConnection()
+{
+    uint8_t *bssid = WiFi.BSSID();
+    if (bssid == nullptr) {
+        sWifiCache.magic = 0;
+        return;
+    }
+
+    memcpy(sWifiCache.bssid, bssid, sizeof(sWifiCache.bssid));
+    sWifiCache.channel = WiFi.channel();
+    sWifiCache.localIP = WiFi.localIP();
+    sWifiCache.gatewayIP = WiFi.gatewayIP();
+    sWifiCache.subnetMask = WiFi.subnetMask();
+    sWifiCache.dnsIP = WiFi.dnsIP();
+    sWifiCache.magic = WIFI_CACHE_MAGIC;
+}
+
+status_t WifiConnection::resolveHost(const char *host, IPAddress &address)
+{
+    if (host == nullptr) {
+        LOG_ERROR("WiFi: resolve got null host");
+        return STATUS_INVALID_PARAMS;
+    }
+
+    uint32_t hostHash = hashHost(host);
+
+    // The RTC clock keeps running in deep sleep, a clock that went
+    // backwards also expires the address
+    uint32_t now = time(nullptr);
+    if (sWifiCache.hostHash == hostHash
+        && now >= sWifiCache.hostResolvedTime
+        && now - sWifiCache.hostResolvedTime < HOST_CACHE_MAX_AGE_S)
+    {
+        address = IPAddress(sWifiCache.hostAddress);
+        return STATUS_OK;
+    }
+
+    if (!WiFi.hostByName(host, address)) {
+        LOG_ERROR("WiFi: failed to resolve " + String(host));
+        return STATUS_FAIL;
+    }
+
+    sWifiCache.hostHash = hostHash;
+    sWifiCache.hostAddress = address;
+    sWifiCache.hostResolvedTime = now;
+
+    return STATUS_OK;
+}
+
+void WifiConnection::invalidateHost()
+{
+    sWifiCache.hostHash = 0;
+}
+
+uint32_t WifiConnection::getConnectTimeMs()
+{
+    return _connectTimeMs;
+}
+
+bool WifiConnection::lastConnectWasFast()
+{
+    return _fastConnect;
+}
@@ -0,0 +1,122 @@
+#ifndef WIFICONNECTION_H_9DBX3LTE
+#define WIFICONNECTION_H_9DBX3LTE
+
+#include <WiFi.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "Status.h"
+
+/*! \class WifiConnection
+ *  \brief Manages the WiFi connection, reconnecting quickly after deep sleep
+ *
+ *  The access point BSSID and channel, the IP lease and resolved host
+ *  addresses are kept in RTC memory. On wake we associate directly with the
+ *  cached access point on the cached channel and reuse the cached lease,
+ *  skipping the channel scan, DHCP and DNS. If that fails we fall back to a
+ *  full connection. Connection progress is driven by WiFi events rather than
+ *  polling.
+ */
+class WifiConnection
+{
+public:
+    WifiConnection();
+
+    /**
+     * @brief Start connecting to the access point, without waiting for the
+     * connection to complete
+     *
+     * @return status
+     */
+    status_t begin(const char *ssid, const char *password);
+
+    /**
+     * @brief Wait for the connection started by begin() to complete, falling
+     * back to a full connection if the fast reconnect fails
+     *
+     * @param timeoutMs Time to wait for the full connection
+     *
+     * @return STATUS_OK once connected, STATUS_TIMEOUT otherwise
+     */
+    status_t waitForConnection(uint32_t timeoutMs);
+
+    /**
+     * @brief Connect to the access point and wait for the connection
+     */
+    status_t connect(const char *ssid, const char *password, uint32_t timeoutMs);
+
+    bool isConnected();
+
+    /**
+     * @brief Resolve a host name, using the address cached in RTC memory if we
+     * have one that was resolved less than HOST_CACHE_MAX_AGE_S ago
+     *
+     * @param host The host name to resolve
+     * @param address Output, the host address
+     *
+     * @return status
+     */
+    status_t resolveHost(const char *host, IPAddress &address);
+
+    /**
+     * @brief Drop the cached host address, e.g. after failing to connect to
+     * it, so the next lookup goes to DNS
+     */
+    void invalidateHost();
+
+    /**
+     * @brief Get the time from begin() until we had an IP address
+     *
+     * @return The time in ms
+     */
+    uint32_t getConnectTimeMs();
+
+    /**
+     * @brief Check if the last connection used the cached access point and
+     * lease
+     */
+    bool lastConnectWasFast();
+
+    /**
+     * Private, only to be used in callbacks
+     */
+    void handleEvent(arduino_event_id_t event, arduino_event_info_t info);
+
+protected:
+    enum {
+        //! Time to wait for the fast reconnect before falling back
+        FAST_CONNECT_TIMEOUT_MS = 3*1000,
+
+        //! Run DHCP after this many fast connects to renew the lease
+        FAST_CONNECTS_PER_LEASE_REFRESH = 12,
+
+        //! Look the cached host address up again after this long, in case
+        //! its DNS record changed
+        HOST_CACHE_MAX_AGE_S = 60*60,
+    };
+
+    enum {
+        EVENT_BIT_CONNECTED = (1 << 0),
+        EVENT_BIT_DISCONNECTED = (1 << 1),
+    };
+
+    status_t beginFast();
+    status_t beginFull();
+
+    void saveConnection();
+
+    uint32_t hashHost(const char *host);
+
+    EventGroupHandle_t _events;
+
+    const char *_ssid;
+    const char *_password;
+
+    uint32_t _beginMs;
+    uint32_t _connectTimeMs;
+    bool _fastConnect;
+    bool _eventsRegistered;
+};
+
+extern WifiConnection gWifiConnection;
+
+#endif /* end of include guard: WIFICONNECTION_H_9DBX3LTE */
@@ -12,8 +12,211 @@
 
 #define AIO_SERVER      "io.adafruit.com"
 #define AIO_SERVERPORT  8883                   // use 8883 for SSL, or 1883 for non secure
+#define AIO_USE_TLS     1                      // set to 0 when using port 1883
 #define AIO_USERNAME    "Rich_M"
 
+// Topic of an Adafruit IO feed, concatenated at compile time
+#define AIO_FEED_TOPIC(key) AIO_USERNAME "/feeds/" key
+
+// Adafruit IO data rate limit, 30 data points per minute on the free plan.
+// The window has a second of margin so we never trip the limit.
+#define AIO_PUBLISHES_PER_WINDOW 30
+#define AIO_RATE_LIMIT_WINDOW_MS (61*1000)
+
+/************************* Outbox *********************************/
+
+// Max size of the outbox file holding publishes that couldn't be sent, about
+// 5000 readings or a day and a half of wakes. New messages are dropped when
+// it is full. The outbox lives on the LittleFS (spiffs) data partition.
+#define OUTBOX_MAX_BYTES (256*1024)
+
+// Max size of the LAN MQTT telemetry backend's outbox, about 400 snapshots or
+// four days of wakes. It shares the partition with the outbox above.
+#define LAN_MQTT_OUTBOX_MAX_BYTES (64*1024)
+
+/************************* Sleep Schedule *********************************/
+
+// Time between wakes in normal conditions, and the limits the schedule stays
+// within
+#define SLEEP_BASE_S (5*60)
+#define SLEEP_MIN_S (2*60)
+#define SLEEP_MAX_S (30*60)
+
+// Below SLEEP_LOW_SOC percent the interval stretches, reaching SLEEP_MAX_S at
+// SLEEP_CRITICAL_SOC
+#define SLEEP_LOW_SOC 40
+#define SLEEP_CRITICAL_SOC 15
+
+// Smoothed solar power below this counts as night or heavy cloud
+#define SLEEP_DARK_SOLAR_MW 100
+
+// Local hours the interval is stretched, the clock must be set
+#define SLEEP_NIGHT_START_HOUR 21
+#define SLEEP_NIGHT_END_HOUR 6
+
+// Soil drying at least this fast is sampled more often
+#define SLEEP_FAST_DRYING_PCT_PER_H 1.5
+
+// Longest sleep when the soil is predicted to stay above the watering
+// threshold, caps how far a wrong prediction can delay watering
+#define SLEEP_DRYDOWN_MAX_S (2*60*60)
+
+/************************* Watering Planner *********************************/
+
+// Battery capacity, as set on the gas gauge, to turn the predicted pump
+// energy into SOC
+#define WATER_BATTERY_CAPACITY_MAH 2000
+
+// Within the allowed hours, watering waits for the sunniest hour of the day
+// so the pump runs off the solar panel rather than the battery. It goes
+// ahead straight away once the current solar power is this fraction of the
+// best hour's, or the battery is this full.
+#define WATER_PEAK_SOLAR_FRACTION 0.8
+#define WATER_FULL_SOC 90
+
+// Longest watering waits for more sun, it waits as long as needed for the
+// battery to have enough charge
+#define WATER_MAX_SOLAR_DEFER_S (3*60*60)
+
+/************************* Wake Budget *********************************/
+
+// Longest a wake stays awake, whatever it is doing. The supervisor forces
+// deep sleep past it. Covers a telnet session.
+#define WAKE_MAX_AWAKE_S (20*60)
+
+// Longest the pump runs in one watering, longer water times are cut short
+#define WAKE_WATERING_MAX_S (2*60)
+
+// Longest a telnet session stays open
+#define WAKE_TELNET_MAX_S (15*60)
+
+// Staying connected on a full battery isn't bounded by WAKE_MAX_AWAKE_S, each
+// pass of its loop is. This bounds the whole session instead, after which we
+// deep sleep and start again from a clean boot.
+#define ALWAYS_CONNECTED_MAX_SESSION_S (6*60*60)
+
+/************************* Clock *********************************/
+
+// NTP only runs when the clock's estimated error is over this. The error
+// grows with the time since the last sync, at the rate the RTC drift
+// correction is thought to be off.
+#define TIME_MAX_ERROR_MS 2000
+
+/************************* ULP Soil Monitor *********************************/
+
+// Sample the soil moisture with the ULP coprocessor during deep sleep, waking
+// early when it drops below the watering threshold. Sampling is tuned in
+// UlpSoilMonitor.h. The probe must be powered from SOIL_MOISTURE_POWER_PIN,
+// see SoilMoisture.h.
+#define ULP_SOIL_MONITOR 1
+
+// While the ULP monitors, the wake stub sends timer wakes back to sleep
+// without a full boot when its soil moisture readings are within
+// WAKE_STUB_SOIL_DELTA_PCT of the last report and no watering is planned. A
+// full boot still comes at least every WAKE_STUB_MAX_SKIP_S, which also
+// bounds how long config and commands wait on the server.
+#define WAKE_STUB_SOIL_DELTA_PCT 2
+#define WAKE_STUB_MAX_SKIP_S (30*60)
+
+/************************* Link Quality *********************************/
+
+// TX power is lowered until the access point is estimated to hear us at this
+// RSSI, assuming the link is symmetric
+#define LINK_TARGET_AP_RSSI_DBM (-67)
+
+// Telemetry is deferred to a later wake when the smoothed RSSI is below
+// LINK_POOR_RSSI_DBM and uplinks have cost at least LINK_DEFER_MIN_UPLINK_MJ
+// on average. Readings wait in the outbox, alarms, config and commands still
+// go over the network.
+#define LINK_POOR_RSSI_DBM (-80)
+#define LINK_DEFER_MIN_UPLINK_MJ 2000
+
+// Never defer with at least this much in the outbox, or when the last full
+// uplink was this long ago
+#define LINK_DEFER_MAX_BACKLOG_BYTES (OUTBOX_MAX_BYTES/4)
+#define LINK_MAX_DEFER_S (60*60)
+
+/************************* Power Management *********************************/
+
+// CPU frequency range for frequency scaling and automatic light sleep. The
+// network and TLS run at the max, everything else at the min. At 80 MHz and
+// above the APB clock stays at 80 MHz, so UART and I2C timing doesn't change
+// with the CPU frequency.
+#define PM_MAX_CPU_FREQ_MHZ 240
+#define PM_MIN_CPU_FREQ_MHZ 80
+
+/************************* HTTP Backfill *********************************/
+
+// Adafruit IO REST API, used to upload outbox backlogs with the time each
+// reading was taken. To test against scripts/aio_http_standin.py point
+// AIO_HTTP_SERVER at the machine running it, set AIO_HTTP_PORT to 8080 and
+// AIO_HTTP_USE_TLS to 0
+#define AIO_HTTP_SERVER   AIO_SERVER
+#define AIO_HTTP_PORT     443
+#define AIO_HTTP_USE_TLS  1
+
+// Outbox backlogs at least this large, a few wakes of readings, are uploaded
+// over HTTP with their timestamps. Smaller ones are published over MQTT.
+#define HTTP_BACKFILL_MIN_BYTES (2*1024)
+
+/************************* Telemetry Backend *********************************/
+
+// Sensor readings go to Adafruit IO, one feed per reading
+#define TELEMETRY_BACKEND_ADAFRUIT_IO 0
+// Sensor readings go to a MQTT broker on the LAN (e.g. Mosquitto), as one
+// CBOR encoded snapshot per wake on LAN_MQTT_TOPIC. Snapshots that can't be
+// sent are stored and resent once the broker is back. Config still comes from
+// AIO_SERVER, point it at the same broker with MQTT_CONFIG_DELIVERY_RETAINED
+// to run without Adafruit IO.
+#define TELEMETRY_BACKEND_LAN_MQTT 1
+
+#define TELEMETRY_BACKEND TELEMETRY_BACKEND_ADAFRUIT_IO
+
+#define LAN_MQTT_SERVER    "192.168.1.10"
+#define LAN_MQTT_PORT      1883                // use 8883 for SSL
+#define LAN_MQTT_USE_TLS   0
+#define LAN_MQTT_USERNAME  ""
+#define LAN_MQTT_PASSWORD  ""
+#define LAN_MQTT_TOPIC     "greenhouse/telemetry"
+// With TLS, define LAN_MQTT_CA_CERT as the broker's CA certificate (PEM) to
+// verify it, otherwise the broker isn't verified
+
+/************************* MQTT Config Delivery *********************************/
+
+// Config values are requested by publishing to <feed>/get and waiting for the
+// reply. This is the only mode Adafruit IO supports.
+#define MQTT_CONFIG_DELIVERY_GET 0
+// Config values are published retained, so the broker delivers the current
+// value of every config topic as part of subscribing, with no round trips.
+// To test against a local Mosquitto broker point AIO_SERVER at it, set
+// AIO_SERVERPORT to 1883 and AIO_USE_TLS to 0, and seed the config topics
+// with scripts/seed_retained_config.sh
+#define MQTT_CONFIG_DELIVERY_RETAINED 1
+
+#define MQTT_CONFIG_DELIVERY MQTT_CONFIG_DELIVERY_GET
+
+// Subscribe with one wildcard instead of a subscription per routed topic,
+// incoming messages are routed to their handlers by topic. Off by default,
+// each config and command topic is subscribed to on its own.
+//
+// A wildcard has to cover a whole topic level, and Adafruit IO feeds are all
+// on one level, so on Adafruit IO it matches every feed. The broker then
+// sends back all of our own telemetry, logs and responses, which cost radio
+// time and crowd config messages out of the receive buffer. Only turn this
+// on with a broker where the config and command topics have a level of their
+// own, and set the filter to it.
+#define MQTT_SUBSCRIBE_WILDCARD 0
+#define MQTT_SUBSCRIBE_WILDCARD_FILTER AIO_USERNAME "/feeds/+"
+
+// Keep our MQTT session on the broker between wakes (clean session off), so
+// config updates published while we sleep are queued and delivered on connect
+#define MQTT_PERSISTENT_SESSION 0
+
+// Persistent sessions need a fixed client ID, and QoS 1 subscriptions for the
+// broker to queue messages
+#define MQTT_CLIENT_ID AIO_USERNAME "-greenhouse"
+#define MQTT_CONFIG_SUBSCRIBE_QOS (MQTT_PERSISTENT_SESSION ? MQTT_QOS_1 : MQTT_QOS_0)
+
 /************************* Logging *********************************/
 #define DEFAULT_LOG_LEVEL_UART Logger::DEBUG
 
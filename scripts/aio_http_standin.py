@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Local stand-in for the Adafruit IO REST batch data endpoint, to test the
+# HTTP backfill (HTTPBackfill.cpp) without Adafruit IO.
+#
+# Point AIO_HTTP_SERVER in config.h at the machine running this, set
+# AIO_HTTP_PORT to the port below and AIO_HTTP_USE_TLS to 0. Every uploaded
+# data point is printed with its timestamp.
+#
+# Usage: aio_http_standin.py [--port 8080] [--status 200]
+#
+# --status sets the status returned for every upload, e.g. 429 to test rate
+# limiting or 500 to test a failed upload being kept in the outbox.
+
+import argparse
+import json
+import re
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+BATCH_PATH = re.compile(r"^/api/v2/([^/]+)/feeds/([^/]+)/data/batch$")
+
+
+class BatchHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    status = 200
+
+    def read_body(self):
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            body = b""
+            while True:
+                size = int(self.rfile.readline().strip(), 16)
+                if size == 0:
+                    self.rfile.readline()
+                    return body
+                body += self.rfile.read(size)
+                self.rfile.readline()
+
+        return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+    def reply(self, status, body):
+        data = json.dumps(body).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_POST(self):
+        match = BATCH_PATH.match(self.path)
+        if match is None:
+            self.read_body()
+            self.reply(404, {"error": "not found"})
+            return
+
+        username, feed = match.groups()
+        body = self.read_body()
+
+        if not self.headers.get("X-AIO-Key"):
+            self.reply(401, {"error": "missing X-AIO-Key"})
+            return
+
+        try:
+            points = json.loads(body)["data"]
+        except (ValueError, KeyError) as e:
+            print("Bad body for {}: {} ({})".format(feed, body, e))
+            self.reply(400, {"error": "bad body"})
+            return
+
+        for point in points:
+            print("{}/{} {} {}".format(username, feed,
+                                       point.get("created_at", "<now>"),
+                                       point["value"]))
+
+        if self.status != 200:
+            self.reply(self.status, {"error": "stand-in status"})
+            return
+
+        self.reply(200, [dict(point, feed_key=feed) for point in points])
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--status", type=int, default=200)
+    args = parser.parse_args()
+
+    BatchHandler.status = args.status
+
+    server = HTTPServer(("", args.port), BatchHandler)
+    print("Listening on port {}".format(args.port))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
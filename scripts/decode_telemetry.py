@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Print the CBOR telemetry snapshots published to a LAN broker with the LAN
+# MQTT telemetry backend (TELEMETRY_BACKEND_LAN_MQTT in config.h).
+#
+# Usage: mosquitto_sub -h <broker> -t greenhouse/telemetry -F %x | decode_telemetry.py
+#
+# Only decodes what LanMQTTTelemetry.cpp writes, maps of text keys to
+# unsigned, float or map values, so it needs no CBOR library.
+
+import struct
+import sys
+from datetime import datetime, timezone
+
+NAMES = {
+    "t": "time",
+    "co2": "co2 ppm",
+    "at": "air temp C",
+    "ah": "air humidity %",
+    "soc": "battery soc %",
+    "bv": "battery V",
+    "st": "soil temp C",
+    "sm": "soil moisture %",
+    "wl": "water level %",
+    "pv": "solar V",
+    "pi": "solar mA",
+    "pp": "solar mW",
+    "e": "last wake mJ",
+}
+
+
+def read_argument(data, pos, additional):
+    if additional < 24:
+        return additional, pos
+    size = {24: 1, 25: 2, 26: 4, 27: 8}[additional]
+    return int.from_bytes(data[pos:pos + size], "big"), pos + size
+
+
+def read_item(data, pos):
+    head = data[pos]
+    pos += 1
+    major, additional = head >> 5, head & 0x1F
+
+    if major == 0:
+        return read_argument(data, pos, additional)
+    if major == 3:
+        length, pos = read_argument(data, pos, additional)
+        return data[pos:pos + length].decode(), pos + length
+    if major == 5 and additional == 31:
+        return read_map(data, pos)
+    if major == 7 and additional == 26:
+        return struct.unpack(">f", data[pos:pos + 4])[0], pos + 4
+
+    raise ValueError("unsupported CBOR item 0x{:02x}".format(head))
+
+
+def read_map(data, pos):
+    """Read the entries of an indefinite length map, after its head"""
+    entries = {}
+    while data[pos] != 0xFF:
+        key, pos = read_item(data, pos)
+        value, pos = read_item(data, pos)
+        entries[key] = value
+
+    return entries, pos + 1
+
+
+def decode_snapshot(data):
+    if data[0] != 0xBF:
+        raise ValueError("not an indefinite length map")
+
+    snapshot, _ = read_map(data, 1)
+
+    return snapshot
+
+
+def format_value(value):
+    if isinstance(value, float):
+        return round(value, 2)
+    if isinstance(value, dict):
+        return "{" + ", ".join("{} {}".format(k, format_value(v)) for k, v in value.items()) + "}"
+    return value
+
+
+def main():
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            continue
+
+        data = bytes.fromhex(line)
+        try:
+            snapshot = decode_snapshot(data)
+        except (ValueError, IndexError, KeyError) as e:
+            print("Bad snapshot {}: {}".format(line, e))
+            continue
+
+        if "t" in snapshot:
+            snapshot["t"] = datetime.fromtimestamp(snapshot["t"], timezone.utc).isoformat()
+
+        print("{} bytes: ".format(len(data)) + ", ".join(
+            "{} {}".format(NAMES.get(k, k), format_value(v))
+            for k, v in snapshot.items()))
+
+
+if __name__ == "__main__":
+    main()
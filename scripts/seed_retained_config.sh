@@ -0,0 +1,22 @@
+#!/bin/sh
+# Seed a local MQTT broker (e.g. Mosquitto) with retained config values, to
+# test the retained config delivery mode (MQTT_CONFIG_DELIVERY_RETAINED in
+# config.h) without Adafruit IO.
+#
+# Usage: seed_retained_config.sh [broker host] [username]
+#
+# Publishing a new value to any of these topics while the greenhouse is asleep
+# is delivered on its next connection. With MQTT_PERSISTENT_SESSION enabled
+# publish with -q 1 so the broker also queues the update for our session.
+
+HOST=${1:-localhost}
+USERNAME=${2:-Rich_M}
+
+publish() {
+    mosquitto_pub -h "$HOST" -r -q 1 -t "$USERNAME/feeds/$1" -m "$2"
+}
+
+publish water-threshold 40
+publish water-time 30
+publish pump-control-override OFF
+publish config-version 1
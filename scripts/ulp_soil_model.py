@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+# Host model of the ULP soil moisture program in UlpSoilMonitor.cpp, to try
+# out the wake threshold and decimation settings on Linux.
+#
+# The tuning (ULP_* defines) is read from UlpSoilMonitor.h and the sensor
+# calibration from SoilMoisture.h, so edit those and rerun.
+#
+# Usage:
+#   ulp_soil_model.py simulate --start 45 --rate 1.5 --threshold 30 [--hours 4]
+#       Simulate a linear dry down with ADC noise and print each stored
+#       reading and the wake
+#   ulp_soil_model.py replay <file> --threshold 30
+#       Run raw ADC reads, one per line, through the program
+#   ulp_soil_model.py check
+#       Check the model against hand worked cases
+
+import argparse
+import os
+import random
+import re
+import sys
+
+REPO = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+WAKE_REASON_NONE = 0
+WAKE_REASON_THRESHOLD = 1
+WAKE_REASON_BUFFER_FULL = 2
+
+WAKE_REASON_NAMES = {
+    WAKE_REASON_NONE: "none",
+    WAKE_REASON_THRESHOLD: "threshold",
+    WAKE_REASON_BUFFER_FULL: "buffer full",
+}
+
+THRESHOLD_DISARMED = 0xFFFF
+
+
+def read_defines(filename):
+    defines = {}
+    with open(os.path.join(REPO, filename)) as f:
+        for line in f:
+            match = re.match(r"#define\s+(\w+)\s+(.+?)\s*(//.*)?$", line)
+            if match:
+                defines[match.group(1)] = match.group(2)
+    return defines
+
+
+def evaluate(expression):
+    # The defines used here are plain integer arithmetic
+    return int(eval(expression, {"__builtins__": {}}))
+
+
+def load_config():
+    ulp = read_defines("UlpSoilMonitor.h")
+    soil = read_defines("SoilMoisture.h")
+    return {
+        "sample_period_ms": evaluate(ulp["ULP_SAMPLE_PERIOD_MS"]),
+        "oversample_shift": evaluate(ulp["ULP_OVERSAMPLE_SHIFT"]),
+        "decimation_shift": evaluate(ulp["ULP_DECIMATION_SHIFT"]),
+        "buffer_len": evaluate(ulp["ULP_BUFFER_LEN"]),
+        "reading_air": evaluate(soil["SOIL_MOISTURE_READING_AIR"]),
+        "reading_water": evaluate(soil["SOIL_MOISTURE_READING_WATER"]),
+    }
+
+
+def map_range(value, in_min, in_max, out_min, out_max):
+    return (value - in_min) * (out_max - out_min) / (in_max - in_min) + out_min
+
+
+def adc_to_percent(config, adc):
+    # SoilMoisture::soilMoistureADCValToPercent()
+    return 100 - map_range(adc, config["reading_water"], config["reading_air"], 0, 100)
+
+
+def percent_to_adc(config, percent):
+    # SoilMoisture::soilMoisturePercentToADCVal(), truncated to an integer
+    return int(map_range(100 - percent, 0, 100,
+                         config["reading_water"], config["reading_air"]))
+
+
+class UlpModel:
+    """One run of step() is one ULP timer wake, registers are 16 bits"""
+
+    def __init__(self, config, threshold_adc):
+        self.config = config
+        self.threshold = threshold_adc & 0xFFFF
+        self.sum = 0
+        self.count = 0
+        self.readings = []
+        self.wake_reason = WAKE_REASON_NONE
+        self.running = True
+
+    def step(self, adc_reads):
+        if not self.running:
+            return None
+
+        oversamples = 1 << self.config["oversample_shift"]
+        decimation = 1 << self.config["decimation_shift"]
+        assert len(adc_reads) == oversamples
+
+        sample = (sum(adc_reads) & 0xFFFF) >> self.config["oversample_shift"]
+
+        self.sum = (self.sum + sample) & 0xFFFF
+        self.count += 1
+        if self.count < decimation:
+            return None
+
+        reading = self.sum >> self.config["decimation_shift"]
+        self.sum = 0
+        self.count = 0
+        self.readings.append(reading)
+
+        # I_SUBR sets the overflow flag when the result is negative
+        if self.threshold - reading < 0:
+            self.wake(WAKE_REASON_THRESHOLD)
+        elif len(self.readings) >= self.config["buffer_len"]:
+            self.wake(WAKE_REASON_BUFFER_FULL)
+
+        return reading
+
+    def wake(self, reason):
+        self.wake_reason = reason
+        # I_END stops the ULP timer
+        self.running = False
+
+
+def threshold_adc(config, threshold_percent, moisture_percent):
+    # UlpSoilMonitor::start() only arms the threshold while the soil is wetter
+    if threshold_percent is None or threshold_percent < 0:
+        return THRESHOLD_DISARMED
+    if moisture_percent is not None and moisture_percent <= threshold_percent:
+        return THRESHOLD_DISARMED
+    return percent_to_adc(config, threshold_percent)
+
+
+def reading_span_s(config):
+    return config["sample_period_ms"] // 1000 << config["decimation_shift"]
+
+
+def report(config, model, elapsed_s):
+    span = reading_span_s(config)
+    for i, reading in enumerate(model.readings):
+        print("{:7.0f} s  adc {:4d}  {:5.1f}%".format(
+            (i + 1) * span, reading, adc_to_percent(config, reading)))
+
+    if model.running:
+        print("no wake in {:.0f} s".format(elapsed_s))
+    else:
+        print("woke after {:.0f} s: {}".format(
+            elapsed_s, WAKE_REASON_NAMES[model.wake_reason]))
+
+
+def simulate(config, args):
+    rng = random.Random(args.seed)
+    oversamples = 1 << config["oversample_shift"]
+    period_s = config["sample_period_ms"] / 1000
+
+    model = UlpModel(config, threshold_adc(config, args.threshold, args.start))
+    elapsed_s = 0
+
+    while model.running and elapsed_s < args.hours * 3600:
+        moisture = args.start - args.rate * elapsed_s / 3600
+        adc = percent_to_adc(config, moisture)
+        reads = [min(4095, max(0, int(rng.gauss(adc, args.noise))))
+                 for _ in range(oversamples)]
+        model.step(reads)
+        elapsed_s += period_s
+
+    report(config, model, elapsed_s)
+
+
+def replay(config, args):
+    oversamples = 1 << config["oversample_shift"]
+    period_s = config["sample_period_ms"] / 1000
+
+    with open(args.file) as f:
+        reads = [int(line) for line in f if line.strip()]
+
+    model = UlpModel(config, threshold_adc(config, args.threshold, None))
+    elapsed_s = 0
+
+    for i in range(0, len(reads) - oversamples + 1, oversamples):
+        if not model.running:
+            break
+        model.step(reads[i:i + oversamples])
+        elapsed_s += period_s
+
+    report(config, model, elapsed_s)
+
+
+def check(config):
+    oversamples = 1 << config["oversample_shift"]
+    decimation = 1 << config["decimation_shift"]
+    failures = []
+
+    def expect(name, condition):
+        if not condition:
+            failures.append(name)
+
+    expect("sums fit in 16 bits",
+           4095 << config["oversample_shift"] <= 0xFFFF
+           and 4095 << config["decimation_shift"] <= 0xFFFF)
+
+    # Readings average the samples, each the average of its ADC reads
+    model = UlpModel(config, THRESHOLD_DISARMED)
+    for i in range(decimation):
+        model.step([1000 + i] * oversamples)
+    expect("decimated average",
+           model.readings == [(sum(range(1000, 1000 + decimation)) // decimation)])
+
+    # The full scale doesn't wrap
+    model = UlpModel(config, THRESHOLD_DISARMED)
+    for _ in range(decimation):
+        model.step([4095] * oversamples)
+    expect("full scale reading", model.readings == [4095])
+
+    # Drier than the threshold, a higher ADC reading, wakes on that reading
+    model = UlpModel(config, 2000)
+    for _ in range(decimation):
+        model.step([2000] * oversamples)
+    expect("at the threshold doesn't wake", model.running)
+    for _ in range(decimation):
+        model.step([2001] * oversamples)
+    expect("past the threshold wakes",
+           not model.running and model.wake_reason == WAKE_REASON_THRESHOLD)
+
+    # Disarmed, only the buffer filling wakes
+    model = UlpModel(config, THRESHOLD_DISARMED)
+    for _ in range(decimation * config["buffer_len"]):
+        model.step([4095] * oversamples)
+    expect("buffer full wakes",
+           not model.running and model.wake_reason == WAKE_REASON_BUFFER_FULL
+           and len(model.readings) == config["buffer_len"])
+
+    expect("threshold disarmed when already drier",
+           threshold_adc(config, 30, 25) == THRESHOLD_DISARMED)
+    expect("threshold round trips",
+           abs(adc_to_percent(config, percent_to_adc(config, 30)) - 30) < 0.1)
+
+    print("buffer covers {:.1f} h, a reading every {} s".format(
+        reading_span_s(config) * config["buffer_len"] / 3600,
+        reading_span_s(config)))
+
+    for name in failures:
+        print("FAIL: " + name)
+    if failures:
+        sys.exit(1)
+    print("all checks passed")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Host model of the ULP soil moisture program")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    sim = commands.add_parser("simulate")
+    sim.add_argument("--start", type=float, required=True, help="moisture %% at sleep")
+    sim.add_argument("--rate", type=float, required=True, help="drying %%/h")
+    sim.add_argument("--threshold", type=float, help="watering threshold %%")
+    sim.add_argument("--hours", type=float, default=4)
+    sim.add_argument("--noise", type=float, default=20, help="ADC noise, std dev")
+    sim.add_argument("--seed", type=int, default=1)
+
+    rep = commands.add_parser("replay")
+    rep.add_argument("file")
+    rep.add_argument("--threshold", type=float, help="watering threshold %%")
+
+    commands.add_parser("check")
+
+    args = parser.parse_args()
+    config = load_config()
+
+    if args.command == "simulate":
+        simulate(config, args)
+    elif args.command == "replay":
+        replay(config, args)
+    else:
+        check(config)
+
+
+if __name__ == "__main__":
+    main()